@@ -30,6 +30,14 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <signal.h>
+#include <endian.h>
+#include <time.h>
+#include <linux/fs.h>
 
 #ifdef USE_LARGEFILES
 #ifndef _LFS64_LARGEFILE
@@ -41,6 +49,12 @@
 #include <getopt.h>
 #endif
 
+#ifdef PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 /* should be in sync with perl script */
 #define LEVEL_NONE             0
 #define LEVEL_FATAL            10
@@ -55,6 +69,14 @@
 #define LATENCY_STAT1          2
 #define LATENCY_STAT2          10
 
+/*
+  Latency histogram: values in usecs, 16 linear buckets per power
+  of two, covering up to 2^36 usecs
+*/
+#define LATENCY_SUB_BITS       4
+#define LATENCY_MAX_BITS       36
+#define LATENCY_BUCKETS        ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
 #define MAX_PATHS              50
 
 #define KBYTE                  1024
@@ -67,6 +89,43 @@
 #define DEFAULT_DIRECTORY      "."
 #define DEFAULT_BLOCKSIZE      (4*KBYTE)
 #define DEFAULT_RAW_OFFSET     0
+#define DEFAULT_WAL_RECORDS    10000
+#define DEFAULT_WAL_RECORD_MIN 64
+#define DEFAULT_WAL_RECORD_MAX 1024
+#define DEFAULT_WAL_BATCH      256
+#define DEFAULT_REPLACE_FILES  16
+#define DEFAULT_REPLACE_OPS    1000
+#define DEFAULT_REPLACE_SIZE   (16*KBYTE)
+#define DEFAULT_DISCARD_OPS    1000
+#define DEFAULT_DISCARD_SIZE   (1*MBYTE)
+#define REPLAY_QUEUE_LENGTH    4096
+#define REPLAY_READ_RECORDS    4096
+#define REPLAY_MAX_LENGTH      (16*MBYTE)
+#define MAX_JOB_GROUPS         32
+#define MAX_BLOCK_SIZES        16
+#define DEFAULT_KNEE_MAX_THREADS 64
+#define DEFAULT_KNEE_STEP_TIME 10
+#define DEFAULT_KNEE_GAIN      10
+#define KNEE_MAX_STEPS         32
+#define DEFAULT_STEADY_ROUNDS  25
+#define DEFAULT_STEADY_WINDOW  5
+#define DEFAULT_STEADY_TIME    60
+#define DEFAULT_STEADY_BAND    20
+#define DEFAULT_STEADY_SLOPE   10
+#define MAX_STEADY_ROUNDS      100
+#define MAX_SWEEP              16
+#define MAX_AGENTS             64
+#define PATTERN_POOL_SIZE      (4*MBYTE)
+#define PATTERN_CHUNK          (4*KBYTE)  /* the block size of deduplication */
+#define PATTERN_DEDUPE_CHUNKS  64
+#define AGENT_PROTOCOL         2
+#define DEFAULT_AGENT_BIND     "127.0.0.1"
+#define JOB_NAME_LENGTH        32
+#define PERF_COUNTERS_COUNT    6
+#define MAX_SLOW_OPS           4096    /* per thread, over --slow-ms */
+#define OPLOG_RING_RECORDS     65536   /* per thread */
+#define OPLOG_WINDOW           (64*MBYTE)
+#define OPLOG_FLUSH_USECS      10000
 
 #define TRUE                   1
 #define FALSE                  0
@@ -83,6 +142,7 @@ typedef off64_t        TIO_off_t;
 #define TIO_ftruncate  ftruncate64
 #define TIO_pread      pread64
 #define TIO_pwrite     pwrite64
+#define TIO_fallocate  fallocate64
 #define OFFSET_FORMAT  "0x%Lx"
 #else
 typedef off_t          TIO_off_t;
@@ -91,11 +151,13 @@ typedef off_t          TIO_off_t;
 #define TIO_ftruncate  ftruncate
 #define TIO_pread      pread
 #define TIO_pwrite     pwrite
+#define TIO_fallocate  fallocate
 #define OFFSET_FORMAT  "0x%lx"
 #endif
 
 
 #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)  (((a) > (b)) ? (a) : (b))
 #define MMAP_CHUNK_SIZE 1073741824uLL
 
 #endif /* CONSTANTS_H */
@@ -1,7 +1,7 @@
 #!/bin/sh
 # runs bonnie and tiobench.pl until you're tired of them
 # be smart: boot with mem=16M and init 1 before running this
-# if you want half-decent numbers
+# if you want half-decent numbers, or give tiobench.pl --memlimit
 
 device=/dev/md3
 half_one=/dev/sda10
@@ -0,0 +1,198 @@
+#!/usr/bin/env perl
+#       This software may be used and distributed according to the terms of
+#       the GNU General Public License, http://www.gnu.org/copyleft/gpl.html
+#
+#    Description:
+#       Compares two result files written by tiobench.pl --results, a
+#       baseline and a new run, configuration by configuration.
+#
+#       Every metric is reported with its change against the baseline
+#       and whether that change is significant at 95% (Welch's t-test on
+#       the recorded runs; with a single run on either side there is no
+#       variance to test and the change is taken at face value).
+#
+#       Exits 1 when throughput drops or maximum (tail) latency grows by
+#       more than the thresholds with a significant change, 0 otherwise
+#       and 2 on errors, so it can gate a rollout from a script.
+
+use warnings;
+use strict;
+use Getopt::Long;
+
+my $rate_threshold    = 5;
+my $latency_threshold = 10;
+my $quiet;
+my $help;
+
+GetOptions("threshold=f",         \$rate_threshold,
+           "latency-threshold=f", \$latency_threshold,
+           "quiet",               \$quiet,
+           "help",                \$help);
+
+&usage if $help || $Getopt::Long::error || @ARGV != 2;
+
+my %names = ('read'  => 'Seq Read',  'rread'  => 'Rand Read',
+             'write' => 'Seq Write', 'rwrite' => 'Rand Write');
+
+# metric => [direction a regression moves in, gating threshold or undef]
+my %metrics = ('rate'   => [-1, $rate_threshold],
+               'maxlat' => [ 1, $latency_threshold],
+               'avglat' => [ 1, undef],
+               'cpu'    => [ 1, undef]);
+
+my ($base_id, %base) = &read_results($ARGV[0]);
+my ($new_id,  %new)  = &read_results($ARGV[1]);
+
+print "Baseline: $ARGV[0] ($base_id)\nNew:      $ARGV[1] ($new_id)\n",
+      "Regression: rate -$rate_threshold%, max latency +$latency_threshold%\n\n";
+printf("%-10s %6s %6s %3s %-7s %12s %12s %9s %4s %s\n",
+       'Test', 'Size', 'Blk', 'Thr', 'Metric', 'Baseline', 'New', 'Change',
+       'Sig', 'Verdict');
+
+my $regressions = 0;
+my @missing;
+
+foreach my $key (sort { &config_order($a, $b) } keys %base) {
+   if (!exists $new{$key}) {
+      push(@missing, "$key missing from $ARGV[1]");
+      next;
+   }
+   my ($field, $size, $block, $threads) = split(' ', $key);
+
+   foreach my $metric ('rate', 'avglat', 'maxlat', 'cpu') {
+      my $b = $base{$key}{$metric} or next;
+      my $n = $new{$key}{$metric} or next;
+      my ($direction, $threshold) = @{$metrics{$metric}};
+      my %b = &summarize(@$b);
+      my %n = &summarize(@$n);
+
+      my $change = $b{'mean'} ? 100 * ($n{'mean'} - $b{'mean'}) / $b{'mean'} : 0;
+      my $significant = &significant(\%b, \%n);
+      my $worse = $change * $direction > 0;
+      my $verdict = '';
+
+      if ($significant && $change != 0) {
+         $verdict = $worse ? 'worse' : 'better';
+         if ($worse && defined($threshold) && abs($change) > $threshold) {
+            $verdict = 'REGRESSION';
+            $regressions++;
+         }
+      }
+      next if $quiet && $verdict ne 'REGRESSION';
+
+      printf("%-10s %6s %6s %3s %-7s %12.3f %12.3f %+8.1f%% %4s %s\n",
+             $names{$field}, $size, $block, $threads, $metric, $b{'mean'},
+             $n{'mean'}, $change,
+             ($b{'n'} < 2 || $n{'n'} < 2) ? '-' : $significant ? 'yes' : 'no',
+             $verdict);
+   }
+}
+
+foreach my $key (sort keys %new) {
+   push(@missing, "$key missing from $ARGV[0]") unless exists $base{$key};
+}
+print "\n", map { "Not compared: $_\n" } @missing if @missing;
+
+print "\n", $regressions ? "$regressions regression(s)\n" : "No regressions\n";
+exit($regressions ? 1 : 0);
+
+# returns the identifier and a hash of "test size block threads" =>
+# metric => [runs]
+sub read_results {
+   my ($file) = @_;
+   my ($identifier, %results) = ('unknown');
+
+   open(RESULTS, "< $file") or &fail("Could not open $file: $!");
+   my $header = <RESULTS>;
+   &fail("$file is not a tiobench.pl --results file")
+      unless defined($header) && $header =~ /^# tiobench results 1$/;
+
+   while (my $line = <RESULTS>) {
+      chomp($line);
+      if ($line =~ /^# identifier (.*)$/) {
+         $identifier = $1;
+         next;
+      }
+      next if $line =~ /^\s*(#|$)/;
+
+      my ($field, $size, $block, $threads, $metric, $runs) = split(' ', $line);
+      &fail("$file: cannot parse \"$line\"")
+         unless defined($runs) && exists $names{$field} && exists $metrics{$metric};
+      $results{"$field $size $block $threads"}{$metric} = [split(/,/, $runs)];
+   }
+   close(RESULTS);
+   return ($identifier, %results);
+}
+
+sub config_order {
+   my ($a, $b) = @_;
+   my %order = ('read' => 0, 'rread' => 1, 'write' => 2, 'rwrite' => 3);
+   my @a = split(' ', $a);
+   my @b = split(' ', $b);
+
+   return $order{$a[0]} <=> $order{$b[0]} || $a[1] <=> $b[1] ||
+          $a[2] <=> $b[2] || $a[3] <=> $b[3];
+}
+
+sub summarize {
+   my @values = @_;
+   my %s = ('n' => scalar(@values), 'mean' => 0, 'var' => 0);
+   my $sum = 0;
+
+   $sum += $_ foreach @values;
+   $s{'mean'} = $sum / @values;
+   if (@values > 1) {
+      my $sumsq = 0;
+      $sumsq += ($_ - $s{'mean'}) ** 2 foreach @values;
+      $s{'var'} = $sumsq / (@values - 1);
+   }
+   return %s;
+}
+
+# two sided 95% critical values of Student's t by degrees of freedom
+sub t95 {
+   my ($df) = @_;
+   my @t95 = (0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+              2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110,
+              2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+              2.052, 2.048, 2.045, 2.042);
+
+   $df = 1 if $df < 1;
+   return $t95[$df] if $df < @t95;
+   return $df <= 40 ? 2.021 : $df <= 60 ? 2.000 : $df <= 120 ? 1.980 : 1.960;
+}
+
+# Welch's t-test; without runs to estimate the variance from every
+# change counts
+sub significant {
+   my ($b, $n) = @_;
+
+   return 1 if $b->{'n'} < 2 || $n->{'n'} < 2;
+
+   my $vb = $b->{'var'} / $b->{'n'};
+   my $vn = $n->{'var'} / $n->{'n'};
+   my $diff = abs($n->{'mean'} - $b->{'mean'});
+
+   return $diff > 0 if $vb + $vn == 0;
+
+   my $df = ($vb + $vn) ** 2 /
+            ($vb ** 2 / ($b->{'n'} - 1) + $vn ** 2 / ($n->{'n'} - 1));
+   return $diff / sqrt($vb + $vn) > &t95(int($df));
+}
+
+sub fail {
+   print STDERR "$_[0]\n";
+   exit(2);
+}
+
+sub usage {
+   print "Usage: $0 [<options>] BaselineResults NewResults\n","Available options:\n\t",
+            "[--help] (this help text)\n\t",
+            "[--threshold Percent] (rate drop counted as regression, default 5)\n\t",
+            "[--latency-threshold Percent] (maximum latency growth counted\n\t",
+            "          as regression, default 10)\n\t",
+            "[--quiet] (only print regressions)\n\n",
+   "Result files are written by: tiobench.pl --results File\n",
+   "Exit status is 1 if anything regressed, 2 on errors.\n";
+   exit(2);
+}
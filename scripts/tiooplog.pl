@@ -0,0 +1,191 @@
+#!/usr/bin/env perl
+#       This software may be used and distributed according to the terms of
+#       the GNU General Public License, http://www.gnu.org/copyleft/gpl.html
+#
+#    Description:
+#       Decodes operation logs written by tiotest --oplog.
+#
+#       Modes, all printing CSV:
+#         csv       every operation (the default)
+#         latency   per time interval and test: ops, MB/s, average,
+#                   99% and maximum latency
+#         heatmap   per time interval and offset range: ops and MBytes
+#         timeline  per time interval and thread: ops, MBytes and the
+#                   share of the interval the thread spent in I/O
+#
+#       The log is read a record at a time; the summaries only keep
+#       their buckets, so logs of any size decode in bounded memory.
+
+use warnings;
+use strict;
+use Getopt::Long;
+
+# must match OplogHeader/OplogRecord in tiotest.c
+my $MAGIC       = 'TIOOPLOG';
+my $VERSION     = 1;
+my $HEADER      = 'a8 V V Q< Q<';
+my $HEADER_SIZE = 32;
+my $RECORD      = 'Q< Q< V V V C x3';
+my $RECORD_SIZE = 32;
+
+my @tests = ('write', 'rwrite', 'read', 'rread');
+
+my $mode = 'csv';
+my $interval = 1;
+my $offset_mb = 64;
+my $help;
+
+GetOptions("mode=s",      \$mode,
+           "interval=f",  \$interval,
+           "offset-mb=f", \$offset_mb,
+           "help",        \$help);
+
+&usage if $help || $Getopt::Long::error || @ARGV != 1 ||
+          $interval <= 0 || $offset_mb <= 0;
+
+my %modes = (
+   'csv'      => [\&csv_header,      \&csv_record,      sub {}],
+   'latency'  => [\&latency_header,  \&latency_record,  \&latency_report],
+   'heatmap'  => [\&heatmap_header,  \&heatmap_record,  \&heatmap_report],
+   'timeline' => [\&timeline_header, \&timeline_record, \&timeline_report],
+);
+my ($header, $handler, $report) = @{$modes{$mode} || &usage};
+
+my $file = $ARGV[0];
+my $in;
+open($in, $file eq '-' ? '<&STDIN' : "< $file") or die "Could not open $file: $!";
+binmode($in);
+
+my $buffer;
+read($in, $buffer, $HEADER_SIZE) == $HEADER_SIZE or die "$file: short log header\n";
+my ($magic, $version, $size, $start_sec, $start_usec) = unpack($HEADER, $buffer);
+die "$file is not a tiotest operation log\n"
+   unless $magic eq $MAGIC && $version == $VERSION && $size == $RECORD_SIZE;
+
+my %buckets;
+
+$header->();
+while (read($in, $buffer, $RECORD_SIZE) == $RECORD_SIZE) {
+   $handler->(unpack($RECORD, $buffer));
+}
+close($in);
+$report->();
+exit(0);
+
+sub bucket {
+   my ($start) = @_;
+   return int($start / 1e9 / $interval);
+}
+
+sub csv_header {
+   print "# log started at $start_sec.", sprintf("%06d", $start_usec), "\n",
+         "start_s,thread,test,offset,size,latency_ms\n";
+}
+
+sub csv_record {
+   my ($start, $offset, $size, $duration, $thread, $test) = @_;
+   printf("%.6f,%u,%s,%u,%u,%.3f\n", $start / 1e9, $thread,
+          $tests[$test] || $test, $offset, $size, $duration / 1000);
+}
+
+# latencies go into histogram buckets of 2^(1/8) steps for percentiles
+sub latency_bucket {
+   my ($usecs) = @_;
+   return int(log($usecs + 1) / log(2) * 8);
+}
+
+sub latency_header {
+   print "time_s,test,ops,mb_per_s,avg_ms,p99_ms,max_ms\n";
+}
+
+sub latency_record {
+   my ($start, $offset, $size, $duration, $thread, $test) = @_;
+   my $bucket = $buckets{&bucket($start)}{$test} ||= { 'hist' => {} };
+
+   $bucket->{'ops'}++;
+   $bucket->{'bytes'} += $size;
+   $bucket->{'sum'} += $duration;
+   $bucket->{'max'} = $duration if !defined($bucket->{'max'}) || $duration > $bucket->{'max'};
+   $bucket->{'hist'}{&latency_bucket($duration)}++;
+}
+
+sub latency_report {
+   foreach my $t (sort { $a <=> $b } keys %buckets) {
+      foreach my $test (sort { $a <=> $b } keys %{$buckets{$t}}) {
+         my $bucket = $buckets{$t}{$test};
+         my ($seen, $p99) = (0, 0);
+
+         foreach my $h (sort { $a <=> $b } keys %{$bucket->{'hist'}}) {
+            $seen += $bucket->{'hist'}{$h};
+            # upper end of the histogram bucket
+            $p99 = 2 ** (($h + 1) / 8) - 1;
+            last if $seen >= 0.99 * $bucket->{'ops'};
+         }
+         $p99 = $bucket->{'max'} if $p99 > $bucket->{'max'};
+
+         printf("%g,%s,%u,%.3f,%.3f,%.3f,%.3f\n", $t * $interval,
+                $tests[$test] || $test, $bucket->{'ops'},
+                $bucket->{'bytes'} / 1048576 / $interval,
+                $bucket->{'sum'} / $bucket->{'ops'} / 1000, $p99 / 1000,
+                $bucket->{'max'} / 1000);
+      }
+   }
+}
+
+sub heatmap_header {
+   print "time_s,offset_mb,ops,mbytes\n";
+}
+
+sub heatmap_record {
+   my ($start, $offset, $size, $duration, $thread, $test) = @_;
+   my $bucket = $buckets{&bucket($start)}{int($offset / 1048576 / $offset_mb)} ||= {};
+
+   $bucket->{'ops'}++;
+   $bucket->{'bytes'} += $size;
+}
+
+sub heatmap_report {
+   foreach my $t (sort { $a <=> $b } keys %buckets) {
+      foreach my $o (sort { $a <=> $b } keys %{$buckets{$t}}) {
+         my $bucket = $buckets{$t}{$o};
+         printf("%g,%g,%u,%.3f\n", $t * $interval, $o * $offset_mb,
+                $bucket->{'ops'}, $bucket->{'bytes'} / 1048576);
+      }
+   }
+}
+
+sub timeline_header {
+   print "time_s,thread,tests,ops,mbytes,busy_pct\n";
+}
+
+sub timeline_record {
+   my ($start, $offset, $size, $duration, $thread, $test) = @_;
+   my $bucket = $buckets{&bucket($start)}{$thread} ||= { 'tests' => {} };
+
+   $bucket->{'ops'}++;
+   $bucket->{'bytes'} += $size;
+   $bucket->{'busy'} += $duration;
+   $bucket->{'tests'}{$tests[$test] || $test} = 1;
+}
+
+sub timeline_report {
+   foreach my $t (sort { $a <=> $b } keys %buckets) {
+      foreach my $thread (sort { $a <=> $b } keys %{$buckets{$t}}) {
+         my $bucket = $buckets{$t}{$thread};
+         printf("%g,%u,%s,%u,%.3f,%.1f\n", $t * $interval, $thread,
+                join('+', sort keys %{$bucket->{'tests'}}), $bucket->{'ops'},
+                $bucket->{'bytes'} / 1048576,
+                100 * $bucket->{'busy'} / 1e6 / $interval);
+      }
+   }
+}
+
+sub usage {
+   print "Usage: $0 [<options>] OperationLog\n","Available options:\n\t",
+            "[--help] (this help text)\n\t",
+            "[--mode csv|latency|heatmap|timeline] (default csv)\n\t",
+            "[--interval Seconds] (time buckets of the summaries, default 1)\n\t",
+            "[--offset-mb MBytes] (offset buckets of the heatmap, default 64)\n\n",
+   "Operation logs are written by: tiotest --oplog File\n";
+   exit(1);
+}
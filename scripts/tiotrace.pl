@@ -0,0 +1,209 @@
+#!/usr/bin/env perl
+#       This software may be used and distributed according to the terms of
+#       the GNU General Public License, http://www.gnu.org/copyleft/gpl.html
+#
+#    Description:
+#       Converts I/O traces into the binary trace format replayed by
+#       tiotest --replay, or dumps such a trace back as text.
+#
+#       Inputs understood:
+#         blkparse  default blkparse text output, one event per line
+#         strace    strace -f -tt (or -ttt) output of pread64, pwrite64,
+#                   fsync and fdatasync calls
+#         text      lines of "seconds stream op offset length [fsync]",
+#                   op being r, w or f
+#
+#       Input is read a line at a time and records are written as they
+#       are parsed, so traces of any size convert in constant memory.
+
+use warnings;
+use strict;
+use Getopt::Long;
+
+# must match ReplayHeader/ReplayRecord in tiotest.c
+my $MAGIC       = 'TIOTRACE';
+my $VERSION     = 1;
+my $RECORD      = 'Q< Q< V V C C x6';
+my $RECORD_SIZE = 32;
+
+my $OP_READ  = 0;
+my $OP_WRITE = 1;
+my $OP_FSYNC = 2;
+my $FLAG_FSYNC = 0x01;
+
+my $from = 'text';
+my $output;
+my $action = 'Q';
+my $fd_filter;
+my $dump;
+my $help;
+
+GetOptions("from=s",   \$from,
+           "output=s", \$output,
+           "action=s", \$action,
+           "fd=i",     \$fd_filter,
+           "dump",     \$dump,
+           "help",     \$help);
+
+&usage if $help || $Getopt::Long::error;
+
+if ($dump) {
+   &dump_trace(@ARGV);
+   exit(0);
+}
+
+my %parsers = (
+   'blkparse' => \&parse_blkparse,
+   'strace'   => \&parse_strace,
+   'text'     => \&parse_text,
+);
+my $parser = $parsers{$from} or &usage;
+
+my $out = \*STDOUT;
+if (defined($output)) {
+   open($out, '>', $output) or die "Could not create $output: $!";
+}
+binmode($out);
+print $out pack('a8 V V', $MAGIC, $VERSION, $RECORD_SIZE);
+
+my $first_time;       # timestamps are written relative to the first record
+my %streams;          # pids and the like mapped to small stream numbers
+my %pending;          # strace calls waiting for their "resumed" line
+my $records = 0;
+
+while (my $line = <>) {
+   chomp($line);
+   $parser->($line);
+}
+
+close($out) if defined($output);
+print STDERR "Wrote $records records\n";
+exit(0);
+
+sub emit {
+   my ($seconds, $stream, $op, $offset, $length, $flags) = @_;
+
+   $first_time = $seconds unless defined($first_time);
+   my $nsecs = int(($seconds - $first_time) * 1e9);
+   $nsecs = 0 if $nsecs < 0;
+
+   $streams{$stream} = scalar(keys %streams) unless exists $streams{$stream};
+
+   print $out pack($RECORD, $nsecs, $offset, $length, $streams{$stream},
+                   $op, $flags || 0);
+   $records++;
+}
+
+# "  8,0    3        1     0.000000000   697  Q  WS 223490 + 8 [kjournald]"
+sub parse_blkparse {
+   my ($line) = @_;
+   my ($dev, $cpu, $seq, $time, $pid, $act, $rwbs, $sector, $plus, $blocks) =
+      split(' ', $line);
+
+   return unless defined($rwbs) && $time =~ /^\d+\.\d+$/ && $act eq $action;
+
+   my $flags = $rwbs =~ /F/ ? $FLAG_FSYNC : 0;
+
+   if (!defined($blocks) || $plus ne '+' || $blocks == 0) {
+      &emit($time, $pid, $OP_FSYNC, 0, 0, 0) if $flags;
+      return;
+   }
+
+   if ($rwbs =~ /R/) {
+      &emit($time, $pid, $OP_READ, $sector * 512, $blocks * 512, 0);
+   } elsif ($rwbs =~ /W/) {
+      &emit($time, $pid, $OP_WRITE, $sector * 512, $blocks * 512, $flags);
+   }
+}
+
+sub strace_seconds {
+   my ($stamp) = @_;
+
+   return $stamp unless $stamp =~ /:/;       # -ttt or -r
+
+   my ($h, $m, $s) = split(/:/, $stamp);     # -t or -tt
+   return $h * 3600 + $m * 60 + $s;
+}
+
+# "1234  12:34:56.789012 pread64(3, "..."..., 4096, 8192) = 4096"
+sub parse_strace {
+   my ($line) = @_;
+
+   my ($pid, $rest) = $line =~ /^(?:\[pid\s+)?(\d+)\]?\s+(\d.*)$/ ? ($1, $2) : (0, $line);
+
+   if ($rest =~ /^(\S+)\s+(.*)<unfinished \.\.\.>\s*$/) {
+      $pending{$pid} = "$1 $2";
+      return;
+   }
+   if ($rest =~ /^\S+\s+<\.\.\. \w+ resumed>\s*(.*)$/) {
+      return unless exists $pending{$pid};
+      $rest = delete($pending{$pid}) . $1;
+   }
+
+   my ($stamp, $call) = $rest =~ /^(\d[\d:.]*)\s+(.*)$/ or return;
+   my $seconds = &strace_seconds($stamp);
+
+   if ($call =~ /^(pread64|pwrite64|pread|pwrite)\((\d+),.*,\s*(\d+),\s*(\d+)\s*\)\s*=\s*(-?\d+)/) {
+      my ($name, $fd, $count, $offset, $ret) = ($1, $2, $3, $4, $5);
+      return if $ret < 0;
+      return if defined($fd_filter) && $fd != $fd_filter;
+      &emit($seconds, $pid, $name =~ /read/ ? $OP_READ : $OP_WRITE,
+            $offset, $count, 0);
+   } elsif ($call =~ /^(fsync|fdatasync)\((\d+)\)\s*=\s*0/) {
+      return if defined($fd_filter) && $2 != $fd_filter;
+      &emit($seconds, $pid, $OP_FSYNC, 0, 0, 0);
+   }
+}
+
+# "0.001250 3 w 1048576 4096 fsync"
+sub parse_text {
+   my ($line) = @_;
+
+   return if $line =~ /^\s*(#|$)/;
+
+   my ($seconds, $stream, $op, $offset, $length, $fsync) = split(' ', $line);
+   my %ops = ('r' => $OP_READ, 'w' => $OP_WRITE, 'f' => $OP_FSYNC);
+   my $code = $ops{lc(substr($op, 0, 1))};
+
+   die "Cannot parse trace line: $line\n" unless defined($code);
+
+   &emit($seconds, $stream, $code, $offset || 0, $length || 0,
+         defined($fsync) ? $FLAG_FSYNC : 0);
+}
+
+sub dump_trace {
+   my @names = ('r', 'w', 'f');
+
+   foreach my $file (@_ ? @_ : ('-')) {
+      my $in;
+      open($in, $file eq '-' ? '<&STDIN' : "< $file") or die "Could not open $file: $!";
+      binmode($in);
+
+      my $header;
+      read($in, $header, 16) == 16 or die "$file: short trace header\n";
+      my ($magic, $version, $size) = unpack('a8 V V', $header);
+      die "$file is not a tiotest trace\n"
+         unless $magic eq $MAGIC && $version == $VERSION && $size == $RECORD_SIZE;
+
+      my $record;
+      while (read($in, $record, $RECORD_SIZE) == $RECORD_SIZE) {
+         my ($nsecs, $offset, $length, $stream, $op, $flags) = unpack($RECORD, $record);
+         printf("%.9f %u %s %u %u%s\n", $nsecs / 1e9, $stream,
+                $names[$op] || '?', $offset, $length,
+                ($flags & $FLAG_FSYNC) ? ' fsync' : '');
+      }
+      close($in);
+   }
+}
+
+sub usage {
+   print "Usage: $0 [<options>] [input files]\n","Available options:\n\t",
+            "[--help] (this help text)\n\t",
+            "[--from blkparse|strace|text] (input format, default text)\n\t",
+            "[--output TraceFile] (default standard output)\n\t",
+            "[--action A] (blkparse event to convert, default Q)\n\t",
+            "[--fd N] (strace: only calls on file descriptor N)\n\t",
+            "[--dump] (print binary traces as text)\n\n",
+   "Converted traces are replayed with: tiotest --replay TraceFile\n";
+   exit(1);
+}
@@ -65,6 +65,8 @@ my $rread_mbytes;  my $rread_time;  my $rread_utime;  my $rread_stime;
 my $num_runs;      my $run_number;  my $help;         my $nofrag;
 my $identifier;    my $debug;       my $dump;         my $progress;
 my $timeout;       my $rawdev;      my $flushCaches;  my $directIO;
+my $sweep;         my $ci_target;   my $max_runs;     my $keep_outliers;
+my $results_file; my $mem_limit;
 
 # option parsing
 GetOptions("target=s@",\@targets,
@@ -81,7 +83,13 @@ GetOptions("target=s@",\@targets,
            "progress",\$progress,
            "threads=i@",\@threads,
            "flushCaches", \$flushCaches,
-           "directio", \$directIO,);
+           "directio", \$directIO,
+           "sweep", \$sweep,
+           "ci=f", \$ci_target,
+           "maxruns=i", \$max_runs,
+           "keep-outliers", \$keep_outliers,
+           "results=s", \$results_file,
+           "memlimit=i", \$mem_limit,);
 
 &usage if $help || $Getopt::Long::error;
 
@@ -89,6 +97,8 @@ my $start_time = time if $timeout;
 
 ### DEFAULT VALUES
 $num_runs=1 unless $num_runs && $num_runs > 0;
+$max_runs=30 unless $max_runs;
+$max_runs=$num_runs if $max_runs < $num_runs;
 @targets=qw(.) unless @targets;
 @blocks=qw(4096) unless @blocks;
 @threads=qw(1 2 4 8) unless @threads;
@@ -98,6 +108,7 @@ $debug=$LEVEL_NONE unless defined($debug);
 unless(@sizes) { # try to be a little smart about file size when possible
    my $mem_size = &get_memory_size();
    $mem_size = int($mem_size/$MB); # convert to MB
+   $mem_size = $mem_limit if $mem_limit && $mem_limit < $mem_size;
    my $use_size=2*($mem_size);         # try to use at least twice memory
 
    # used to cap the value between 200 MB and about 2 GB
@@ -171,55 +182,56 @@ if(&all_devices(@targets)) {
    print STDERR "--target params must be either all devices or all directories\n";
    exit(1);
 }
+$targets_str .= " -W" if $nofrag;
+$targets_str .= " -R" if $rawdev;
+$targets_str .= " -D $debug" if $debug > 0;
+$targets_str .= " -F" if $flushCaches;
+$targets_str .= " -X" if $directIO;
+$targets_str .= " --mem-limit ${mem_limit}m" if $mem_limit;
 
 # run all the possible combinations/permutations/whatever
 OUTER:
 foreach $size (@sizes) {
+   if ($sweep) {
+      # one tiotest per size writes the data set once for all
+      # combinations; -f and -r are given for the most threads and
+      # tiotest spreads the same data and ops over fewer ones
+      my $max_thread = (sort { $b <=> $a } @threads)[0];
+      my $thread_rand=int($random_ops/$max_thread);
+      my $thread_size=int($size/$max_thread); $thread_size=1 if $thread_size==0;
+      my $run_string = "$tiotest --sweep-threads " . join(',', @threads) .
+                       " --sweep-blocks " . join(',', @blocks) .
+                       " -f $thread_size -r $thread_rand $targets_str -T";
+      my @combinations = map { my $b = $_; map { [$_, $b] } @threads } @blocks;
+      $run_number = 0;
+      do {
+         &run_tiotest($run_string, $size);
+         $total_runs_completed += scalar(@combinations);
+         $progressbar->update($total_runs_completed) if $progress;
+      } until (&enough_runs(++$run_number, $size, @combinations));
+      foreach $block (@blocks) {
+         foreach $thread (@threads) {
+            &compute_rates($size, $thread, $block);
+         }
+      }
+      if($timeout && (time > ($start_time + $timeout))) {
+         print STDERR "\nTimeout of $timeout seconds has been reached, aborting\n";
+         last OUTER;
+      }
+      next;
+   }
    foreach $block (@blocks) {
       foreach $thread (@threads) {
          my $thread_rand=int($random_ops/$thread);
          my $thread_size=int($size/$thread); $thread_size=1 if $thread_size==0;
          my $run_string = "$tiotest -t $thread -f $thread_size ".
                           "-r $thread_rand -b $block $targets_str -T";
-         $run_string .= " -W" if $nofrag;
-         $run_string .= " -R" if $rawdev;
-         $run_string .= " -D $debug" if $debug > 0;
-         $run_string .= " -F" if $flushCaches;
-         $run_string .= " -X" if $directIO;
-         foreach $run_number (1..$num_runs) {
-            print "Running: $run_string\n"
-               if $debug >= $LEVEL_INFO;
-            open(TIOTEST,"$run_string |") or die "Could not run $tiotest";
-
-            while(my $line = <TIOTEST>) {
-               next if $line =~ /^total/o; # this may be useful, but it's been ignored up to this point.
-               print "Processing output line of $line"
-                  if $debug >= $LEVEL_INFO;
-               my ($field,$amount,$time,$utime,$stime,$avglat,$maxlat,$pct_gt_2_sec,$pct_gt_10_sec)=split(/[:,]/, $line);
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'amount'} += $amount;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'}   += $time;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'utime'}  += $utime;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'stime'}  += $stime;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'avglat'} += $avglat;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'maxlat'} += $maxlat;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'pct_gt_2_sec'}  += $pct_gt_2_sec;
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'pct_gt_10_sec'} += $pct_gt_10_sec;
-            }
-            close(TIOTEST);
+         $run_number = 0;
+         do {
+            &run_tiotest($run_string, $size, $thread, $block);
             $progressbar->update(++$total_runs_completed) if $progress;
-         }
-         for my $field ('read','rread','write','rwrite') {
-            $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'rate'} =
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'amount'} /
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'};
-            $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'cpu'} =
-               100 * ( $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'utime'} +
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'stime'} ) /
-               $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'};
-            $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'cpueff'} =
-               ($stat_data{$identifier}{$thread}{$size}{$block}{$field}{'rate'} /
-               ($stat_data{$identifier}{$thread}{$size}{$block}{$field}{'cpu'}/100+0.00001));
-         }
+         } until (&enough_runs(++$run_number, $size, [$thread, $block]));
+         &compute_rates($size, $thread, $block);
          if($timeout && (time > ($start_time + $timeout))) {
             print STDERR "\nTimeout of $timeout seconds has been reached, aborting ($total_runs_completed of $total_runs runs completed)\n";
             last OUTER;
@@ -228,6 +240,8 @@ foreach $size (@sizes) {
    }
 }
 
+&write_results($results_file) if $results_file;
+
 if ($dump) {
    require Data::Dumper;
    print Data::Dumper->Dump([\%stat_data], [qw(stat_data)]);
@@ -257,6 +271,13 @@ my %report = (
 # The top is the same for all 4 reports
 $^ = 'SEQ_READS_TOP';
 
+my %report_field = (
+   'SEQ_READS'   => 'read',
+   'RAND_READS'  => 'rread',
+   'SEQ_WRITES'  => 'write',
+   'RAND_WRITES' => 'rwrite',
+);
+
 foreach my $title ('SEQ_READS', 'RAND_READS', 'SEQ_WRITES', 'RAND_WRITES') {
    $-=0; $~="$title"; $^L=''; # reporting variables
    print "\n$report{$title}\n";
@@ -264,16 +285,210 @@ foreach my $title ('SEQ_READS', 'RAND_READS', 'SEQ_WRITES', 'RAND_WRITES') {
    foreach $size (@sizes) {
       foreach $block (@blocks) {
          foreach $thread (@threads) {
-            write if defined($stat_data{$identifier}{$thread}{$size}{$block});
+            write if defined($stat_data{$identifier}{$thread}{$size}{$block}{$report_field{$title}}{'rate'});
          }
       }
    }
 }
 
+&print_statistics();
+
 ###########################################
 ######### Utility subroutines #############
 ###########################################
 
+# runs tiotest once, adding its terse output to %stat_data. With
+# --sweep-threads/--sweep-blocks tiotest prints a "sweep:threads,block"
+# line before every combination instead of them being passed in.
+sub run_tiotest {
+   my ($run_string, $size, $thread, $block) = @_;
+
+   print "Running: $run_string\n"
+      if $debug >= $LEVEL_INFO;
+   open(TIOTEST,"$run_string |") or die "Could not run $tiotest";
+
+   while(my $line = <TIOTEST>) {
+      next if $line =~ /^total/o; # this may be useful, but it's been ignored up to this point.
+      next if $line =~ /^memory:/;
+      print "Processing output line of $line"
+         if $debug >= $LEVEL_INFO;
+      if ($line =~ /^sweep:(\d+),(\d+)/) {
+         ($thread, $block) = ($1, $2);
+         next;
+      }
+      my ($field,$amount,$time,$utime,$stime,$avglat,$maxlat,$pct_gt_2_sec,$pct_gt_10_sec)=split(/[:,]/, $line);
+      next unless $time > 0; # phases a sweep combination did not run
+      push(@{$stat_data{$identifier}{$thread}{$size}{$block}{$field}{'runs'}},
+           { 'rate'   => $amount / $time,
+             'cpu'    => 100 * ($utime + $stime) / $time,
+             'avglat' => $avglat,
+             'maxlat' => $maxlat });
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'amount'} += $amount;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'}   += $time;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'utime'}  += $utime;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'stime'}  += $stime;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'avglat'} += $avglat;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'maxlat'} += $maxlat;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'pct_gt_2_sec'}  += $pct_gt_2_sec;
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'pct_gt_10_sec'} += $pct_gt_10_sec;
+   }
+   close(TIOTEST);
+}
+
+sub compute_rates {
+   my ($size, $thread, $block) = @_;
+
+   for my $field ('read','rread','write','rwrite') {
+      next unless $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'};
+      # latencies and shares are per run, so average them over the runs
+      my $runs = scalar(@{$stat_data{$identifier}{$thread}{$size}{$block}{$field}{'runs'}});
+      for my $key ('avglat','maxlat','pct_gt_2_sec','pct_gt_10_sec') {
+         $stat_data{$identifier}{$thread}{$size}{$block}{$field}{$key} /= $runs;
+      }
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'rate'} =
+         $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'amount'} /
+         $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'};
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'cpu'} =
+         100 * ( $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'utime'} +
+         $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'stime'} ) /
+         $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'time'};
+      $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'cpueff'} =
+         ($stat_data{$identifier}{$thread}{$size}{$block}{$field}{'rate'} /
+         ($stat_data{$identifier}{$thread}{$size}{$block}{$field}{'cpu'}/100+0.00001));
+   }
+}
+
+# runs are repeated until there are --numruns of them and, with --ci, the
+# 95% confidence interval of every rate is within the target percentage
+# of its mean (or --maxruns is reached)
+sub enough_runs {
+   my ($runs, $size, @combinations) = @_;
+
+   return 0 if $runs < $num_runs;
+   return 1 if !$ci_target || $runs >= $max_runs;
+
+   foreach my $combination (@combinations) {
+      my ($thread, $block) = @$combination;
+      foreach my $field ('read','rread','write','rwrite') {
+         my $samples = $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'runs'} or next;
+         my %s = &summarize(map { $_->{'rate'} } @$samples);
+         return 0 unless $s{'n'} > 1 && $s{'mean'} > 0 &&
+                         100 * $s{'ci'} / $s{'mean'} <= $ci_target;
+      }
+   }
+   return 1;
+}
+
+# two sided 95% critical values of Student's t by degrees of freedom
+my @t95 = (0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+           2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+           2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+           2.048, 2.045, 2.042);
+
+sub t95 {
+   my ($df) = @_;
+   return $t95[$df] if $df < @t95;
+   return $df <= 40 ? 2.021 : $df <= 60 ? 2.000 : $df <= 120 ? 1.980 : 1.960;
+}
+
+# flags values whose modified z-score (distance from the median in
+# units of median absolute deviation) is above 3.5
+sub outliers {
+   my @values = @_;
+   my @sorted = sort { $a <=> $b } @values;
+   my $median = ($sorted[$#sorted / 2] + $sorted[@sorted / 2]) / 2;
+   my @deviations = sort { $a <=> $b } map { abs($_ - $median) } @values;
+   my $mad = ($deviations[$#deviations / 2] + $deviations[@deviations / 2]) / 2;
+
+   return map { 0 } @values if $mad == 0 || @values < 3;
+   return map { abs(0.6745 * ($_ - $median) / $mad) > 3.5 ? 1 : 0 } @values;
+}
+
+# mean, stddev and 95% confidence half width, without the outliers
+# unless --keep-outliers
+sub summarize {
+   my @values = @_;
+   my @flags = &outliers(@values);
+   my @kept = $keep_outliers ? @values : map { $flags[$_] ? () : $values[$_] } 0..$#values;
+   my %s = ('n' => scalar(@kept), 'outliers' => scalar(grep { $_ } @flags),
+            'mean' => 0, 'stddev' => 0, 'ci' => 0);
+
+   return %s unless @kept;
+
+   my $sum = 0; $sum += $_ foreach @kept;
+   $s{'mean'} = $sum / @kept;
+   return %s unless @kept > 1;
+
+   my $sumsq = 0; $sumsq += ($_ - $s{'mean'}) ** 2 foreach @kept;
+   $s{'stddev'} = sqrt($sumsq / (@kept - 1));
+   $s{'ci'} = &t95(@kept - 1) * $s{'stddev'} / sqrt(@kept);
+   return %s;
+}
+
+sub print_statistics {
+   my %names = ('write' => 'Seq Write', 'rwrite' => 'Rand Write',
+                'read'  => 'Seq Read',  'rread'  => 'Rand Read');
+   my $header = 0;
+
+   foreach my $field ('read', 'rread', 'write', 'rwrite') {
+      foreach $size (@sizes) {
+         foreach $block (@blocks) {
+            foreach $thread (@threads) {
+               my $samples = $stat_data{$identifier}{$thread}{$size}{$block}{$field}{'runs'};
+               next unless $samples && @$samples > 1;
+
+               if (!$header++) {
+                  my $title = "Statistics over runs (95% confidence, outliers " .
+                              ($keep_outliers ? "kept" : "excluded") . ")";
+                  print "\n$title\n", '=' x length($title), "\n";
+                  printf("%-28s %-10s %6s %6s %3s %-8s %4s %12s %12s %12s %4s\n",
+                         'Identifier', 'Test', 'Size', 'Blk', 'Thr', 'Metric',
+                         'Runs', 'Mean', 'Stddev', 'CI95 +/-', 'Out');
+               }
+
+               foreach my $metric ('rate', 'cpu', 'avglat', 'maxlat') {
+                  my @values = map { $_->{$metric} } @$samples;
+                  my %s = &summarize(@values);
+                  printf("%-28s %-10s %6s %6s %3s %-8s %4d %12.3f %12.3f %12.3f %4d\n",
+                         $identifier, $names{$field}, $size, $block, $thread,
+                         $metric, $s{'n'}, $s{'mean'}, $s{'stddev'}, $s{'ci'},
+                         $s{'outliers'});
+               }
+
+               my @flags = &outliers(map { $_->{'rate'} } @$samples);
+               my @runs = grep { $flags[$_] } 0..$#flags;
+               print "   outlier runs by rate: ", join(', ', map { $_ + 1 } @runs), "\n"
+                  if @runs;
+            }
+         }
+      }
+   }
+}
+
+# writes the samples of every run for scripts/tiocompare.pl, one line
+# per test, size, block, threads and metric
+sub write_results {
+   my ($file) = @_;
+
+   open(RESULTS, "> $file") or die "Could not create $file: $!";
+   print RESULTS "# tiobench results 1\n# identifier $identifier\n",
+                 "# test size block threads metric run,run,...\n";
+   foreach my $field ('read', 'rread', 'write', 'rwrite') {
+      foreach my $s (@sizes) {
+         foreach my $b (@blocks) {
+            foreach my $t (@threads) {
+               my $samples = $stat_data{$identifier}{$t}{$s}{$b}{$field}{'runs'} or next;
+               foreach my $metric ('rate', 'cpu', 'avglat', 'maxlat') {
+                  print RESULTS "$field $s $b $t $metric ",
+                     join(',', map { sprintf("%.6f", $_->{$metric}) } @$samples), "\n";
+               }
+            }
+         }
+      }
+   }
+   close(RESULTS);
+}
+
 sub usage {
    print "Usage: $0 [<options>]\n","Available options:\n\t",
             "[--help] (this help text)\n\t",
@@ -282,6 +497,11 @@ sub usage {
             "[--raw] (use raw device defined with --dir)\n\t",
             "[--size SizeInMB]+\n\t",
             "[--numruns NumberOfRuns]\n\t",
+            "[--ci Percent] (repeat until the 95% confidence interval of\n\t",
+            "          every rate is within Percent of its mean)\n\t",
+            "[--maxruns NumberOfRuns] (limit for --ci, default 30)\n\t",
+            "[--keep-outliers] (use outlier runs in the statistics)\n\t",
+            "[--results File] (save every run for scripts/tiocompare.pl)\n\t",
             "[--target DirOrDisk]+\n\t",
             "[--block BlkSizeInBytes]+\n\t",
             "[--random NumberRandOpsAllThreads]+\n\t",
@@ -290,16 +510,21 @@ sub usage {
             "[--progress] (monitor progress with Term::ProgressBar)\n\t",
             "[--timeout TimeoutInSeconds]\n\t",
             "[--flushCaches] (requires root)\n\t",
+            "[--memlimit MBytes] (run tiotest in a memory cgroup of MBytes,\n\t",
+            "          default sizes are then twice that, requires root)\n\t",
+            "[--sweep] (one tiotest per size, files written once for all\n\t",
+            "          threads and blocks)\n\t",
             "[--debug DebugLevel]\n\n",
    "+ means you can specify this option multiple times to cover multiple\n",
    "cases, for instance: $0 --block 4096 --block 8192 will first run\n",
    "through with a 4KB block size and then again with a 8KB block size.\n",
    "\n",
    "--numruns specifies over how many runs each test combination of\n",
-   "parameters should be averaged\n";
+   "parameters should be averaged, with mean, standard deviation and\n",
+   "95% confidence interval of every metric reported when above 1\n",
    "\n",
    "--target parameters are all tested in parallel on each tiotest\n",
-   "run using tiotest's ability to take multiple -d parameters\n",
+   "run using tiotest's ability to take multiple -d parameters\n";
    exit(1);
 }
 
@@ -23,9 +23,13 @@
 #include "constants.h"
 #include "crc32.h"
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 
 #define WRITE_TEST         0
 #define RANDOM_WRITE_TEST  1
@@ -34,6 +38,47 @@
 
 #define TEST_COUNT         4
 
+/* steps of one atomic replace operation */
+#define REPLACE_WRITE      0
+#define REPLACE_FSYNC      1
+#define REPLACE_RENAME     2
+#define REPLACE_DIRSYNC    3
+
+#define REPLACE_STEPS      4
+
+/* operations of a replay trace */
+#define REPLAY_READ        0
+#define REPLAY_WRITE       1
+#define REPLAY_FSYNC       2
+#define REPLAY_END         255  /* sent to the workers after the last record */
+
+#define REPLAY_OPS         3
+
+/* operations of the discard phase and of the mixed discard phase */
+#define DISCARD_RANGE      0
+#define MIXED_DISCARD      1
+#define MIXED_WRITE        2
+#define MIXED_READ         3
+
+#define DISCARD_OPS        4
+
+#define REPLAY_FLAG_FSYNC  0x01 /* fsync after the operation */
+
+#define REPLAY_MAGIC       "TIOTRACE"
+#define REPLAY_VERSION     1
+
+#define DISK_SECTOR_SIZE   512  /* unit of the sector counts in diskstats */
+
+#define VMSTAT_FILE        "/proc/vmstat"
+#define MEMINFO_FILE       "/proc/meminfo"
+
+#define CGROUP_FILE        "/proc/self/cgroup"
+#define CGROUP_ROOT        "/sys/fs/cgroup"         /* cgroup v2 */
+#define CGROUP_MEMORY_ROOT "/sys/fs/cgroup/memory"  /* cgroup v1 */
+
+#define OPLOG_MAGIC        "TIOOPLOG"
+#define OPLOG_VERSION      1
+
 #define CACHE_CONTROL_FILE "/proc/sys/vm/drop_caches"
 #define CACHE_DROP_ALL_FLAG "3";
 
@@ -50,11 +95,116 @@ struct tt_rusage {
 typedef struct {
 	double avg, max;
 	unsigned long count, count1, count2;
+	unsigned long hist[LATENCY_BUCKETS];
 } Latencies;
 
+/*
+  Block size distribution of a phase, sizes picked with probability
+  weight/totalWeight. No entries means the fixed -b block size.
+*/
+typedef struct {
+	int              count;
+	unsigned long    size[MAX_BLOCK_SIZES];
+	int              weight[MAX_BLOCK_SIZES];
+	int              totalWeight;
+} BlockDist;
+
+/*
+  Offset pattern of a phase given with --access, kind indexes
+  accessNames, -1 for the pattern the phase has by default
+*/
+typedef struct {
+	int              kind;
+	unsigned long    stride;                // bytes from one op to the next
+	int              streams;               // interleaved sequential streams
+} AccessPattern;
+
+/*
+  Counters of one thread for one phase, in the order of perfEvents.
+  valid has a bit set for every counter that could be opened.
+*/
+typedef struct {
+	unsigned long long value[PERF_COUNTERS_COUNT];
+	unsigned int     valid;
+} PerfCounts;
+
+/*
+  Operation log of --oplog, all fields little endian:
+
+    header: "TIOOPLOG", u32 version, u32 record size, u64 seconds and
+            u64 usecs of the start of the log (gettimeofday)
+    record: u64 start in nsecs from start of log, u64 offset, u32 size,
+            u32 duration in usecs, u32 thread, u8 test (0 write,
+            1 random write, 2 read, 3 random read), 3 bytes padding
+
+  Times come from the gettimeofday() calls timing each op, so they have
+  microsecond resolution. scripts/tiooplog.pl decodes the log.
+*/
+typedef struct
+{
+	char               magic[8];
+	unsigned int       version;
+	unsigned int       recordSize;
+	unsigned long long startSec;
+	unsigned long long startUsec;
+} OplogHeader;
+
+typedef struct
+{
+	unsigned long long start;
+	unsigned long long offset;
+	unsigned int       size;
+	unsigned int       duration;
+	unsigned int       thread;
+	unsigned char      test;
+	unsigned char      pad[3];
+} OplogRecord;
+
+/*
+  Records of one thread on their way to the log. Only the I/O thread
+  moves head and only the flusher moves tail; when the ring is full
+  records are dropped rather than the I/O thread waiting.
+*/
+typedef struct
+{
+	OplogRecord       *records;
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	unsigned long      dropped;
+} OplogRing;
+
+/* one operation noted by --slowest or --slow-ms */
+typedef struct {
+	struct timeval   start;
+	double           latency;
+	TIO_off_t        offset;
+	unsigned long    size;
+	int              testCase;
+} SlowOp;
+
+typedef struct {
+	unsigned long    blocks;
+	unsigned long long bytes;
+	struct tt_rusage timings;
+	Latencies        latency;
+
+	/* per entry of the block size distribution, if there is one */
+	Latencies       *sizeLatency;
+
+	/* blocks and bytes done when the first thread finished */
+	unsigned long    stonewallBlocks;
+	unsigned long long stonewallBytes;
+
+	/* fsync()/fdatasync()/msync() calls of the write phases */
+	Latencies        flushLatency;
+
+	PerfCounts       perf;
+} PhaseStats;
+
 typedef struct {
 	pthread_t        thread;
 	pthread_attr_t   thread_attr;
+	pid_t            pid;                   // worker process with --processes
 
 	char             fileName[KBYTE];
 	TIO_off_t        fileSizeInMBytes;
@@ -62,26 +212,69 @@ typedef struct {
 	unsigned long    numRandomOps;
 
 	unsigned long    blockSize;
+	unsigned long    ioSize;                // size of the current operation
+	unsigned long    lastIoSize;
+	const BlockDist *blockDist[TEST_COUNT];
+	const AccessPattern *access;            // of the current phase
 	unsigned char*   buffer;
+	unsigned long    bufferSize;            // largest size of any phase
 	unsigned         bufferCrc;
+	unsigned int     patternSeed;
+	unsigned long long patternSeq;
 
 	unsigned long    myNumber;
 
-	unsigned long    blocksWritten;
-	struct tt_rusage writeTimings;
-	Latencies	     writeLatency;
+	/* set for job file threads */
+	int              jobGroup;
+	int              jobTest;
+	unsigned long    jobOps;
+	int              prefill;               // fill the file before reading it
+	unsigned long    rateLimit;             // bytes per second, 0 for no limit
+	int              runtime;               // stop after this many seconds
 
-	unsigned long    blocksRandomWritten;
-	struct tt_rusage          randomWriteTimings;
-	Latencies	     randomWriteLatency;
+	PhaseStats       phase[TEST_COUNT];
 
-	unsigned long    blocksRead;
-	struct tt_rusage          readTimings;
-	Latencies	     readLatency;
+	/* CPU of the --ramp of the current phase, taken out of the phase */
+	struct timeval   rampUserTime;
+	struct timeval   rampSysTime;
 
-	unsigned long    blocksRandomRead;
-	struct tt_rusage          randomReadTimings;
-	Latencies	     randomReadLatency;
+	/*
+	  --slowest keeps the slowest ops in a min-heap, --slow-ms the ops
+	  over it in time order. Ops faster than slowFloor are not noted.
+	*/
+	SlowOp          *slowest;
+	int              slowestCount;
+	SlowOp          *slowOps;
+	unsigned long    slowOpsCount;
+	unsigned long    slowOpsDropped;
+	double           slowFloor;
+
+	OplogRing        oplog;
+
+	/* write-ahead log workload, latency is from append to durable */
+	unsigned long    walRecords;
+	unsigned long long walBytes;
+	struct tt_rusage walTimings;
+	Latencies        walLatency;
+
+	/* atomic replace phase, latencies of the whole sequence and its steps */
+	unsigned long    replaceOps;
+	struct tt_rusage replaceTimings;
+	Latencies        replaceLatency;
+	Latencies        replaceStepLatency[REPLACE_STEPS];
+
+	/* trace replay, per REPLAY_READ/WRITE/FSYNC */
+	unsigned long    replayOps[REPLAY_OPS];
+	unsigned long long replayBytes[REPLAY_OPS];
+	struct tt_rusage replayTimings;
+	Latencies        replayLatency[REPLAY_OPS];
+
+	/* discard and mixed discard phases, per DISCARD_RANGE/MIXED_* */
+	unsigned long    discardOps[DISCARD_OPS];
+	unsigned long long discardBytes[DISCARD_OPS];
+	struct tt_rusage discardTimings;
+	struct tt_rusage mixedTimings;
+	Latencies        discardLatency[DISCARD_OPS];
 
 } ThreadData;
 
@@ -91,10 +284,16 @@ typedef struct {
 	ThreadData* threads;
 	int         numThreads;
 
-	struct tt_rusage totalTimeWrite;
-	struct tt_rusage totalTimeRandomWrite;
-	struct tt_rusage totalTimeRead;
-	struct tt_rusage totalTimeRandomRead;
+	struct tt_rusage totalTime[TEST_COUNT];
+	struct tt_rusage totalTimeWal;
+	struct tt_rusage totalTimeReplace;
+	struct tt_rusage totalTimeReplay;
+	struct tt_rusage totalTimeDiscard;
+	struct tt_rusage totalTimeMixed;
+
+	/* when the first thread of each phase finished */
+	struct timeval   stonewallTime[TEST_COUNT];
+	int              stonewalled[TEST_COUNT];
 
 } ThreadTest;
 
@@ -122,6 +321,68 @@ typedef struct {
 	int	     runRandomRead;
 	int	     flushCaches;
 	int	     openDirect;
+	int	     stonewall;
+	int	     dsyncWriting;
+	int	     flushData;
+	unsigned long      fsyncOps;
+	unsigned long long fsyncBytes;
+	int	     wal;
+	unsigned long walRecords;
+	int	     walRecordMin;
+	int	     walRecordMax;
+	int	     walBatch;
+	int	     replace;
+	int	     replaceFiles;
+	unsigned long replaceOps;
+	int	     replaceSize;
+	int	     discard;
+	unsigned long discardOps;
+	unsigned long long discardMin;
+	unsigned long long discardMax;
+	int	     discardMix;                    /* percent of the mixed phase ops */
+	char	     replayFile[KBYTE];
+	int	     replayOriginalTiming;
+	char	     jobFile[KBYTE];
+	BlockDist    blockDist[TEST_COUNT];
+	int	     kneeTest;
+	int	     kneeMaxThreads;
+	int	     kneeStepTime;
+	double	     kneeP99;
+	double	     kneeGain;
+	int	     steadyState;
+	int	     steadyRounds;
+	int	     steadyWindow;
+	int	     steadyTime;
+	double	     steadyBand;
+	double	     steadySlope;
+	int	     sweepThreads[MAX_SWEEP];
+	int	     sweepThreadsCount;
+	int	     sweepBlocks[MAX_SWEEP];
+	int	     sweepBlocksCount;
+	int	     diskStats;
+	int	     diskStatsInterval;
+	int	     amplification;
+	int	     perf;
+	int	     slowest;
+	double	     slowMs;
+	char	     oplogFile[KBYTE];
+	char	     controller[KBYTE];
+	char	     agentPort[32];
+	char	     agentBind[KBYTE];
+	char	     agentToken[KBYTE];
+	double	     compressRatio;
+	double	     dedupeRatio;
+	int	     unique;
+	int	     evict;
+	int	     fadvise[TEST_COUNT];           /* index into fadviseNames, -1 for none */
+	unsigned long readahead[TEST_COUNT];    /* window in bytes, 0 for none */
+	AccessPattern access[TEST_COUNT];
+	unsigned long long memLimit;
+	unsigned long long mlockBytes;
+	unsigned long long pageCache;
+	unsigned long rampOps;
+	double	     rampSecs;
+	int	     processes;
 
 
 	/*
@@ -140,6 +401,322 @@ typedef struct
 	volatile int *pstart;
 } StartData;
 
+/*
+  The shared log of the write-ahead log workload. Threads append their
+  records to the filling batch, and whoever finds no commit in progress
+  becomes the leader: it takes the batch, writes it with one append and
+  makes it durable with fdatasync() while the others keep filling the
+  next batch.
+*/
+typedef struct
+{
+	int             fd;
+	char            fileName[KBYTE];
+	pthread_mutex_t lock;
+	pthread_cond_t  committed;
+
+	unsigned char  *batch[2];
+	size_t          batchSize;
+	int             filling;        /* index of the batch being filled */
+	size_t          batchBytes;
+	unsigned long   batchRecords;
+
+	unsigned long long fillingSeq;  /* sequence number of the filling batch */
+	unsigned long long durableSeq;  /* last batch known to be on disk */
+	int             leader;         /* a commit is in progress */
+	int             failed;
+
+	unsigned long   commits;
+	unsigned long   committedRecords;
+	Latencies       commitLatency;
+} WalLog;
+
+/*
+  Trace file for --replay, all fields little endian:
+
+    header: "TIOTRACE", u32 version, u32 record size
+    record: u64 timestamp in nsecs from start of trace, u64 offset,
+            u32 length, u32 stream, u8 op, u8 flags, 6 bytes padding
+
+  Streams are spread over the worker threads, so operations of one
+  stream are issued in trace order. scripts/tiotrace.pl writes these
+  from blkparse and strace output.
+*/
+typedef struct
+{
+	char         magic[8];
+	unsigned int version;
+	unsigned int recordSize;
+} ReplayHeader;
+
+typedef struct
+{
+	unsigned long long timestamp;
+	unsigned long long offset;
+	unsigned int       length;
+	unsigned int       stream;
+	unsigned char      op;
+	unsigned char      flags;
+	unsigned char      pad[6];
+} ReplayRecord;
+
+/* records on their way from the trace reader to one worker */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  changed;
+	ReplayRecord    records[REPLAY_QUEUE_LENGTH];
+	unsigned int    head, tail;
+} ReplayQueue;
+
+typedef struct
+{
+	int             fd;
+	int             traceFd;
+	char            fileName[KBYTE + 32];
+	TIO_off_t       base;
+	TIO_off_t       size;
+	ReplayQueue    *queues;
+	int             numQueues;
+	volatile int    started;
+	struct timespec start;
+	unsigned long long records;
+} Replay;
+
+/*
+  Job groups read from a --job file. Each group is a set of threads
+  doing one access pattern on their own files; groups of the same
+  stage run concurrently and stages run one after the other.
+*/
+typedef struct
+{
+	char            name[JOB_NAME_LENGTH];
+	int             numThreads;
+	int             blockSize;
+	int             fileSizeInMBytes;
+	int             testCase;
+	unsigned long   numOps;         /* 0 for the default of the pattern */
+	char            path[KBYTE];
+	unsigned long   rateLimit;      /* bytes per second per thread */
+	int             runtime;
+	int             stage;
+	BlockDist       blockDist;
+	int             firstThread;    /* threads of a group are contiguous */
+} JobGroup;
+
+typedef struct
+{
+	JobGroup        groups[MAX_JOB_GROUPS];
+	int             count;
+	int             stages[MAX_JOB_GROUPS];   /* distinct stages, ascending */
+	int             stagesCount;
+	struct tt_rusage stageTimings[MAX_JOB_GROUPS];
+} Jobs;
+
+/* one step of the --knee saturation finder, latencies in seconds */
+typedef struct
+{
+	int             threads;
+	double          mbytes, ops, secs;
+	double          avg, p99, max;
+} KneeStep;
+
+typedef struct
+{
+	KneeStep        steps[KNEE_MAX_STEPS];
+	int             count;
+	int             knee;           /* index of the step found */
+	const char     *reason;
+} Knee;
+
+/*
+  One round of the --steady-state random writes. The window numbers
+  are of the steadyWindow rounds ending with this one, once there are
+  that many: average IOPS, the max - min range and the excursion of
+  the least squares fit, the last two in percent of the average.
+*/
+typedef struct
+{
+	double          mbytes, ops, secs, p99;
+	double          windowAvg, range, excursion;
+} SteadyRound;
+
+typedef struct
+{
+	SteadyRound     rounds[MAX_STEADY_ROUNDS];
+	int             count;
+	int             reached;        /* round steady state was reached in, or -1 */
+} SteadyState;
+
+/*
+  Counters of a block device as in /sys/block/<dev>/stat (the fields
+  of /proc/diskstats), times in milliseconds.
+*/
+typedef struct
+{
+	unsigned long long readIos, readMerges, readSectors, readTicks;
+	unsigned long long writeIos, writeMerges, writeSectors, writeTicks;
+	unsigned long long inFlight, ioTicks, timeInQueue;
+} DiskSample;
+
+typedef struct
+{
+	char            name[JOB_NAME_LENGTH];
+	char            statFile[KBYTE];
+	dev_t           dev;
+	DiskSample      start;          /* when the running phase started */
+	DiskSample      last;           /* of the last interval sample */
+	DiskSample      delta[TEST_COUNT];
+	double          secs[TEST_COUNT];
+} Disk;
+
+/*
+  The devices behind the -d paths, sampled around every test phase.
+  With --amplification also the page cache residency of the test files
+  and the system wide paging counters of /proc/vmstat, in bytes.
+*/
+typedef struct
+{
+	Disk            disks[MAX_PATHS];
+	int             count;
+	int             phase;          /* running test */
+	struct timeval  start, last;
+	volatile int    stop;
+	pthread_t       sampler;
+
+	unsigned long long pagedIn, pagedOut;
+	unsigned long long vmstatIn[TEST_COUNT], vmstatOut[TEST_COUNT];
+	double          residentBefore[TEST_COUNT], residentAfter[TEST_COUNT];
+} DiskStats;
+
+/*
+  The --oplog file, filled through a window mapping OPLOG_WINDOW bytes
+  of it by the flusher thread.
+*/
+typedef struct
+{
+	int                fd;
+	char              *window;
+	unsigned long long windowStart;
+	unsigned long long size;        /* bytes written so far */
+	unsigned long long records;
+	struct timeval     start;
+	ThreadTest        *test;
+	volatile int       stop;
+	pthread_t          flusher;
+} Oplog;
+
+/*
+  --ramp state of the phase currently running. The threads wait for
+  each other at the barrier after their ramp and the phase time starts
+  when the last one arrives.
+*/
+typedef struct
+{
+	int               active;
+	int               sync;
+	pthread_barrier_t barrier;
+	struct timeval    measureStart;
+} Ramp;
+
+/*
+  Stonewall state of the phase currently running. The first thread
+  to finish its work sets hit, and every other thread records how many
+  blocks it had done when it noticed.
+*/
+typedef struct
+{
+	volatile int armed;
+	volatile int hit;
+	struct timeval time;
+} Stonewall;
+
+/*
+  Coordinated runs of --controller and --agent over TCP, one text line
+  per message:
+
+    agent:      "tiotest agent <version>"
+    controller: "token <token>"
+    agent:      "ok" if it is the token of the agent, else it hangs up
+    controller: "agent <n>", "arg <argument>" for every argument of the
+                controller, then "run"
+    agent:      "ready <test>" before every phase
+    controller: "go" once every agent is ready
+    agent:      "phase <test> <blocks> <mbytes> <secs> <latency>" for
+                every phase that ran, then "done"
+
+  <latency> is the sum, maximum and counts of the Latencies of the
+  phase followed by its non empty histogram buckets as bucket:count.
+*/
+typedef struct
+{
+	FILE              *in;
+	FILE              *out;
+	int                number;
+	/* the -d of the agent itself, controllers may only use these */
+	char               dirs[MAX_PATHS][KBYTE];
+	int                dirsCount;
+	/* and the host wide memory and cache options it was started with */
+	int                memLimit;
+	int                mlock;
+	int                pageCache;
+	int                flushCaches;
+} AgentLink;
+
+typedef struct
+{
+	unsigned long      blocks;
+	double             mbytes;
+	double             secs;
+	Latencies          latency;
+} AgentPhase;
+
+typedef struct
+{
+	char               host[KBYTE];
+	char               port[32];
+	FILE              *in;
+	FILE              *out;
+	AgentPhase         phase[TEST_COUNT];
+} ClusterAgent;
+
+typedef struct
+{
+	ClusterAgent       agents[MAX_AGENTS];
+	int                count;
+} Cluster;
+
+/*
+  Write data of --compress, --dedupe and --unique, built PATTERN_CHUNK
+  bytes at a time: 1/compress of every chunk is random bytes from a
+  random place in the pool, the rest zeros. 1 - 1/dedupe of the chunks
+  repeat one of the first PATTERN_DEDUPE_CHUNKS chunks of the pool; the
+  others, and all of them with --unique, start with the run, thread and
+  a sequence number so that no two are the same.
+*/
+typedef struct
+{
+	int                active;
+	unsigned char     *pool;
+	unsigned int       runId;
+} Patterns;
+
+/*
+  State of --mem-limit, --mlock and --page-cache: the memory cgroup the
+  process moved into, the one it came from, whether the memory
+  controller had to be enabled for the children of that one and the
+  anonymous memory locked to keep it from the page cache.
+*/
+typedef struct
+{
+	char               cgroup[KBYTE + 32];
+	char               parent[KBYTE];
+	int                enabledMemory;
+	pid_t              owner;
+	void              *pinned;
+	unsigned long long pinnedBytes;
+} MemoryPressure;
+
 typedef int                (*file_io_function)     (int fd, TIO_off_t offset, ThreadData *d);
 typedef int                (*mmap_io_function)     (void *loc, ThreadData *d);
 
@@ -157,11 +734,112 @@ static TIO_off_t get_sequential_offset(TIO_off_t current_offset, ThreadData *d,
 static TIO_off_t get_random_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed);
 static void *get_sequential_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed);
 static void *get_random_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed);
+static TIO_off_t get_reverse_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed);
+static TIO_off_t get_strided_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed);
+static TIO_off_t get_interleaved_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed);
+static void *get_reverse_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed);
+static void *get_strided_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed);
+static void *get_interleaved_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed);
+
+static void print_results( ThreadTest *d );
 
 static const char* const versionStr = "tiotest v0.4.2 (C) 1999-2008 tiobench team <http://tiobench.sf.net/>";
 
 static ArgumentOptions args;
 
+/* in shared memory, so --processes workers see them too */
+static Stonewall *stonewall;
+
+static Ramp *ramp;
+
+/* set when the kernel only allowed --perf to count user space */
+static volatile int *perfUserOnly;
+
+static WalLog walLog;
+
+static Replay replay;
+
+static Jobs jobs;
+
+static Knee knee;
+
+static SteadyState steady;
+
+static DiskStats diskStats;
+
+static Oplog oplog;
+
+/* the controller of an --agent worker, the agents of a --controller */
+static AgentLink agentLink;
+
+static Cluster cluster;
+
+static Patterns patterns;
+
+static MemoryPressure memoryPressure;
+
+/* page cache residency of the test files around every phase */
+static double residentStart[TEST_COUNT], residentEnd[TEST_COUNT];
+
+static const char* const fadviseNames[] = {
+	"normal", "sequential", "random", "noreuse", "willneed", "dontneed"
+};
+
+static const int fadviseValues[] = {
+	POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM,
+	POSIX_FADV_NOREUSE, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED
+};
+
+enum {
+	ACCESS_SEQUENTIAL,
+	ACCESS_RANDOM,
+	ACCESS_REVERSE,
+	ACCESS_STRIDE,
+	ACCESS_INTERLEAVE,
+};
+
+/* --access patterns, in the order of the enum above */
+static const char* const accessNames[] = {
+	"sequential", "random", "reverse", "stride", "interleave"
+};
+
+static const file_offset_function accessOffsets[] = {
+	get_sequential_offset, get_random_offset, get_reverse_offset,
+	get_strided_offset, get_interleaved_offset
+};
+
+static const mmap_loc_function accessLocs[] = {
+	get_sequential_loc, get_random_loc, get_reverse_loc,
+	get_strided_loc, get_interleaved_loc
+};
+
+/* --perf counters, hardware ones read as missing without a PMU */
+static const struct {
+	unsigned int        type;
+	unsigned long long  config;
+	const char         *title;
+} perfEvents[PERF_COUNTERS_COUNT] = {
+#ifdef PERF_COUNTERS
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       "Cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     "Instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     "Cache misses" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,       "CPU usecs" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "Ctx switches" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      "Page faults" },
+#endif
+};
+
+#define PERF_TASK_CLOCK    3    /* counts nanoseconds, shown in usecs */
+
+static const char* const testNames[TEST_COUNT] = {
+	"write", "rwrite", "read", "rread",
+};
+
+static const char* const testTitles[TEST_COUNT] = {
+	"Write", "Random Write", "Read", "Random Read",
+};
+
+
 static void t_log (int level, char *message)
 {
 	if(args.debugLevel >= level)
@@ -200,6 +878,25 @@ static void timer_init(struct tt_rusage *t)
 	memset( t, 0, sizeof(struct tt_rusage) );
 }
 
+/* workers forked by --processes count once they have been waited for */
+static int get_cpu_usage(struct rusage *ru)
+{
+	struct rusage children;
+
+	if (getrusage( RUSAGE_SELF, ru ))
+		return -1;
+
+	if (args.processes)
+	{
+		if (getrusage( RUSAGE_CHILDREN, &children ))
+			return -1;
+		timeradd(&ru->ru_utime, &children.ru_utime, &ru->ru_utime);
+		timeradd(&ru->ru_stime, &children.ru_stime, &ru->ru_stime);
+	}
+
+	return 0;
+}
+
 static void timer_start(struct tt_rusage *t)
 {
 	struct rusage ru;
@@ -210,7 +907,7 @@ static void timer_start(struct tt_rusage *t)
 		exit(10);
 	}
 
-	if(getrusage( RUSAGE_SELF, &ru ))
+	if(get_cpu_usage( &ru ))
 	{
 		perror("Error in timer_start from getrusage()\n");
 		exit(11);
@@ -224,7 +921,7 @@ static void timer_stop(struct tt_rusage *t)
 {
 	struct rusage ru;
 
-	if( getrusage( RUSAGE_SELF, &ru ))
+	if( get_cpu_usage( &ru ))
 	{
 		perror("Error in timer_stop from getrusage()\n");
 		exit(11);
@@ -245,8 +942,35 @@ static unsigned long long tv_to_usec(const struct timeval* v)
 	return v->tv_sec * (1000*1000) + v->tv_usec;
 }
 
-static void update_latency_info(Latencies *lat, struct timeval tv_start,
-				struct timeval tv_stop)
+static int latency_bucket(double usecs)
+{
+	const unsigned long long v = usecs > 0 ? usecs : 0;
+	int e;
+
+	if (v < (1 << LATENCY_SUB_BITS))
+		return v;
+
+	e = 63 - __builtin_clzll(v);
+	if (e >= LATENCY_MAX_BITS)
+		return LATENCY_BUCKETS - 1;
+
+	return ((e - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) +
+		((v >> (e - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+static double latency_bucket_low(int bucket)
+{
+	const int sub = bucket & ((1 << LATENCY_SUB_BITS) - 1);
+	const int e = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+
+	if (bucket < (1 << LATENCY_SUB_BITS))
+		return bucket;
+
+	return ldexp((1 << LATENCY_SUB_BITS) + sub, e - LATENCY_SUB_BITS);
+}
+
+static double update_latency_info(Latencies *lat, struct timeval tv_start,
+				  struct timeval tv_stop)
 {
 	double value;
 
@@ -261,7 +985,52 @@ static void update_latency_info(Latencies *lat, struct timeval tv_start,
 		lat->count1++;
 	if (value > (double)LATENCY_STAT2)
 		lat->count2++;
-	return;
+	lat->hist[latency_bucket(value * 1000000.0)]++;
+	return value;
+}
+
+static void merge_latencies(Latencies *to, const Latencies *from)
+{
+	int i;
+
+	if (from->max > to->max)
+		to->max = from->max;
+	to->avg    += from->avg;
+	to->count  += from->count;
+	to->count1 += from->count1;
+	to->count2 += from->count2;
+	for(i = 0; i < LATENCY_BUCKETS; i++)
+		to->hist[i] += from->hist[i];
+}
+
+/*
+  Latency at the given percentile in seconds, taken as the middle
+  of the histogram bucket it falls in
+*/
+static double latency_percentile(const Latencies *lat, double percentile)
+{
+	unsigned long long target, seen = 0;
+	int i;
+
+	if (lat->count == 0)
+		return 0;
+
+	target = (unsigned long long)ceil(lat->count * percentile / 100.0);
+	if (target == 0)
+		target = 1;
+
+	for(i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += lat->hist[i];
+		if (seen >= target)
+		{
+			const double v = latency_bucket_low(i) +
+				(latency_bucket_low(i + 1) - latency_bucket_low(i)) / 2.0;
+			return MIN(v / 1000000.0, lat->max);
+		}
+	}
+
+	return lat->max;
 }
 
 static void * tt_aligned_alloc(const ssize_t size)
@@ -284,6 +1053,30 @@ static void tt_aligned_free(caddr_t a, const ssize_t size)
 	munmap(a, size);
 }
 
+/*
+  Zeroed memory the threads report into. With --processes it is a
+  shared mapping, so that the parent sees what the workers wrote.
+*/
+static void * tt_shared_alloc(const size_t size)
+{
+	void *a;
+
+	if (!args.processes)
+		return calloc(1, size);
+
+	a = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANON, -1, 0);
+	return a == MAP_FAILED ? NULL : a;
+}
+
+static void tt_shared_free(void *a, const size_t size)
+{
+	if (!args.processes)
+		free(a);
+	else if (a)
+		munmap(a, size);
+}
+
 static void checkValidFileSize(const int value)
 {
 #ifndef USE_LARGEFILES
@@ -389,27 +1182,343 @@ static void print_help_and_exit()
 
 	print_option("-X", "Use direct I/O to bypass buffer cache (blocksize must be a multiple of logical blocksize of underlying filesystem)", 0);
 
+#ifdef LONG_OPTIONS
+	print_option("--stonewall", "Also report rates up to when the first thread finished", 0);
+	print_option("--fsync-ops n", "Flush written data every n operations", 0);
+	print_option("--fsync-mb n", "Flush written data every n MBytes", 0);
+	print_option("--fdatasync", "Flush with fdatasync() instead of fsync()", 0);
+	print_option("--dsync", "Like -S but open with O_DSYNC instead of O_SYNC", 0);
+	print_option("--wal", "Run the write-ahead log workload instead of the normal tests", 0);
+	print_option("--wal-records n", "Log records appended per thread",
+		     my_int_to_string(DEFAULT_WAL_RECORDS));
+	print_option("--wal-record-size min[:max]", "Log record size range in bytes",
+		     xstr(DEFAULT_WAL_RECORD_MIN) ":" xstr(DEFAULT_WAL_RECORD_MAX));
+	print_option("--wal-batch n", "Maximum records per group commit",
+		     my_int_to_string(DEFAULT_WAL_BATCH));
+	print_option("--replace", "Add atomic replace phase (write temp, fsync, rename, fsync dir)", 0);
+	print_option("--replace-files n", "Files each thread replaces",
+		     my_int_to_string(DEFAULT_REPLACE_FILES));
+	print_option("--replace-ops n", "Replace operations per thread",
+		     my_int_to_string(DEFAULT_REPLACE_OPS));
+	print_option("--replace-size n", "Size of replaced files in bytes",
+		     my_int_to_string(DEFAULT_REPLACE_SIZE));
+	print_option("--discard", "Add discard phase: BLKDISCARD ranges of the devices with -R, else punch holes in the files", 0);
+	print_option("--discard-ops n", "Discards per thread",
+		     my_int_to_string(DEFAULT_DISCARD_OPS));
+	print_option("--discard-size min[:max]", "Size range of discarded ranges (k/m/g suffix), rounded down to blocks",
+		     "1m");
+	print_option("--discard-mix pct", "Add mixed phase of -r ops per thread, pct % discards and the rest random reads and writes", 0);
+	print_option("--replay file", "Replay an I/O trace instead of the normal tests, -f sets target size", 0);
+	print_option("--replay-timing t", "Issue replayed ops as fast as possible or with original timing (fast|original)",
+		     "fast");
+	print_option("--job file", "Run the job groups described in file instead of the normal tests", 0);
+	print_option("--knee test", "Find the saturation point of test (write|rwrite|read|rread) by doubling threads", 0);
+	print_option("--knee-threads n", "Most threads to try",
+		     my_int_to_string(DEFAULT_KNEE_MAX_THREADS));
+	print_option("--knee-time n", "Seconds per step",
+		     my_int_to_string(DEFAULT_KNEE_STEP_TIME));
+	print_option("--knee-p99 ms", "Stop once the 99% latency passes ms", 0);
+	print_option("--knee-gain pct", "Stop once doubling threads gains less than pct throughput",
+		     my_int_to_string(DEFAULT_KNEE_GAIN));
+	print_option("--steady-state", "Precondition with random write rounds until IOPS are steady, then run the tests", 0);
+	print_option("--steady-rounds n", "Most rounds to run (up to " xstr(MAX_STEADY_ROUNDS) ")",
+		     my_int_to_string(DEFAULT_STEADY_ROUNDS));
+	print_option("--steady-window n", "Rounds that have to be steady",
+		     my_int_to_string(DEFAULT_STEADY_WINDOW));
+	print_option("--steady-time n", "Seconds per round",
+		     my_int_to_string(DEFAULT_STEADY_TIME));
+	print_option("--steady-band pct", "Most IOPS range in the window, of its average",
+		     my_int_to_string(DEFAULT_STEADY_BAND));
+	print_option("--steady-slope pct", "Most excursion of the IOPS fit line in the window, of its average",
+		     my_int_to_string(DEFAULT_STEADY_SLOPE));
+	print_option("--sweep-threads n,n,...", "Run the tests for every thread count, writing the files only once", 0);
+	print_option("--sweep-blocks n,n,...", "Run the tests for every block size (k/m suffix), writing the files only once", 0);
+	print_option("--bsdist [test=]dist", "Block sizes of test (or all tests) as size:weight,... e.g. 4k:60,64k:30,1m:10", 0);
+	print_option("--evict", "Evict just the test files from the page cache before every test, no root needed", 0);
+	print_option("--fadvise [test=]advice", "posix_fadvise() the files of test (or all tests): normal|sequential|random|noreuse|willneed|dontneed", 0);
+	print_option("--readahead [test=]size", "readahead() size bytes ahead of the reads of test (or all tests)", 0);
+	print_option("--access [test=]pattern", "Offsets of test (or all tests): sequential|random|reverse|stride:size|interleave:n", 0);
+	print_option("--mem-limit size", "Run in a memory cgroup limited to size (k/m/g suffix), which also bounds its page cache", 0);
+	print_option("--mlock size", "Lock size of anonymous memory so that the page cache gets that much less", 0);
+	print_option("--page-cache size", "Lock all available memory but size, leaving about size to the page cache", 0);
+	print_option("--diskstats", "Report statistics of the block devices behind -d for every test", 0);
+	print_option("--diskstats-interval n", "Also print device statistics every n seconds (implies --diskstats)", 0);
+	print_option("--amplification", "Report device bytes per issued byte and page cache residency of every test (implies --diskstats)", 0);
+	print_option("--perf", "Count cycles, instructions, cache misses, context switches and page faults per I/O and MB", 0);
+	print_option("--slowest n", "List the n slowest operations of every thread", 0);
+	print_option("--slow-ms ms", "List operations slower than ms in time order (" xstr(MAX_SLOW_OPS) " per thread)", 0);
+	print_option("--oplog file", "Log every operation of the tests to file, see scripts/tiooplog.pl", 0);
+	print_option("--ramp n[s]", "Run n unrecorded ops (or n seconds) per thread before measuring each test", 0);
+	print_option("--processes", "Run every thread as a forked process, with its own mappings and file table", 0);
+	print_option("--compress ratio", "Write data that compresses by about ratio", 0);
+	print_option("--dedupe ratio", "Write data that deduplicates by about ratio in 4 KB chunks", 0);
+	print_option("--unique", "Make every written chunk unique", 0);
+	print_option("--agent port", "Wait on port for controllers and run the tests they send, in the -d directories only", 0);
+	print_option("--agent-bind address", "Address the agent listens on", DEFAULT_AGENT_BIND);
+	print_option("--agent-token token", "Secret shared by agents and controllers, else $TIOTEST_AGENT_TOKEN", 0);
+	print_option("--controller list", "Run the tests on the agents of a comma separated host:port list, every phase starting together", 0);
+#endif
+
 	print_option("-h", "Print this help and exit", 0);
 
 	exit(1);
 }
 
-static void parse_args( ArgumentOptions* args, int argc, char *argv[] )
+#define SHORT_OPTIONS "f:b:d:t:r:D:k:o:hLRTWSOcMFX"
+
+/* options without a short form, values above any character */
+enum {
+	OPT_STONEWALL = 256,
+	OPT_FSYNC_OPS,
+	OPT_FSYNC_MB,
+	OPT_FDATASYNC,
+	OPT_DSYNC,
+	OPT_WAL,
+	OPT_WAL_RECORDS,
+	OPT_WAL_RECORD_SIZE,
+	OPT_WAL_BATCH,
+	OPT_REPLACE,
+	OPT_REPLACE_FILES,
+	OPT_REPLACE_OPS,
+	OPT_REPLACE_SIZE,
+	OPT_DISCARD,
+	OPT_DISCARD_OPS,
+	OPT_DISCARD_SIZE,
+	OPT_DISCARD_MIX,
+	OPT_REPLAY,
+	OPT_REPLAY_TIMING,
+	OPT_JOB,
+	OPT_BSDIST,
+	OPT_KNEE,
+	OPT_KNEE_THREADS,
+	OPT_KNEE_TIME,
+	OPT_KNEE_P99,
+	OPT_KNEE_GAIN,
+	OPT_STEADY,
+	OPT_STEADY_ROUNDS,
+	OPT_STEADY_WINDOW,
+	OPT_STEADY_TIME,
+	OPT_STEADY_BAND,
+	OPT_STEADY_SLOPE,
+	OPT_SWEEP_THREADS,
+	OPT_SWEEP_BLOCKS,
+	OPT_DISKSTATS,
+	OPT_DISKSTATS_INTERVAL,
+	OPT_AMPLIFICATION,
+	OPT_PERF,
+	OPT_SLOWEST,
+	OPT_SLOW_MS,
+	OPT_OPLOG,
+	OPT_RAMP,
+	OPT_PROCESSES,
+	OPT_AGENT,
+	OPT_AGENT_BIND,
+	OPT_AGENT_TOKEN,
+	OPT_CONTROLLER,
+	OPT_COMPRESS,
+	OPT_DEDUPE,
+	OPT_UNIQUE,
+	OPT_EVICT,
+	OPT_FADVISE,
+	OPT_READAHEAD,
+	OPT_ACCESS,
+	OPT_MEM_LIMIT,
+	OPT_MLOCK,
+	OPT_PAGE_CACHE,
+};
+
+#ifdef LONG_OPTIONS
+static const struct option longOptions[] = {
+	{ "stonewall",       no_argument,       NULL, OPT_STONEWALL },
+	{ "fsync-ops",       required_argument, NULL, OPT_FSYNC_OPS },
+	{ "fsync-mb",        required_argument, NULL, OPT_FSYNC_MB },
+	{ "fdatasync",       no_argument,       NULL, OPT_FDATASYNC },
+	{ "dsync",           no_argument,       NULL, OPT_DSYNC },
+	{ "wal",             no_argument,       NULL, OPT_WAL },
+	{ "wal-records",     required_argument, NULL, OPT_WAL_RECORDS },
+	{ "wal-record-size", required_argument, NULL, OPT_WAL_RECORD_SIZE },
+	{ "wal-batch",       required_argument, NULL, OPT_WAL_BATCH },
+	{ "replace",         no_argument,       NULL, OPT_REPLACE },
+	{ "replace-files",   required_argument, NULL, OPT_REPLACE_FILES },
+	{ "replace-ops",     required_argument, NULL, OPT_REPLACE_OPS },
+	{ "replace-size",    required_argument, NULL, OPT_REPLACE_SIZE },
+	{ "discard",         no_argument,       NULL, OPT_DISCARD },
+	{ "discard-ops",     required_argument, NULL, OPT_DISCARD_OPS },
+	{ "discard-size",    required_argument, NULL, OPT_DISCARD_SIZE },
+	{ "discard-mix",     required_argument, NULL, OPT_DISCARD_MIX },
+	{ "replay",          required_argument, NULL, OPT_REPLAY },
+	{ "replay-timing",   required_argument, NULL, OPT_REPLAY_TIMING },
+	{ "job",             required_argument, NULL, OPT_JOB },
+	{ "bsdist",          required_argument, NULL, OPT_BSDIST },
+	{ "knee",            required_argument, NULL, OPT_KNEE },
+	{ "knee-threads",    required_argument, NULL, OPT_KNEE_THREADS },
+	{ "knee-time",       required_argument, NULL, OPT_KNEE_TIME },
+	{ "knee-p99",        required_argument, NULL, OPT_KNEE_P99 },
+	{ "knee-gain",       required_argument, NULL, OPT_KNEE_GAIN },
+	{ "steady-state",    no_argument,       NULL, OPT_STEADY },
+	{ "steady-rounds",   required_argument, NULL, OPT_STEADY_ROUNDS },
+	{ "steady-window",   required_argument, NULL, OPT_STEADY_WINDOW },
+	{ "steady-time",     required_argument, NULL, OPT_STEADY_TIME },
+	{ "steady-band",     required_argument, NULL, OPT_STEADY_BAND },
+	{ "steady-slope",    required_argument, NULL, OPT_STEADY_SLOPE },
+	{ "sweep-threads",   required_argument, NULL, OPT_SWEEP_THREADS },
+	{ "sweep-blocks",    required_argument, NULL, OPT_SWEEP_BLOCKS },
+	{ "diskstats",       no_argument,       NULL, OPT_DISKSTATS },
+	{ "diskstats-interval", required_argument, NULL, OPT_DISKSTATS_INTERVAL },
+	{ "amplification",   no_argument,       NULL, OPT_AMPLIFICATION },
+	{ "perf",            no_argument,       NULL, OPT_PERF },
+	{ "slowest",         required_argument, NULL, OPT_SLOWEST },
+	{ "slow-ms",         required_argument, NULL, OPT_SLOW_MS },
+	{ "oplog",           required_argument, NULL, OPT_OPLOG },
+	{ "ramp",            required_argument, NULL, OPT_RAMP },
+	{ "processes",       no_argument,       NULL, OPT_PROCESSES },
+	{ "agent",           required_argument, NULL, OPT_AGENT },
+	{ "agent-bind",      required_argument, NULL, OPT_AGENT_BIND },
+	{ "agent-token",     required_argument, NULL, OPT_AGENT_TOKEN },
+	{ "controller",      required_argument, NULL, OPT_CONTROLLER },
+	{ "compress",        required_argument, NULL, OPT_COMPRESS },
+	{ "dedupe",          required_argument, NULL, OPT_DEDUPE },
+	{ "unique",          no_argument,       NULL, OPT_UNIQUE },
+	{ "evict",           no_argument,       NULL, OPT_EVICT },
+	{ "fadvise",         required_argument, NULL, OPT_FADVISE },
+	{ "readahead",       required_argument, NULL, OPT_READAHEAD },
+	{ "access",          required_argument, NULL, OPT_ACCESS },
+	{ "mem-limit",       required_argument, NULL, OPT_MEM_LIMIT },
+	{ "mlock",           required_argument, NULL, OPT_MLOCK },
+	{ "page-cache",      required_argument, NULL, OPT_PAGE_CACHE },
+	{ NULL,              0,                 NULL, 0 }
+};
+#endif
+
+static unsigned long long parse_size(const char *s)
 {
-	int c;
-	int once = 0;
+	char *end;
+	unsigned long long value = strtoull(s, &end, 10);
 
-	while (1)
+	switch (*end)
 	{
-		c = getopt( argc, argv, "f:b:d:t:r:D:k:o:hLRTWSOcMFX");
+	case 'g': case 'G':
+		value *= KBYTE;
+		/* Go through */
+	case 'm': case 'M':
+		value *= KBYTE;
+		/* Go through */
+	case 'k': case 'K':
+		value *= KBYTE;
+	}
 
-		if (c == -1)
-			break;
+	return value;
+}
 
-		switch (c)
+/*
+  Parses "n,n,..." with optional k/m/g suffixes into at most MAX_SWEEP
+  values, returns how many there were
+*/
+static int parse_list(const char *list, int *values, const char *mess)
+{
+	const char *s = list;
+	int count = 0;
+
+	do
+	{
+		const unsigned long long value = parse_size(s);
+
+		if (value == 0 || value > INT_MAX || count == MAX_SWEEP)
 		{
-		case 'f':
-			args->fileSizeInMBytes = atoi(optarg);
+			fprintf(stderr, "%s", mess);
+			exit(1);
+		}
+		values[count++] = value;
+
+		s = strchr(s, ',');
+	} while (s++ != NULL);
+
+	return count;
+}
+
+/*
+  Parses "size[:weight],..." into dist, returns non-zero on errors
+*/
+static int parse_block_dist(const char *spec, BlockDist *dist)
+{
+	const char *s = spec;
+
+	memset(dist, 0, sizeof(BlockDist));
+
+	while (*s)
+	{
+		char *end;
+		const unsigned long long size = parse_size(s);
+		int weight = 1;
+
+		if (size == 0 || size > INT_MAX || dist->count == MAX_BLOCK_SIZES)
+			return -1;
+
+		end = strpbrk(s, ":,");
+		if (end && *end == ':')
+		{
+			weight = strtol(end + 1, &end, 10);
+			if (weight <= 0 || (*end && *end != ','))
+				return -1;
+		}
+
+		dist->size[dist->count] = size;
+		dist->weight[dist->count] = weight;
+		dist->totalWeight += weight;
+		dist->count++;
+
+		if (end == NULL || *end == '\0')
+			break;
+		s = end + 1;
+	}
+
+	return dist->count ? 0 : -1;
+}
+
+/*
+  Splits "[test=]value" into the tests it is for, first to last (all
+  of them without a test, first is TEST_COUNT for unknown tests), and
+  returns the value
+*/
+static const char *test_spec(const char *arg, int *first, int *last)
+{
+	const char *spec = strchr(arg, '=');
+
+	*first = 0;
+	*last = TEST_COUNT - 1;
+
+	if (spec == NULL)
+		return arg;
+
+	for(*first = 0; *first < TEST_COUNT; (*first)++)
+		if (strlen(testNames[*first]) == spec - arg &&
+		    !strncmp(arg, testNames[*first], spec - arg))
+			break;
+	*last = *first;
+
+	return spec + 1;
+}
+
+static void parse_args( ArgumentOptions* args, int argc, char *argv[] )
+{
+	int c;
+	int once = 0;
+
+	while (1)
+	{
+#ifdef LONG_OPTIONS
+		c = getopt_long( argc, argv, SHORT_OPTIONS, longOptions, NULL );
+#else
+		c = getopt( argc, argv, SHORT_OPTIONS );
+#endif
+
+		if (c == -1)
+			break;
+
+		switch (c)
+		{
+		case 'f':
+			args->fileSizeInMBytes = atoi(optarg);
 			checkIntZero(args->fileSizeInMBytes, "Wrong file size\n");
 			checkValidFileSize(args->fileSizeInMBytes);
 			break;
@@ -494,1036 +1603,6625 @@ static void parse_args( ArgumentOptions* args, int argc, char *argv[] )
 			args->openDirect = TRUE;
 			break;
 
-		case 'k':
+		case OPT_STONEWALL:
+			args->stonewall = TRUE;
+			break;
+
+		case OPT_FSYNC_OPS:
+			checkIntZero(atoi(optarg), "Wrong number of operations between flushes\n");
+			args->fsyncOps = atoi(optarg);
+			break;
+
+		case OPT_FSYNC_MB:
+			checkIntZero(atoi(optarg), "Wrong number of MBytes between flushes\n");
+			args->fsyncBytes = (unsigned long long)atoi(optarg) * MBYTE;
+			break;
+
+		case OPT_FDATASYNC:
+			args->flushData = TRUE;
+			break;
+
+		case OPT_DSYNC:
+			args->syncWriting = TRUE;
+			args->dsyncWriting = TRUE;
+			break;
+
+		case OPT_WAL:
+			args->wal = TRUE;
+			break;
+
+		case OPT_WAL_RECORDS:
+			checkIntZero(atoi(optarg), "Wrong number of log records\n");
+			args->walRecords = atoi(optarg);
+			break;
+
+		case OPT_WAL_RECORD_SIZE:
 		{
-			const int i = atoi(optarg);
-			if (i < TEST_COUNT)
+			char *max = strchr(optarg, ':');
+
+			args->walRecordMin = atoi(optarg);
+			args->walRecordMax = max ? atoi(max + 1) : args->walRecordMin;
+			checkIntZero(args->walRecordMin, "Wrong log record size\n");
+			if (args->walRecordMax < args->walRecordMin)
 			{
-				args->testsToRun[i] = 0;
-				break;
+				fprintf(stderr, "Wrong log record size range %s\n", optarg);
+				exit(1);
 			}
-			else
-				fprintf(stderr, "Wrong test number %d\n", i);
-			/* Go through */
-		}
-		case '?':
-		default:
-			fprintf(stderr, "Try 'tiotest -h' for more information\n");
-			exit(1);
 			break;
 		}
-	}
-}
 
-static int flush_caches()
-{
-	int retVal = 0;
-	int fd;
+		case OPT_WAL_BATCH:
+			args->walBatch = atoi(optarg);
+			checkIntZero(args->walBatch, "Wrong number of records per commit\n");
+			break;
 
-	if (geteuid() != 0)
-	{
-		fprintf(stderr, "Cache flushing requires root.\n");
-	}
-	else
-	{
-		fd = open(CACHE_CONTROL_FILE, O_WRONLY);
-		if (fd == -1)
-		{
-			fprintf(stderr, "%s: %s\n", strerror(errno),
- 				CACHE_CONTROL_FILE);
-		}
-		else
+		case OPT_REPLACE:
+			args->replace = TRUE;
+			break;
+
+		case OPT_REPLACE_FILES:
+			args->replaceFiles = atoi(optarg);
+			checkIntZero(args->replaceFiles, "Wrong number of files to replace\n");
+			break;
+
+		case OPT_REPLACE_OPS:
+			checkIntZero(atoi(optarg), "Wrong number of replace operations\n");
+			args->replaceOps = atoi(optarg);
+			break;
+
+		case OPT_REPLACE_SIZE:
+			args->replaceSize = atoi(optarg);
+			checkIntZero(args->replaceSize, "Wrong size of replaced files\n");
+			break;
+
+		case OPT_DISCARD:
+			args->discard = TRUE;
+			break;
+
+		case OPT_DISCARD_OPS:
+			checkIntZero(atoi(optarg), "Wrong number of discards\n");
+			args->discardOps = atoi(optarg);
+			break;
+
+		case OPT_DISCARD_SIZE:
 		{
-			char drop_all_message[] = CACHE_DROP_ALL_FLAG;
-			int length = strlen(drop_all_message);
-			int written = write(fd, drop_all_message,
-					    length);
-			if (written == -1)
+			char *max = strchr(optarg, ':');
+
+			args->discardMin = parse_size(optarg);
+			args->discardMax = max ? parse_size(max + 1) : args->discardMin;
+			if (args->discardMin == 0 || args->discardMax < args->discardMin)
 			{
-				fprintf(stderr, "%s: %s\n", strerror(errno),
-					drop_all_message);
+				fprintf(stderr, "Wrong discard size range %s\n", optarg);
+				exit(1);
 			}
-			else if (written != length)
+			break;
+		}
+
+		case OPT_DISCARD_MIX:
+			args->discardMix = atoi(optarg);
+			if (args->discardMix < 1 || args->discardMix > 100)
 			{
-				fprintf(stderr,
-					"Error: only wrote %d of %d bytes.\n",
-					written, length);
+				fprintf(stderr, "Wrong discard share %s, 1 to 100 percent\n", optarg);
+				exit(1);
 			}
+			break;
+
+		case OPT_REPLAY:
+			strncpy(args->replayFile, optarg, KBYTE - 1);
+			break;
+
+		case OPT_REPLAY_TIMING:
+			if (!strcmp(optarg, "original"))
+				args->replayOriginalTiming = TRUE;
+			else if (!strcmp(optarg, "fast"))
+				args->replayOriginalTiming = FALSE;
 			else
 			{
-				// successful write.
-				retVal = 1;
+				fprintf(stderr, "Wrong replay timing %s\n", optarg);
+				exit(1);
 			}
-			close(fd);
-		}
-	}
-	return retVal;
-}
+			break;
 
-static void* do_generic_test(file_io_function io_func,
-			     mmap_io_function mmap_func,
-			     file_offset_function offset_func,
-			     mmap_loc_function loc_func,
-			     ThreadData *d, struct tt_rusage *timings,
-			     Latencies *latencies,
-			     int madvise_advice,
-			     unsigned long *blockCount,
-			     unsigned long io_ops)
-{
-	int     fd;
-	TIO_off_t  blocks=((TIO_off_t)d->fileSizeInMBytes*MBYTE)/d->blockSize;
-	unsigned int seed = get_random_seed();
-	unsigned long orig_iops = io_ops;
+		case OPT_JOB:
+			strncpy(args->jobFile, optarg, KBYTE - 1);
+			break;
 
-	int     rc;
-	TIO_off_t  bytesize=blocks*d->blockSize; /* truncates down to BS multiple */
+		case OPT_BSDIST:
+		{
+			int i, first, last;
+			const char *spec = test_spec(optarg, &first, &last);
 
-	// for now, always read/write, just easier
-	int openFlags = O_RDWR;
+			if (first == TEST_COUNT ||
+			    parse_block_dist(spec, &args->blockDist[first]))
+			{
+				fprintf(stderr, "Wrong block size distribution %s\n", optarg);
+				exit(1);
+			}
 
-	// if not a pre-existing device, add create flag
-	if (!args.rawDrives)
-		openFlags |= O_CREAT;
+			for(i = first + 1; i <= last; i++)
+				args->blockDist[i] = args->blockDist[first];
+			break;
+		}
 
-	// if sync I/O requested, do it at open time
-	if( args.syncWriting )
-		openFlags |= O_SYNC;
+		case OPT_KNEE:
+			for(args->kneeTest = 0; args->kneeTest < TEST_COUNT; args->kneeTest++)
+				if (!strcmp(optarg, testNames[args->kneeTest]))
+					break;
+			if (args->kneeTest == TEST_COUNT)
+			{
+				fprintf(stderr, "Wrong test %s\n", optarg);
+				exit(1);
+			}
+			break;
 
-	// if direct I/O requested, do it at open time
-	if( args.openDirect )
-		openFlags |= O_DIRECT;
+		case OPT_KNEE_THREADS:
+			args->kneeMaxThreads = atoi(optarg);
+			checkIntZero(args->kneeMaxThreads, "Wrong number of threads\n");
+			break;
 
-#ifdef USE_LARGEFILES
-	openFlags |= O_LARGEFILE;
-#endif
+		case OPT_KNEE_TIME:
+			args->kneeStepTime = atoi(optarg);
+			checkIntZero(args->kneeStepTime, "Wrong step time\n");
+			break;
 
-	fd = open(d->fileName, openFlags, 0600 );
-	if(fd == -1) {
-		fprintf(stderr, "%s: %s\n", strerror(errno), d->fileName);
-		return 0;
-	}
+		case OPT_KNEE_P99:
+			args->kneeP99 = atof(optarg);
+			break;
 
-	/* if doing real files, get them pre-allocated in size */
-	if (!args.rawDrives) {
-		t_log(LEVEL_DEBUG, "calling " xstr(TIO_ftruncate) "() on file descriptor");
-		rc = TIO_ftruncate(fd, bytesize); /* pre-allocate space */
-		if(rc != 0) {
-			perror(xstr(TIO_ftruncate) "() failed");
-			close(fd);
-			return 0;
-		}
-	}
+		case OPT_KNEE_GAIN:
+			args->kneeGain = atof(optarg);
+			break;
 
-	if (args.flushCaches)
-	{
-		if (!flush_caches())
-		{
-			close(fd);
-			return 0;
-                }
-        }
+		case OPT_STEADY:
+			args->steadyState = TRUE;
+			break;
 
-	timer_start( timings );
+		case OPT_STEADY_ROUNDS:
+			args->steadyRounds = atoi(optarg);
+			if (args->steadyRounds <= 0 || args->steadyRounds > MAX_STEADY_ROUNDS)
+			{
+				fprintf(stderr, "Wrong number of rounds %s\n", optarg);
+				exit(1);
+			}
+			break;
 
-	if(args.use_mmap)
-	{
-		/**
-		 * MEMORY-MAPPED OPERATIONS
-		 */
-		unsigned long chunk_num;
-		// rounds the number of mmap chunks up, basically ceiling function
-		TIO_off_t num_mmap_chunks = bytesize/MMAP_CHUNK_SIZE + 1;
+		case OPT_STEADY_WINDOW:
+			args->steadyWindow = atoi(optarg);
+			if (args->steadyWindow < 2)
+			{
+				fprintf(stderr, "Wrong window %s, at least 2 rounds\n", optarg);
+				exit(1);
+			}
+			break;
 
-		for(chunk_num=0; chunk_num < num_mmap_chunks; chunk_num++)
-		{
-			void *file_loc = NULL;
-			long this_chunk_offset = d->fileOffset + chunk_num*MMAP_CHUNK_SIZE;
-			long this_chunk_size = MIN(MMAP_CHUNK_SIZE, (TIO_off_t)bytesize - chunk_num*MMAP_CHUNK_SIZE);
-			long this_chunk_blocks = this_chunk_size / d->blockSize;
-			void *current_loc = NULL;
+		case OPT_STEADY_TIME:
+			args->steadyTime = atoi(optarg);
+			checkIntZero(args->steadyTime, "Wrong round time\n");
+			break;
 
-			file_loc=TIO_mmap(NULL,this_chunk_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,
-					  this_chunk_offset);
-			if(file_loc == MAP_FAILED) {
-				fprintf(stderr, "this_chunk_size=%ld, fd=%d, offset=" OFFSET_FORMAT
-					"\n", this_chunk_size, fd, d->fileOffset);
-				perror("Error " xstr(TIO_mmap) "()ing data file");
-				close(fd);
-				return 0;
-			}
+		case OPT_STEADY_BAND:
+			args->steadyBand = atof(optarg);
+			break;
 
-			madvise(file_loc, this_chunk_size, madvise_advice);
+		case OPT_STEADY_SLOPE:
+			args->steadySlope = atof(optarg);
+			break;
 
-			current_loc = file_loc - d->blockSize; // back-one hack for sequential case
-			while(io_ops--) {
-				int ret;
-				struct timeval tv_start, tv_stop;
+		case OPT_SWEEP_THREADS:
+			args->sweepThreadsCount = parse_list(optarg, args->sweepThreads,
+							     "Wrong thread count list\n");
+			break;
 
-				current_loc = (*loc_func)(file_loc, current_loc, d, &(seed));
+		case OPT_SWEEP_BLOCKS:
+			args->sweepBlocksCount = parse_list(optarg, args->sweepBlocks,
+							    "Wrong block size list\n");
+			break;
 
-				gettimeofday(&tv_start, NULL);
+		case OPT_DISKSTATS:
+			args->diskStats = TRUE;
+			break;
 
-				ret = mmap_func(current_loc, d);
-				if(ret != 0)
-					exit(ret);
+		case OPT_DISKSTATS_INTERVAL:
+			args->diskStatsInterval = atoi(optarg);
+			checkIntZero(args->diskStatsInterval, "Wrong interval\n");
+			args->diskStats = TRUE;
+			break;
 
-				if( args.syncWriting ) msync(current_loc, d->blockSize, MS_SYNC);
+		case OPT_PERF:
+#ifdef PERF_COUNTERS
+			args->perf = TRUE;
+			break;
+#else
+			fprintf(stderr, "This tiotest was built without perf counters\n");
+			exit(1);
+#endif
 
-				gettimeofday(&tv_stop, NULL);
-				update_latency_info(latencies, tv_start, tv_stop);
+		case OPT_SLOWEST:
+			args->slowest = atoi(optarg);
+			checkIntZero(args->slowest, "Wrong number of operations\n");
+			break;
+
+		case OPT_SLOW_MS:
+			args->slowMs = atof(optarg);
+			if (args->slowMs <= 0)
+			{
+				fprintf(stderr, "Wrong latency %s\n", optarg);
+				exit(1);
 			}
+			break;
 
-			(*blockCount) += orig_iops; // take this out of the for loop, we don't handle errors that well
+		case OPT_RAMP:
+		{
+			char *end;
 
-			munmap(file_loc, this_chunk_size);
-		}
+			if (strchr(optarg, 's'))
+				args->rampSecs = strtod(optarg, &end);
+			else
+				args->rampOps = strtoul(optarg, &end, 10);
+			if (end == optarg || (*end && strcmp(end, "s")) ||
+			    (args->rampSecs <= 0 && args->rampOps == 0))
+			{
+				fprintf(stderr, "Wrong ramp %s\n", optarg);
+				exit(1);
+			}
+			break;
+		}
+
+		case OPT_OPLOG:
+			strncpy(args->oplogFile, optarg, KBYTE - 1);
+			break;
+
+		case OPT_PROCESSES:
+			args->processes = TRUE;
+			break;
+
+		case OPT_AGENT:
+			snprintf(args->agentPort, sizeof(args->agentPort), "%s", optarg);
+			break;
+
+		case OPT_AGENT_BIND:
+			snprintf(args->agentBind, sizeof(args->agentBind), "%s", optarg);
+			break;
+
+		case OPT_AGENT_TOKEN:
+			snprintf(args->agentToken, sizeof(args->agentToken), "%s", optarg);
+			break;
+
+		case OPT_CONTROLLER:
+			snprintf(args->controller, sizeof(args->controller), "%s", optarg);
+			break;
+
+		case OPT_COMPRESS:
+		case OPT_DEDUPE:
+		{
+			const double ratio = atof(optarg);
+
+			if (ratio < 1)
+			{
+				fprintf(stderr, "Wrong ratio %s, 1 or more\n", optarg);
+				exit(1);
+			}
+			if (c == OPT_COMPRESS)
+				args->compressRatio = ratio;
+			else
+				args->dedupeRatio = ratio;
+			break;
+		}
+
+		case OPT_UNIQUE:
+			args->unique = TRUE;
+			break;
+
+		case OPT_EVICT:
+			args->evict = TRUE;
+			break;
+
+		case OPT_FADVISE:
+		{
+			int i, advice, first, last;
+			const char *spec = test_spec(optarg, &first, &last);
+
+			for(advice = 0; advice < sizeof(fadviseNames) / sizeof(*fadviseNames); advice++)
+				if (!strcmp(spec, fadviseNames[advice]))
+					break;
+
+			if (first == TEST_COUNT ||
+			    advice == sizeof(fadviseNames) / sizeof(*fadviseNames))
+			{
+				fprintf(stderr, "Wrong advice %s\n", optarg);
+				exit(1);
+			}
+
+			for(i = first; i <= last; i++)
+				args->fadvise[i] = advice;
+			break;
+		}
+
+		case OPT_READAHEAD:
+		{
+			int i, first, last;
+			const char *spec = test_spec(optarg, &first, &last);
+			const unsigned long long window = parse_size(spec);
+
+			if (first == TEST_COUNT || window == 0 || window > INT_MAX)
+			{
+				fprintf(stderr, "Wrong readahead window %s\n", optarg);
+				exit(1);
+			}
+
+			for(i = first; i <= last; i++)
+				args->readahead[i] = window;
+			break;
+		}
+
+		case OPT_ACCESS:
+		{
+			int i, first, last;
+			const char *spec = test_spec(optarg, &first, &last);
+			const char *param = strchr(spec, ':');
+			const int length = param ? param - spec : strlen(spec);
+			AccessPattern access;
+
+			memset(&access, 0, sizeof(AccessPattern));
+			for(access.kind = 0; access.kind < sizeof(accessNames) / sizeof(*accessNames); access.kind++)
+				if (strlen(accessNames[access.kind]) == length &&
+				    !strncmp(spec, accessNames[access.kind], length))
+					break;
+
+			if (access.kind == ACCESS_STRIDE && param)
+				access.stride = parse_size(param + 1);
+			else if (access.kind == ACCESS_INTERLEAVE && param)
+				access.streams = atoi(param + 1);
+
+			/* only stride and interleave take, and need, a parameter */
+			if (first == TEST_COUNT ||
+			    access.kind == sizeof(accessNames) / sizeof(*accessNames) ||
+			    (param != NULL) != (access.kind == ACCESS_STRIDE ||
+						access.kind == ACCESS_INTERLEAVE) ||
+			    (access.kind == ACCESS_STRIDE && access.stride == 0) ||
+			    (access.kind == ACCESS_INTERLEAVE && access.streams < 1))
+			{
+				fprintf(stderr, "Wrong access pattern %s\n", optarg);
+				exit(1);
+			}
+
+			for(i = first; i <= last; i++)
+				args->access[i] = access;
+			break;
+		}
+
+		case OPT_MEM_LIMIT:
+			args->memLimit = parse_size(optarg);
+			if (args->memLimit < MBYTE)
+			{
+				fprintf(stderr, "Wrong memory limit %s, 1m or more\n", optarg);
+				exit(1);
+			}
+			break;
+
+		case OPT_MLOCK:
+		case OPT_PAGE_CACHE:
+		{
+			const unsigned long long size = parse_size(optarg);
+
+			if (size == 0)
+			{
+				fprintf(stderr, "Wrong memory size %s\n", optarg);
+				exit(1);
+			}
+			if (c == OPT_MLOCK)
+				args->mlockBytes = size;
+			else
+				args->pageCache = size;
+			break;
+		}
+
+		case OPT_AMPLIFICATION:
+			args->amplification = TRUE;
+			args->diskStats = TRUE;
+			break;
+
+		case 'k':
+		{
+			const int i = atoi(optarg);
+			if (i < TEST_COUNT)
+			{
+				args->testsToRun[i] = 0;
+				break;
+			}
+			else
+				fprintf(stderr, "Wrong test number %d\n", i);
+			/* Go through */
+		}
+		case '?':
+		default:
+			fprintf(stderr, "Try 'tiotest -h' for more information\n");
+			exit(1);
+			break;
+		}
+	}
+}
+
+/*
+  Job files describe groups of threads, ini style:
+
+    [global]
+    directory = /mnt/test
+    size = 100
+
+    [stream]
+    threads = 4
+    block = 1m
+    pattern = write
+
+    [lookups]
+    threads = 16
+    block = 4k
+    pattern = rread
+    runtime = 60
+    rate = 2
+
+  Keys are threads, block (bytes, k/m/g suffix), bsdist (as --bsdist),
+  size (MBytes per thread), pattern (write, rwrite, read or rread), ops
+  (per thread), directory, rate (MBytes/s per thread), runtime (seconds)
+  and stage.
+  [global] sets the defaults of the groups after it. Groups of the same
+  stage run concurrently, stages run in ascending order. Lines starting
+  with # or ; are comments.
+*/
+
+static void job_error(const char *file, int line, const char *message,
+		      const char *value)
+{
+	fprintf(stderr, "%s:%d: %s %s\n", file, line, message, value);
+	exit(1);
+}
+
+static char *trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+
+	return s;
+}
+
+static void set_job_key(JobGroup *g, const char *key, const char *value,
+			const char *file, int line)
+{
+	if (!strcmp(key, "threads"))
+		g->numThreads = atoi(value);
+	else if (!strcmp(key, "block"))
+		g->blockSize = parse_size(value);
+	else if (!strcmp(key, "size"))
+		g->fileSizeInMBytes = atoi(value);
+	else if (!strcmp(key, "ops"))
+		g->numOps = strtoul(value, NULL, 10);
+	else if (!strcmp(key, "directory"))
+		strncpy(g->path, value, KBYTE - 1);
+	else if (!strcmp(key, "rate"))
+		g->rateLimit = atof(value) * MBYTE;
+	else if (!strcmp(key, "runtime"))
+		g->runtime = atoi(value);
+	else if (!strcmp(key, "stage"))
+		g->stage = atoi(value);
+	else if (!strcmp(key, "bsdist"))
+	{
+		if (parse_block_dist(value, &g->blockDist))
+			job_error(file, line, "Wrong block size distribution", value);
+	}
+	else if (!strcmp(key, "pattern"))
+	{
+		int i;
+
+		for(i = 0; i < TEST_COUNT; i++)
+			if (!strcmp(value, testNames[i]))
+				break;
+
+		if (i == TEST_COUNT)
+			job_error(file, line, "Unknown pattern", value);
+
+		g->testCase = i;
+	}
+	else
+		job_error(file, line, "Unknown key", key);
+}
+
+static void load_job_file(const char *file)
+{
+	FILE *f;
+	char buf[KBYTE];
+	JobGroup defaults;
+	JobGroup *g = NULL;	/* section being read, &defaults in [global] */
+	int line = 0;
+	int i, j;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), file);
+		exit(1);
+	}
+
+	memset(&defaults, 0, sizeof(JobGroup));
+	defaults.numThreads = 1;
+	defaults.blockSize = args.blockSize;
+	defaults.fileSizeInMBytes = args.fileSizeInMBytes;
+	defaults.testCase = WRITE_TEST;
+	strcpy(defaults.path, args.path[0]);
+
+	while (fgets(buf, sizeof(buf), f))
+	{
+		char *s = trim(buf);
+		char *value;
+
+		line++;
+
+		if (*s == '\0' || *s == '#' || *s == ';')
+			continue;
+
+		if (*s == '[')
+		{
+			char *end = strchr(s, ']');
+
+			if (end == NULL)
+				job_error(file, line, "Unterminated section", s);
+			*end = '\0';
+			s++;
+
+			if (!strcmp(s, "global"))
+			{
+				g = &defaults;
+				continue;
+			}
+
+			if (jobs.count == MAX_JOB_GROUPS)
+				job_error(file, line, "Too many job groups at", s);
+
+			g = &jobs.groups[jobs.count++];
+			*g = defaults;
+			strncpy(g->name, s, JOB_NAME_LENGTH - 1);
+			continue;
+		}
+
+		value = strchr(s, '=');
+		if (value == NULL || g == NULL)
+			job_error(file, line, "Expected key = value in a section, got", s);
+		*value++ = '\0';
+
+		set_job_key(g, trim(s), trim(value), file, line);
+	}
+
+	fclose(f);
+
+	if (jobs.count == 0)
+	{
+		fprintf(stderr, "%s: No job groups\n", file);
+		exit(1);
+	}
+
+	for(i = 0; i < jobs.count; i++)
+	{
+		const JobGroup *g = &jobs.groups[i];
+
+		if (g->numThreads <= 0 || g->blockSize <= 0 ||
+		    (TIO_off_t)g->fileSizeInMBytes * MBYTE < g->blockSize)
+		{
+			fprintf(stderr, "%s: Group %s needs threads, block and a size of at least one block\n",
+				file, g->name);
+			exit(1);
+		}
+
+		/* insert into the sorted list of stages */
+		for(j = 0; j < jobs.stagesCount && jobs.stages[j] < g->stage; j++)
+			;
+		if (j < jobs.stagesCount && jobs.stages[j] == g->stage)
+			continue;
+		memmove(&jobs.stages[j + 1], &jobs.stages[j],
+			(jobs.stagesCount - j) * sizeof(int));
+		jobs.stages[j] = g->stage;
+		jobs.stagesCount++;
+	}
+}
+
+static int flush_caches()
+{
+	int retVal = 0;
+	int fd;
+
+	if (geteuid() != 0)
+	{
+		fprintf(stderr, "Cache flushing requires root.\n");
+	}
+	else
+	{
+		fd = open(CACHE_CONTROL_FILE, O_WRONLY);
+		if (fd == -1)
+		{
+			fprintf(stderr, "%s: %s\n", strerror(errno),
+ 				CACHE_CONTROL_FILE);
+		}
+		else
+		{
+			char drop_all_message[] = CACHE_DROP_ALL_FLAG;
+			int length = strlen(drop_all_message);
+			int written = write(fd, drop_all_message,
+					    length);
+			if (written == -1)
+			{
+				fprintf(stderr, "%s: %s\n", strerror(errno),
+					drop_all_message);
+			}
+			else if (written != length)
+			{
+				fprintf(stderr,
+					"Error: only wrote %d of %d bytes.\n",
+					written, length);
+			}
+			else
+			{
+				// successful write.
+				retVal = 1;
+			}
+			close(fd);
+		}
+	}
+	return retVal;
+}
+
+static int is_write_test(int testCase)
+{
+	return testCase == WRITE_TEST || testCase == RANDOM_WRITE_TEST;
+}
+
+/* any phase or job group with a block size distribution */
+static int block_dists_used( void )
+{
+	int i;
+
+	for(i = 0; i < TEST_COUNT; i++)
+		if (args.blockDist[i].count)
+			return TRUE;
+
+	for(i = 0; i < jobs.count; i++)
+		if (jobs.groups[i].blockDist.count)
+			return TRUE;
+
+	return FALSE;
+}
+
+static void check_block_dist(const BlockDist *dist, int fileSizeInMBytes,
+			     const char *name)
+{
+	int i;
+
+	for(i = 0; i < dist->count; i++)
+	{
+		if (dist->size[i] > (unsigned long)fileSizeInMBytes * MBYTE)
+		{
+			fprintf(stderr, "Block size %lu of %s is larger than its file\n",
+				dist->size[i], name);
+			exit(1);
+		}
+	}
+}
+
+/*
+  Flush written data to stable storage: loc != NULL means flush the
+  mmapped region instead of the file descriptor
+*/
+static int do_flush(int fd, void *loc, size_t length, Latencies *lat)
+{
+	struct timeval tv_start, tv_stop;
+	int rc;
+
+	gettimeofday(&tv_start, NULL);
+
+	if (loc)
+		rc = msync(loc, length, MS_SYNC);
+	else if (args.flushData)
+		rc = fdatasync(fd);
+	else
+		rc = fsync(fd);
+
+	gettimeofday(&tv_stop, NULL);
+
+	if (rc)
+		perror("Error flushing data file");
+	else if (lat)
+		update_latency_info(lat, tv_start, tv_stop);
+
+	return rc;
+}
+
+/* true when the --fsync-ops/--fsync-mb cadence calls for a flush */
+static int flush_due(unsigned long *ops, unsigned long long *bytes,
+		     unsigned long size)
+{
+	(*ops)++;
+	(*bytes) += size;
+
+	if ((args.fsyncOps && *ops >= args.fsyncOps) ||
+	    (args.fsyncBytes && *bytes >= args.fsyncBytes))
+	{
+		*ops = 0;
+		*bytes = 0;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void init_patterns( void )
+{
+	unsigned long long x = ((unsigned long long)get_random_seed() << 32) | getpid();
+	unsigned long long *pool;
+	int i;
+
+	patterns.pool = tt_aligned_alloc(PATTERN_POOL_SIZE);
+	patterns.runId = x ^ (x >> 32);
+	pool = (unsigned long long *)patterns.pool;
+
+	/* xorshift64, random enough for any compressor */
+	for(i = 0; i < PATTERN_POOL_SIZE / sizeof(*pool); i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		pool[i] = x;
+	}
+
+	patterns.active = TRUE;
+}
+
+/*
+  Fills the first length bytes of the buffer of d with the next data
+  to write. Copies and zeroing only, so it keeps up with memory
+  bandwidth rather than a random number generator.
+*/
+static void fill_pattern(ThreadData *d, unsigned long length)
+{
+	const double duplicates = args.dedupeRatio > 1 ?
+		RAND_MAX * (1 - 1 / args.dedupeRatio) : -1;
+	const int stamp = args.unique || args.dedupeRatio > 1;
+	unsigned long pos;
+
+	for(pos = 0; pos < length; pos += PATTERN_CHUNK)
+	{
+		const unsigned long len = MIN(PATTERN_CHUNK, length - pos);
+		const unsigned long random = MIN(len, (unsigned long)(len / args.compressRatio + 0.5));
+		const int duplicate = rand_r(&d->patternSeed) < duplicates;
+		unsigned long src;
+
+		if (duplicate)
+			src = (rand_r(&d->patternSeed) % PATTERN_DEDUPE_CHUNKS) * PATTERN_CHUNK;
+		else
+			src = (rand_r(&d->patternSeed) %
+			       ((PATTERN_POOL_SIZE - PATTERN_CHUNK) / 8)) * 8;
+
+		memcpy(d->buffer + pos, patterns.pool + src, random);
+		memset(d->buffer + pos + random, 0, len - random);
+
+		if (stamp && !duplicate)
+		{
+			const unsigned long long id[2] = {
+				d->patternSeq++,
+				((unsigned long long)patterns.runId << 32) | d->myNumber };
+
+			memcpy(d->buffer + pos, id, MIN(len, sizeof(id)));
+		}
+	}
+}
+
+/*
+  Writes the file up to its full size unless it is that big already,
+  so that reads hit real data instead of holes. Not timed.
+*/
+static int prefill_file(int fd, TIO_off_t bytesize, ThreadData *d)
+{
+	const unsigned long blockSize = d->blockSize;
+	struct stat st;
+	TIO_off_t offset;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size >= bytesize)
+		return 0;
+
+	t_log(LEVEL_INFO, "Filling test file before the test");
+
+	for(offset = (st.st_size / blockSize) * blockSize; offset < bytesize;
+	    offset += blockSize)
+	{
+		const size_t len = MIN(blockSize, bytesize - offset);
+
+		if (patterns.active)
+			fill_pattern(d, len);
+
+		if (TIO_pwrite(fd, d->buffer, len, offset) != len)
+		{
+			perror("Error filling test file");
+			return -1;
+		}
+	}
+
+	return fsync(fd);
+}
+
+#ifdef PERF_COUNTERS
+/*
+  Opens the perfEvents counters of the calling thread, disabled. Kernel
+  time is counted unless perf_event_paranoid forbids it.
+*/
+static void perf_open(int *fds)
+{
+	int i;
+
+	for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perfEvents[i].type;
+		attr.config = perfEvents[i].config;
+		attr.disabled = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		/* once one thread fell back, all count the same events */
+		attr.exclude_kernel = attr.exclude_hv = *perfUserOnly;
+
+		fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fds[i] < 0 && errno == EACCES && !*perfUserOnly)
+		{
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+			if (fds[i] >= 0)
+				*perfUserOnly = TRUE;
+		}
+	}
+}
+
+static void perf_start(int *fds)
+{
+	int i;
+
+	for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+		if (fds[i] >= 0)
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/* stops and closes the counters, scaling any the kernel multiplexed */
+static void perf_stop(int *fds, PerfCounts *counts)
+{
+	int i;
+
+	for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		unsigned long long v[3];
+
+		if (fds[i] < 0)
+			continue;
+
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fds[i], v, sizeof(v)) == sizeof(v) && v[2])
+		{
+			counts->value[i] += v[2] < v[1] ?
+				(unsigned long long)((double)v[0] * v[1] / v[2]) : v[0];
+			counts->valid |= 1 << i;
+		}
+		close(fds[i]);
+		fds[i] = -1;
+	}
+}
+#else
+static void perf_open(int *fds)
+{
+	int i;
+
+	for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+		fds[i] = -1;
+}
+
+static void perf_start(int *fds) {}
+
+static void perf_stop(int *fds, PerfCounts *counts) {}
+#endif
+
+static void set_slow_floor(ThreadData *d)
+{
+	d->slowFloor = args.slowMs ? args.slowMs / 1000 : HUGE_VAL;
+
+	if (args.slowest)
+		d->slowFloor = MIN(d->slowFloor, d->slowestCount < args.slowest ?
+				   0 : d->slowest[0].latency);
+}
+
+static void reset_slow_ops(ThreadData *d)
+{
+	d->slowestCount = 0;
+	d->slowOpsCount = 0;
+	d->slowOpsDropped = 0;
+	set_slow_floor(d);
+}
+
+/*
+  Called for ops slower than d->slowFloor only, which is all the fast
+  path pays for --slowest and --slow-ms.
+*/
+static void note_slow_op(ThreadData *d, int testCase, struct timeval start,
+			 double latency, TIO_off_t offset, unsigned long size)
+{
+	SlowOp op;
+
+	op.start = start;
+	op.latency = latency;
+	op.offset = offset;
+	op.size = size;
+	op.testCase = testCase;
+
+	if (args.slowMs && latency * 1000 > args.slowMs)
+	{
+		if (d->slowOpsCount < MAX_SLOW_OPS)
+			d->slowOps[d->slowOpsCount++] = op;
+		else
+			d->slowOpsDropped++;
+	}
+
+	if (args.slowest)
+	{
+		SlowOp *heap = d->slowest;
+		int i = 0, child;
+
+		if (d->slowestCount < args.slowest)
+		{
+			/* sift up from the new leaf */
+			for(i = d->slowestCount++; i > 0 && heap[(i - 1) / 2].latency > latency;
+			    i = (i - 1) / 2)
+				heap[i] = heap[(i - 1) / 2];
+			heap[i] = op;
+		}
+		else if (latency > heap[0].latency)
+		{
+			/* replace the fastest and sift it down */
+			while ((child = 2 * i + 1) < d->slowestCount)
+			{
+				if (child + 1 < d->slowestCount &&
+				    heap[child + 1].latency < heap[child].latency)
+					child++;
+				if (heap[child].latency >= latency)
+					break;
+				heap[i] = heap[child];
+				i = child;
+			}
+			heap[i] = op;
+		}
+	}
+
+	set_slow_floor(d);
+}
+
+/* the I/O thread side of --oplog, never waits for the flusher */
+static void oplog_record(ThreadData *d, int testCase, struct timeval start,
+			 double latency, TIO_off_t offset, unsigned long size)
+{
+	OplogRing *ring = &d->oplog;
+	OplogRecord *r;
+
+	if (ring->head - ring->tail >= OPLOG_RING_RECORDS)
+	{
+		ring->dropped++;
+		return;
+	}
+
+	r = &ring->records[ring->head % OPLOG_RING_RECORDS];
+	r->start = ((unsigned long long)(start.tv_sec - oplog.start.tv_sec) * 1000000 +
+		    start.tv_usec - oplog.start.tv_usec) * 1000;
+	r->offset = offset;
+	r->size = size;
+	r->duration = MIN(latency * 1000000 + 0.5, (double)UINT_MAX);
+	r->thread = d->myNumber;
+	r->test = testCase;
+
+	/* the record has to be complete before the flusher sees it */
+	__sync_synchronize();
+	ring->head++;
+}
+
+/*
+  The readahead of a streaming reader: keeps window bytes past the
+  current read prefetched, topping them up once half of them has been
+  read. A read outside the prefetched range starts over from there.
+*/
+static void read_ahead(int fd, TIO_off_t offset, unsigned long window,
+		       TIO_off_t *start, TIO_off_t *end)
+{
+	if (offset < *start || offset >= *end)
+		*start = *end = offset;
+
+	if (*end - offset <= window / 2)
+	{
+		readahead(fd, *end, offset + window - *end);
+		*end = offset + window;
+	}
+}
+
+static int pick_block_size(const BlockDist *dist, unsigned int *seed)
+{
+	int pick = get_random_number(dist->totalWeight, seed);
+	int i;
+
+	for(i = 0; i < dist->count - 1; i++)
+	{
+		pick -= dist->weight[i];
+		if (pick < 0)
+			break;
+	}
+
+	return i;
+}
+
+/*
+  Keeps a thread under its rate limit, and tells when its runtime
+  is up. Only called for threads that have either.
+*/
+static int pace_thread(const ThreadData *d, const struct timeval *begin,
+		       const struct timeval *now, unsigned long long bytes)
+{
+	const double elapsed = (now->tv_sec - begin->tv_sec) +
+		(now->tv_usec - begin->tv_usec) / 1000000.0;
+
+	if (d->runtime && elapsed >= d->runtime)
+		return TRUE;
+
+	if (d->rateLimit)
+	{
+		const double due = (double)bytes / d->rateLimit;
+
+		if (due > elapsed)
+			usleep((due - elapsed) * 1000000.0);
+	}
+
+	return FALSE;
+}
+
+/* lets the phase start once every thread is done with its ramp */
+static void ramp_wait( void )
+{
+	if (ramp->sync &&
+	    pthread_barrier_wait(&ramp->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+		gettimeofday(&ramp->measureStart, NULL);
+}
+
+/*
+  Runs the workload of the phase without recording anything, to get
+  past cold caches, first touches and device wakeups, then waits for
+  the other threads.
+*/
+static void ramp_thread(file_io_function io_func,
+			file_offset_function offset_func,
+			ThreadData *d, int fd, TIO_off_t bytesize)
+{
+	const TIO_off_t end_offset = d->fileOffset + bytesize;
+	TIO_off_t offset = d->fileOffset - d->blockSize;
+	unsigned int seed = get_random_seed();
+	struct timeval begin, now;
+	struct rusage before, after;
+	unsigned long done;
+
+	d->ioSize = d->lastIoSize = d->blockSize;
+	getrusage(RUSAGE_THREAD, &before);
+	gettimeofday(&begin, NULL);
+
+	for(done = 0; args.rampSecs || done < args.rampOps; done++)
+	{
+		int ret;
+
+		offset = (*offset_func)(offset, d, &seed);
+		if (offset + d->ioSize > end_offset)
+			offset = d->fileOffset;
+
+		ret = (*io_func)(fd, offset, d);
+		if (ret != 0)
+			exit(ret);
+
+		if (args.rampSecs)
+		{
+			gettimeofday(&now, NULL);
+			if ((now.tv_sec - begin.tv_sec) +
+			    (now.tv_usec - begin.tv_usec) / 1000000.0 >= args.rampSecs)
+				break;
+		}
+	}
+
+	getrusage(RUSAGE_THREAD, &after);
+	timersub(&after.ru_utime, &before.ru_utime, &d->rampUserTime);
+	timersub(&after.ru_stime, &before.ru_stime, &d->rampSysTime);
+
+	ramp_wait();
+}
+
+static void* do_generic_test(file_io_function io_func,
+			     mmap_io_function mmap_func,
+			     file_offset_function offset_func,
+			     mmap_loc_function loc_func,
+			     ThreadData *d,
+			     int madvise_advice,
+			     unsigned long io_ops,
+			     int testCase)
+{
+	PhaseStats *stats = &(d->phase[testCase]);
+	int     fd;
+	int     stonewalled = FALSE;
+	Latencies *flushLatency = NULL;
+	int     cadence = FALSE;
+	unsigned long flushOps = 0;
+	unsigned long long flushBytes = 0;
+	TIO_off_t  blocks=((TIO_off_t)d->fileSizeInMBytes*MBYTE)/d->blockSize;
+	unsigned int seed = get_random_seed();
+	unsigned long orig_iops = io_ops;
+	const unsigned long long startBytes = stats->bytes;
+	int     perfFds[PERF_COUNTERS_COUNT];
+	double  latency;
+	const int fillPattern = patterns.active && is_write_test(testCase);
+
+	int     rc;
+	TIO_off_t  bytesize=blocks*d->blockSize; /* truncates down to BS multiple */
+
+	// for now, always read/write, just easier
+	int openFlags = O_RDWR;
+
+	// if not a pre-existing device, add create flag
+	if (!args.rawDrives)
+		openFlags |= O_CREAT;
+
+	// if sync I/O requested, do it at open time
+	if( args.syncWriting )
+		openFlags |= args.dsyncWriting ? O_DSYNC : O_SYNC;
+
+	if (is_write_test(testCase))
+	{
+		flushLatency = &(stats->flushLatency);
+		cadence = args.fsyncOps || args.fsyncBytes;
+	}
+
+	/* --access replaces the offsets the phase has by default */
+	if (args.access[testCase].kind >= 0)
+	{
+		offset_func = accessOffsets[args.access[testCase].kind];
+		loc_func = accessLocs[args.access[testCase].kind];
+	}
+	d->access = &args.access[testCase];
+
+	// if direct I/O requested, do it at open time
+	if( args.openDirect )
+		openFlags |= O_DIRECT;
+
+#ifdef USE_LARGEFILES
+	openFlags |= O_LARGEFILE;
+#endif
+
+	fd = open(d->fileName, openFlags, 0600 );
+	if(fd == -1) {
+		fprintf(stderr, "%s: %s\n", strerror(errno), d->fileName);
+		ramp_wait();
+		return 0;
+	}
+
+	/* reading phases without a write phase before them need data */
+	if (d->prefill && !args.rawDrives &&
+	    prefill_file(fd, bytesize, d))
+	{
+		close(fd);
+		ramp_wait();
+		return 0;
+	}
+
+	/* if doing real files, get them pre-allocated in size */
+	if (!args.rawDrives) {
+		struct stat st;
+
+		/* never shrink a file that other threads have areas in */
+		if (fstat(fd, &st) || st.st_size < d->fileOffset + bytesize) {
+			t_log(LEVEL_DEBUG, "calling " xstr(TIO_ftruncate) "() on file descriptor");
+			rc = TIO_ftruncate(fd, d->fileOffset + bytesize); /* pre-allocate space */
+			if(rc != 0) {
+				perror(xstr(TIO_ftruncate) "() failed");
+				close(fd);
+				ramp_wait();
+				return 0;
+			}
+		}
+	}
+
+	if (args.flushCaches)
+	{
+		if (!flush_caches())
+		{
+			close(fd);
+			ramp_wait();
+			return 0;
+                }
+        }
+
+	/* advice is kept per open file, so every thread gives its own */
+	if (args.fadvise[testCase] >= 0)
+		posix_fadvise(fd, d->fileOffset, bytesize,
+			      fadviseValues[args.fadvise[testCase]]);
+
+	if (ramp->active)
+		ramp_thread(io_func, offset_func, d, fd, bytesize);
+
+	if (args.perf)
+		perf_open(perfFds);
+
+	timer_start( &(stats->timings) );
+
+	if (args.perf)
+		perf_start(perfFds);
+
+	if(args.use_mmap)
+	{
+		/**
+		 * MEMORY-MAPPED OPERATIONS
+		 */
+		unsigned long chunk_num;
+		// rounds the number of mmap chunks up, basically ceiling function
+		TIO_off_t num_mmap_chunks = bytesize/MMAP_CHUNK_SIZE + 1;
+
+		for(chunk_num=0; chunk_num < num_mmap_chunks; chunk_num++)
+		{
+			void *file_loc = NULL;
+			long this_chunk_offset = d->fileOffset + chunk_num*MMAP_CHUNK_SIZE;
+			long this_chunk_size = MIN(MMAP_CHUNK_SIZE, (TIO_off_t)bytesize - chunk_num*MMAP_CHUNK_SIZE);
+			void *current_loc = NULL;
+
+			file_loc=TIO_mmap(NULL,this_chunk_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,
+					  this_chunk_offset);
+			if(file_loc == MAP_FAILED) {
+				fprintf(stderr, "this_chunk_size=%ld, fd=%d, offset=" OFFSET_FORMAT
+					"\n", this_chunk_size, fd, d->fileOffset);
+				perror("Error " xstr(TIO_mmap) "()ing data file");
+				close(fd);
+				if (args.perf)
+					perf_stop(perfFds, &stats->perf);
+				return 0;
+			}
+
+			madvise(file_loc, this_chunk_size, madvise_advice);
+
+			current_loc = file_loc - d->blockSize; // back-one hack for sequential case
+			while(io_ops--) {
+				int ret;
+				struct timeval tv_start, tv_stop;
+
+				if (stonewall->hit && !stonewalled)
+				{
+					stats->stonewallBlocks = orig_iops - io_ops - 1;
+					stats->stonewallBytes = (unsigned long long)stats->stonewallBlocks * d->blockSize;
+					stonewalled = TRUE;
+				}
+
+				current_loc = (*loc_func)(file_loc, current_loc, d, &(seed));
+
+				if (fillPattern)
+					fill_pattern(d, d->blockSize);
+
+				gettimeofday(&tv_start, NULL);
+
+				ret = mmap_func(current_loc, d);
+				if(ret != 0)
+					exit(ret);
+
+				if( args.syncWriting ) msync(current_loc, d->blockSize, MS_SYNC);
+
+				gettimeofday(&tv_stop, NULL);
+				latency = update_latency_info(&(stats->latency), tv_start, tv_stop);
+				if (latency > d->slowFloor)
+					note_slow_op(d, testCase, tv_start, latency,
+						     this_chunk_offset + ((char *)current_loc - (char *)file_loc),
+						     d->blockSize);
+				if (d->oplog.records)
+					oplog_record(d, testCase, tv_start, latency,
+						     this_chunk_offset + ((char *)current_loc - (char *)file_loc),
+						     d->blockSize);
+
+				if (cadence && flush_due(&flushOps, &flushBytes, d->blockSize))
+					do_flush(fd, file_loc, this_chunk_size, flushLatency);
+			}
+
+			// take this out of the for loop, we don't handle errors that well
+			stats->blocks += orig_iops;
+			stats->bytes += (unsigned long long)orig_iops * d->blockSize;
+
+			munmap(file_loc, this_chunk_size);
+		}
 	} else {
 		/**
 		 * REGULAR I/O OPERATIONS
 		 */
 		//TIO_off_t current_offset = d->fileOffset;
 		TIO_off_t current_offset = d->fileOffset - d->blockSize; // back-one hack for sequential case
+		const TIO_off_t end_offset = d->fileOffset + bytesize;
+		const int pacing = d->runtime || d->rateLimit;
+		const BlockDist *dist = d->blockDist[testCase];
+		const unsigned long raWindow = is_write_test(testCase) ? 0 : args.readahead[testCase];
+		TIO_off_t raStart = 0, raEnd = 0;
+		int sizeIndex = 0;
+		struct timeval tv_begin;
+		unsigned long done;
+
+		if (dist && dist->count == 0)
+			dist = NULL;
+
+		if (dist && stats->sizeLatency == NULL)
+		{
+			stats->sizeLatency = calloc(dist->count, sizeof(Latencies));
+			if (stats->sizeLatency == NULL)
+			{
+				perror("Error calloc()ing block size latency memory");
+				close(fd);
+				if (args.perf)
+					perf_stop(perfFds, &stats->perf);
+				return 0;
+			}
+		}
+
+		d->ioSize = d->lastIoSize = d->blockSize;
+
+		gettimeofday(&tv_begin, NULL);
+
+		for(done = 0; done < io_ops; done++)
+		{
+			struct timeval tv_start, tv_stop;
+			int ret;
+
+			if (stonewall->hit && !stonewalled)
+			{
+				stats->stonewallBlocks = done;
+				stats->stonewallBytes = stats->bytes;
+				stonewalled = TRUE;
+			}
+
+			if (dist)
+			{
+				sizeIndex = pick_block_size(dist, &(seed));
+				d->ioSize = dist->size[sizeIndex];
+			}
+
+			current_offset = (*offset_func)(current_offset, d, &(seed));
+			if (current_offset + d->ioSize > end_offset)
+			{
+				// ULONG_MAX operations means up to the end of the file
+				if (io_ops == ULONG_MAX && !d->runtime)
+					break;
+				current_offset = d->fileOffset; // sequential wraps around with a runtime
+			}
+
+			if (fillPattern)
+				fill_pattern(d, d->ioSize);
+
+			if (raWindow)
+				read_ahead(fd, current_offset, raWindow, &raStart, &raEnd);
+
+			gettimeofday(&tv_start, NULL);
+			ret = (*io_func)(fd, current_offset, d);
+			if(ret != 0)
+				exit(ret);
+
+			gettimeofday(&tv_stop, NULL);
+			latency = update_latency_info(&(stats->latency), tv_start, tv_stop);
+			if (dist)
+				update_latency_info(&(stats->sizeLatency[sizeIndex]), tv_start, tv_stop);
+			if (latency > d->slowFloor)
+				note_slow_op(d, testCase, tv_start, latency,
+					     current_offset, d->ioSize);
+			if (d->oplog.records)
+				oplog_record(d, testCase, tv_start, latency,
+					     current_offset, d->ioSize);
+
+			stats->bytes += d->ioSize;
+			d->lastIoSize = d->ioSize;
+
+			if (cadence && flush_due(&flushOps, &flushBytes, d->ioSize))
+				do_flush(fd, NULL, 0, flushLatency);
+
+			if (pacing && pace_thread(d, &tv_begin, &tv_stop, stats->bytes - startBytes))
+			{
+				done++;
+				break;
+			}
+		}
+
+		orig_iops = done;
+		stats->blocks += done;
+	}
+
+	if (stonewall->armed)
+	{
+		if (__sync_bool_compare_and_swap(&stonewall->hit, 0, 1))
+			gettimeofday(&stonewall->time, NULL);
+
+		if (!stonewalled)
+		{
+			stats->stonewallBlocks = orig_iops;
+			stats->stonewallBytes = stats->bytes;
+		}
+	}
+
+	do_flush(fd, NULL, 0, flushLatency);
+
+	close(fd);
+
+	if (args.perf)
+		perf_stop(perfFds, &stats->perf);
+
+	timer_stop( &(stats->timings) );
+
+	return 0;
+}
+
+static unsigned long get_number_of_blocks(ThreadData *d)
+{
+	return (d->fileSizeInMBytes * MB) / d->blockSize;
+}
+
+/* with mixed block sizes sequential phases go on up to the end of the file */
+static unsigned long sequential_ops(ThreadData *d, int testCase)
+{
+	if (d->blockDist[testCase] && d->blockDist[testCase]->count)
+		return ULONG_MAX;
+
+	return get_number_of_blocks(d);
+}
+
+static void do_read_test( ThreadData *d )
+{
+	t_log(LEVEL_INFO, "Doing sequential read test");
+	do_generic_test(do_pread_operation, do_mmap_read_operation,
+			get_sequential_offset, get_sequential_loc,
+			d, MADV_SEQUENTIAL, sequential_ops(d, READ_TEST),
+			READ_TEST);
+}
+
+static void do_write_test( ThreadData *d )
+{
+	t_log(LEVEL_INFO, "Doing sequential write test");
+	do_generic_test(do_pwrite_operation, do_mmap_write_operation,
+			get_sequential_offset, get_sequential_loc,
+			d, MADV_SEQUENTIAL, sequential_ops(d, WRITE_TEST),
+			WRITE_TEST);
+}
+
+static void do_random_read_test( ThreadData *d )
+{
+	t_log(LEVEL_INFO, "Doing random read test");
+	do_generic_test(do_pread_operation, do_mmap_read_operation,
+			get_random_offset, get_random_loc,
+			d, MADV_RANDOM, d->numRandomOps,
+			RANDOM_READ_TEST);
+}
+
+static void do_random_write_test( ThreadData *d )
+{
+	t_log(LEVEL_INFO, "Doing random write test");
+	do_generic_test(do_pwrite_operation, do_mmap_write_operation,
+			get_random_offset, get_random_loc,
+			d, MADV_RANDOM, d->numRandomOps,
+			RANDOM_WRITE_TEST);
+}
+
+static const TestFunc Tests[] = {
+    do_write_test,
+    do_random_write_test,
+    do_read_test,
+    do_random_read_test,
+};
+
+static void initialize_thread( ThreadData *t )
+{
+	int i, j;
+
+	pthread_attr_init( &(t->thread_attr) );
+
+	pthread_attr_setscope(&(t->thread_attr),
+			      PTHREAD_SCOPE_SYSTEM);
+
+	/* big enough for the largest size of any phase */
+	t->bufferSize = t->blockSize;
+	for(i = 0; i < TEST_COUNT; i++)
+		if (t->blockDist[i])
+			for(j = 0; j < t->blockDist[i]->count; j++)
+				if (t->blockDist[i]->size[j] > t->bufferSize)
+					t->bufferSize = t->blockDist[i]->size[j];
+
+	t->ioSize = t->blockSize;
+	t->buffer = tt_aligned_alloc( t->bufferSize );
+	t->patternSeed = get_random_seed() ^ (t->myNumber * 2654435761u);
+
+	if (args.slowest)
+		t->slowest = tt_shared_alloc(args.slowest * sizeof(SlowOp));
+	if (args.slowMs)
+		t->slowOps = tt_shared_alloc(MAX_SLOW_OPS * sizeof(SlowOp));
+	if ((args.slowest && t->slowest == NULL) ||
+	    (args.slowMs && t->slowOps == NULL))
+	{
+		perror("Error allocating slow operation lists");
+		exit(-1);
+	}
+	reset_slow_ops(t);
+
+	/* workers cannot allocate anything their parent would see */
+	if (args.processes)
+		for(i = 0; i < TEST_COUNT; i++)
+			if (t->blockDist[i] && t->blockDist[i]->count)
+			{
+				t->phase[i].sizeLatency = tt_shared_alloc(
+					t->blockDist[i]->count * sizeof(Latencies));
+				if (t->phase[i].sizeLatency == NULL)
+				{
+					perror("Error allocating block size latency memory");
+					exit(-1);
+				}
+			}
+
+	if( args.consistencyCheckData )
+	{
+		const unsigned long bsize = t->blockSize;
+		unsigned char *b = t->buffer;
+
+		for(j = 0; j < bsize; j++)
+		{
+			b[j] = rand() & 0xFF;
+		}
+
+		t->bufferCrc = crc32(b, bsize, 0);
+	}
+}
+
+static void set_file_name( ThreadData *t, const char *path, int n )
+{
+	/* sweeps lay out one file per path, see place_thread() */
+	if (args.sweepThreadsCount || args.sweepBlocksCount)
+		sprintf(t->fileName, "%s/_tiotest_pid%d.sweep", path, (int) getpid());
+	/* agents on different hosts may share a filesystem and pids */
+	else if (agentLink.out)
+		sprintf(t->fileName, "%s/_tiotest_agent%d_pid%d.thr%d",
+			path, agentLink.number, (int) getpid(), n);
+	else
+		sprintf(t->fileName, "%s/_tiotest_pid%d.thr%d",
+			path, (int) getpid(), n);
+}
+
+/*
+  Size of the file of thread n and, on raw devices or in the file of a
+  sweep, where its area starts: the threads of every path follow each
+  other, on raw devices -o apart
+*/
+static void place_thread( ThreadData *t, int n, int fileSizeInMBytes )
+{
+	t->fileSizeInMBytes = fileSizeInMBytes;
+	t->fileOffset = 0;
+
+	if (args.rawDrives)
+	{
+		t->fileOffset = (TIO_off_t)(n / args.pathsCount) *
+			(args.threadOffset + fileSizeInMBytes) * MBYTE;
+		if (args.useThreadOffsetForFirstThread)
+			t->fileOffset += (TIO_off_t)args.threadOffset * MBYTE;
+	}
+	else if (args.sweepThreadsCount || args.sweepBlocksCount)
+		t->fileOffset = (TIO_off_t)(n / args.pathsCount) * fileSizeInMBytes * MBYTE;
+}
+
+static void initialize_test( ThreadTest *d )
+{
+	int i, j;
+	int pathLoadBalIdx = 0;
+
+	assert(TEST_COUNT == (sizeof(Tests)/sizeof(TestFunc)));
+
+	memset( d, 0, sizeof(ThreadTest) );
+
+	d->numThreads = args.numThreads;
+
+	d->threads = tt_shared_alloc( d->numThreads * sizeof(ThreadData) );
+	if( d->threads == NULL )
+	{
+		perror("Error allocating thread data memory");
+		exit(-1);
+	}
+
+	/* Initializing thread data */
+	for(i = 0; i < d->numThreads; i++)
+	{
+		d->threads[i].myNumber = i;
+		d->threads[i].blockSize = args.blockSize;
+		d->threads[i].numRandomOps = args.numRandomOps;
+		for(j = 0; j < TEST_COUNT; j++)
+			d->threads[i].blockDist[j] = &args.blockDist[j];
+		place_thread(&d->threads[i], i, args.fileSizeInMBytes);
+		if (args.rawDrives)
+			sprintf(d->threads[i].fileName, "%s",
+				args.path[pathLoadBalIdx++]);
+		else
+			set_file_name(&d->threads[i], args.path[pathLoadBalIdx++], i);
+
+		if( pathLoadBalIdx >= args.pathsCount )
+			pathLoadBalIdx = 0;
+
+		initialize_thread( &(d->threads[i]) );
+	}
+}
+
+/*
+  Threads of a job file, ordered by stage so that the threads of
+  every stage are contiguous
+*/
+static void initialize_job_test( ThreadTest *d )
+{
+	int i, j, stage;
+	int n = 0;
+
+	memset( d, 0, sizeof(ThreadTest) );
+
+	for(i = 0; i < jobs.count; i++)
+		d->numThreads += jobs.groups[i].numThreads;
+
+	d->threads = tt_shared_alloc( d->numThreads * sizeof(ThreadData) );
+	if( d->threads == NULL )
+	{
+		perror("Error allocating thread data memory");
+		exit(-1);
+	}
+
+	for(stage = 0; stage < jobs.stagesCount; stage++)
+	{
+		for(i = 0; i < jobs.count; i++)
+		{
+			JobGroup *g = &jobs.groups[i];
+			const int random = g->testCase == RANDOM_WRITE_TEST ||
+				g->testCase == RANDOM_READ_TEST;
+
+			if (g->stage != jobs.stages[stage])
+				continue;
+
+			g->firstThread = n;
+
+			for(j = 0; j < g->numThreads; j++, n++)
+			{
+				ThreadData *t = &(d->threads[n]);
+
+				t->myNumber = n;
+				t->blockSize = g->blockSize;
+				t->numRandomOps = args.numRandomOps;
+				t->fileSizeInMBytes = g->fileSizeInMBytes;
+				t->fileOffset = 0;
+				set_file_name(t, g->path, n);
+
+				t->jobGroup = i;
+				t->jobTest = g->testCase;
+				t->blockDist[g->testCase] = &g->blockDist;
+				t->prefill = !is_write_test(g->testCase);
+				t->rateLimit = g->rateLimit;
+				t->runtime = g->runtime;
+
+				if (g->numOps)
+					t->jobOps = g->numOps;
+				else if (g->runtime)
+					t->jobOps = ULONG_MAX;
+				else if (random)
+					t->jobOps = args.numRandomOps;
+				else
+					t->jobOps = sequential_ops(t, g->testCase);
+
+				initialize_thread(t);
+			}
+		}
+	}
+}
+
+static size_t size_latency_size( const ThreadData *d, int testCase )
+{
+	return d->blockDist[testCase] ?
+		d->blockDist[testCase]->count * sizeof(Latencies) : 0;
+}
+
+static void cleanup_test( ThreadTest *d )
+{
+	int i, j;
+
+	for(i = 0; i < d->numThreads; i++)
+	{
+		if (!args.rawDrives)
+			unlink(d->threads[i].fileName);
+		tt_aligned_free( (char *)d->threads[i].buffer, d->threads[i].bufferSize );
+		d->threads[i].buffer = 0;
+
+		for(j = 0; j < TEST_COUNT; j++)
+			tt_shared_free(d->threads[i].phase[j].sizeLatency,
+				       size_latency_size(&d->threads[i], j));
+		tt_shared_free(d->threads[i].slowest, args.slowest * sizeof(SlowOp));
+		tt_shared_free(d->threads[i].slowOps, MAX_SLOW_OPS * sizeof(SlowOp));
+
+		pthread_attr_destroy( &(d->threads[i].thread_attr) );
+	}
+
+	tt_shared_free(d->threads, d->numThreads * sizeof(ThreadData));
+
+	d->threads = 0;
+}
+
+static void wait_for_thread( ThreadData *d )
+{
+	int status;
+
+	if (!args.processes)
+	{
+		pthread_join(d->thread, NULL);
+		return;
+	}
+
+	while (waitpid(d->pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			perror("Error from waitpid()");
+			exit(-1);
+		}
+	}
+
+	/* a failing thread takes the process down, so does a failing worker */
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+	{
+		fprintf(stderr, "Worker process %lu failed\n", d->myNumber);
+		exit(WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	}
+}
+
+static void wait_for_threads( ThreadTest *d )
+{
+	int i;
+
+	for(i = 0; i < d->numThreads; i++)
+		wait_for_thread(&d->threads[i]);
+}
+
+static void* start_proc( void *data )
+{
+	StartData *sd = (StartData*)data;
+	*sd->child_status = getpid();
+	if (sd->pstart != NULL)
+		while (*sd->pstart == 0) sleep(0);
+	sd->fn(sd->d);
+	return NULL;
+}
+
+/*
+  Starts a thread, or with --processes a worker process with its own
+  address space and file table. Its results go to the shared memory
+  of d, its status and start flag are shared as well.
+*/
+static int start_thread( ThreadData *d, StartData *sd )
+{
+	pid_t pid;
+
+	if (!args.processes)
+		return pthread_create(&d->thread, &d->thread_attr, start_proc, sd);
+
+	/* or buffered output would be printed once more by every worker */
+	fflush(NULL);
+
+	/* d is shared, the worker must not store its 0 there */
+	pid = fork();
+	if (pid < 0)
+		return -1;
+
+	if (pid == 0)
+	{
+		start_proc(sd);
+		fflush(NULL);
+		_exit(0);
+	}
+
+	d->pid = pid;
+	return 0;
+}
+
+/*
+  Runs fn on every thread of the test. Unless sequential, the threads
+  are held until all of them have started, and t measures the time
+  from their release until the last one has finished.
+*/
+static void run_test_threads( ThreadTest *test, TestFunc fn, int sequential,
+			      struct tt_rusage *t )
+{
+	int i;
+	volatile int *child_status;
+	volatile int *start;
+	StartData *sd;
+	int synccount;
+
+	/* the start flag follows the status of the threads */
+	child_status = (volatile int *)tt_shared_alloc((test->numThreads + 1) * sizeof(int));
+	if (child_status == NULL)
+	{
+		perror("Error allocating thread status memory");
+		return;
+	}
+	start = &child_status[test->numThreads];
+
+	sd = (StartData*)calloc(test->numThreads, sizeof(StartData));
+	if (sd == NULL)
+	{
+		perror("Error calloc()ing thread start data memory");
+		tt_shared_free((int*)child_status, (test->numThreads + 1) * sizeof(int));
+		return;
+	}
+
+	if (sequential)
+		timer_start(t);
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		sd[i].child_status = &child_status[i];
+		sd[i].fn = fn;
+		sd[i].d = &test->threads[i];
+		if (sequential)
+			sd[i].pstart = NULL;
+		else
+			sd[i].pstart = start;
+		if( start_thread(&test->threads[i], &sd[i]))
+		{
+			perror(args.processes ? "Error from fork()" : "Error from pthread_create()");
+			tt_shared_free((int*)child_status, (test->numThreads + 1) * sizeof(int));
+			free(sd);
+			exit(-1);
+		}
+
+		if(sequential)
+		{
+			t_log(LEVEL_INFO,"Waiting previous thread to finish before starting a new one");
+			wait_for_thread(&test->threads[i]);
+		}
+	}
+
+	if(sequential)
+		timer_stop(t);
+	else
+	{
+		struct timeval tv1, tv2;
+		gettimeofday(&tv1, NULL);
+		do
+		{
+			synccount = 0;
+			for(i = 0; i < test->numThreads; i++)
+				if (child_status[i])
+					synccount++;
+			if (synccount == test->numThreads)
+				break;
+			sleep(1);
+			gettimeofday(&tv2, NULL);
+		} while ((tv2.tv_sec - tv1.tv_sec) < 30);
+
+		if (synccount != test->numThreads)
+		{
+			fprintf(stderr, "Unable to start %d threads (started %d)\n", 
+					test->numThreads, synccount);
+			*start = 1;
+			wait_for_threads(test);
+			tt_shared_free((int*)child_status, (test->numThreads + 1) * sizeof(int));
+			free(sd);
+			return;
+		}
+
+		t_log(LEVEL_INFO, "Created threads");
+
+		timer_start(t);
+
+		*start = 1;
+
+		t_log(LEVEL_INFO, "Waiting threads");
+
+		wait_for_threads(test);
+
+		timer_stop(t);
+	}
+	tt_shared_free((int*)child_status, (test->numThreads + 1) * sizeof(int));
+
+	free(sd);
+
+	t_log(LEVEL_INFO, "Done!");
+}
+
+static int read_disk_sample(const char *file, DiskSample *s)
+{
+	FILE *f = fopen(file, "r");
+	int n;
+
+	if (f == NULL)
+		return -1;
+
+	n = fscanf(f, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &s->readIos, &s->readMerges, &s->readSectors, &s->readTicks,
+		   &s->writeIos, &s->writeMerges, &s->writeSectors, &s->writeTicks,
+		   &s->inFlight, &s->ioTicks, &s->timeInQueue);
+	fclose(f);
+
+	return n == 11 ? 0 : -1;
+}
+
+static void diff_disk_sample(DiskSample *d, const DiskSample *end,
+			     const DiskSample *start)
+{
+	d->readIos      = end->readIos - start->readIos;
+	d->readMerges   = end->readMerges - start->readMerges;
+	d->readSectors  = end->readSectors - start->readSectors;
+	d->readTicks    = end->readTicks - start->readTicks;
+	d->writeIos     = end->writeIos - start->writeIos;
+	d->writeMerges  = end->writeMerges - start->writeMerges;
+	d->writeSectors = end->writeSectors - start->writeSectors;
+	d->writeTicks   = end->writeTicks - start->writeTicks;
+	d->inFlight     = end->inFlight;
+	d->ioTicks      = end->ioTicks - start->ioTicks;
+	d->timeInQueue  = end->timeInQueue - start->timeInQueue;
+}
+
+/* what iostat -x shows for the difference of two samples secs apart */
+typedef struct {
+	double iops, mbytes, util, queue, await, merged;
+} DiskRates;
+
+static void disk_rates(const DiskSample *d, double secs, DiskRates *r)
+{
+	const double ios = d->readIos + d->writeIos;
+	const double merges = d->readMerges + d->writeMerges;
+
+	memset(r, 0, sizeof(DiskRates));
+	if (secs <= 0)
+		return;
+
+	r->iops   = ios / secs;
+	r->mbytes = (double)(d->readSectors + d->writeSectors) *
+		DISK_SECTOR_SIZE / MBYTE / secs;
+	r->util   = MIN(100.0, d->ioTicks / (secs * 10));
+	r->queue  = d->timeInQueue / (secs * 1000);
+	r->await  = ios ? (d->readTicks + d->writeTicks) / ios : 0;
+	r->merged = ios + merges ? 100 * merges / (ios + merges) : 0;
+}
+
+/*
+  Finds the block device of every -d path from st_dev (st_rdev for raw
+  devices). Paths on file systems without one, like tmpfs, are skipped.
+*/
+static void find_disks( void )
+{
+	int i, j;
+
+	for(i = 0; i < args.pathsCount; i++)
+	{
+		char link[KBYTE], target[KBYTE];
+		struct stat st;
+		Disk *disk = &diskStats.disks[diskStats.count];
+		dev_t dev;
+		ssize_t n;
+
+		if (stat(args.path[i], &st) < 0)
+		{
+			perror("Error stat()ing path");
+			continue;
+		}
+		dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+		for(j = 0; j < diskStats.count; j++)
+			if (diskStats.disks[j].dev == dev)
+				break;
+		if (j < diskStats.count)
+			continue;
+
+		sprintf(link, "/sys/dev/block/%u:%u", major(dev), minor(dev));
+		sprintf(disk->statFile, "%s/stat", link);
+		if (read_disk_sample(disk->statFile, &disk->start) < 0)
+		{
+			fprintf(stderr, "No block device statistics for %s\n",
+				args.path[i]);
+			continue;
+		}
+
+		n = readlink(link, target, sizeof(target) - 1);
+		if (n > 0)
+		{
+			const char *base;
+
+			target[n] = '\0';
+			base = strrchr(target, '/');
+			snprintf(disk->name, sizeof(disk->name), "%.*s",
+				 (int)sizeof(disk->name) - 1, base ? base + 1 : target);
+		}
+		else
+			sprintf(disk->name, "%u:%u", major(dev), minor(dev));
+
+		disk->dev = dev;
+		diskStats.count++;
+	}
+}
+
+static void* disk_sampler( void *data )
+{
+	const int ticks = args.diskStatsInterval * 10;
+	int i, tick = 0;
+
+	while (!diskStats.stop)
+	{
+		struct timeval now;
+		double secs;
+
+		usleep(100000);
+		if (++tick < ticks)
+			continue;
+		tick = 0;
+
+		gettimeofday(&now, NULL);
+		secs = (now.tv_sec - diskStats.last.tv_sec) +
+			(now.tv_usec - diskStats.last.tv_usec) / 1000000.0;
+		diskStats.last = now;
+
+		for(i = 0; i < diskStats.count; i++)
+		{
+			Disk *disk = &diskStats.disks[i];
+			DiskSample sample, delta;
+			DiskRates r;
+
+			if (read_disk_sample(disk->statFile, &sample) < 0)
+				continue;
+			diff_disk_sample(&delta, &sample, &disk->last);
+			disk->last = sample;
+			disk_rates(&delta, secs, &r);
+
+			if (args.terse)
+				printf("diskstat:%s,%s,%.3f,%.1f,%.3f,%.1f,%.2f,%.3f\n",
+				       testNames[diskStats.phase], disk->name,
+				       (now.tv_sec - diskStats.start.tv_sec) +
+				       (now.tv_usec - diskStats.start.tv_usec) / 1000000.0,
+				       r.iops, r.mbytes, r.util, r.queue, r.await);
+			else
+				printf("%-12s %-10s %9.1f IOPS %9.3f MB/s %5.1f %% util %7.2f queue %9.3f ms await\n",
+				       testTitles[diskStats.phase], disk->name,
+				       r.iops, r.mbytes, r.util, r.queue, r.await);
+		}
+		fflush(stdout);
+	}
+
+	return NULL;
+}
+
+/* pgpgin and pgpgout of /proc/vmstat, which count KBytes */
+static void read_vmstat(unsigned long long *in, unsigned long long *out)
+{
+	FILE *f = fopen(VMSTAT_FILE, "r");
+	char name[64];
+	unsigned long long value;
+
+	*in = *out = 0;
+	if (f == NULL)
+		return;
+
+	while (fscanf(f, "%63s %llu", name, &value) == 2)
+	{
+		if (!strcmp(name, "pgpgin"))
+			*in = value * KBYTE;
+		else if (!strcmp(name, "pgpgout"))
+			*out = value * KBYTE;
+	}
+	fclose(f);
+}
+
+/*
+  Share of the thread files in the page cache, by mincore() on a
+  mapping of every file. Files not created yet count as not resident.
+*/
+static double test_residency( ThreadTest *test )
+{
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	unsigned long long pages = 0, resident = 0;
+	unsigned char *vec = malloc(MMAP_CHUNK_SIZE / pageSize);
+	int i;
+
+	if (vec == NULL)
+		return 0;
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		ThreadData *d = &test->threads[i];
+		TIO_off_t bytes = d->fileSizeInMBytes * MBYTE;
+		TIO_off_t done;
+		int fd = open(d->fileName, O_RDONLY);
+
+		pages += (bytes + pageSize - 1) / pageSize;
+		if (fd < 0)
+			continue;
+
+		if (!args.rawDrives)
+		{
+			struct stat st;
+
+			if (fstat(fd, &st) == 0)
+				bytes = MIN(bytes, MAX(st.st_size - d->fileOffset, 0));
+		}
+
+		for(done = 0; done < bytes; done += MMAP_CHUNK_SIZE)
+		{
+			const size_t length = MIN(MMAP_CHUNK_SIZE, bytes - done);
+			const size_t count = (length + pageSize - 1) / pageSize;
+			void *loc = TIO_mmap(NULL, length, PROT_READ, MAP_SHARED,
+					     fd, d->fileOffset + done);
+			size_t j;
+
+			if (loc == MAP_FAILED)
+				break;
+			if (mincore(loc, length, vec) == 0)
+				for(j = 0; j < count; j++)
+					resident += vec[j] & 1;
+			munmap(loc, length);
+		}
+		close(fd);
+	}
+
+	free(vec);
+	return pages ? (double)resident / pages : 0;
+}
+
+/*
+  Writes back and drops the pages of the test files only, the per file
+  -F that leaves the rest of the page cache alone
+*/
+static void evict_test_files( ThreadTest *test )
+{
+	int i;
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		const ThreadData *d = &test->threads[i];
+		int fd = open(d->fileName, O_RDONLY);
+
+		if (fd < 0)
+			continue;
+
+		fdatasync(fd);
+		posix_fadvise(fd, d->fileOffset,
+			      (TIO_off_t)d->fileSizeInMBytes * MBYTE, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+static int cache_control_used( void )
+{
+	int i;
+
+	for(i = 0; i < TEST_COUNT; i++)
+		if (args.fadvise[i] >= 0 || args.readahead[i])
+			return TRUE;
+
+	return args.evict;
+}
+
+/* a field of /proc/meminfo in bytes, 0 if missing */
+static unsigned long long read_meminfo(const char *field)
+{
+	FILE *f = fopen(MEMINFO_FILE, "r");
+	char name[64];
+	unsigned long long value, bytes = 0;
+
+	if (f == NULL)
+		return 0;
+
+	while (fscanf(f, "%63s %llu kB", name, &value) == 2)
+		if (!strcmp(name, field))
+		{
+			bytes = value * KBYTE;
+			break;
+		}
+	fclose(f);
+	return bytes;
+}
+
+static int cgroup_file_exists(const char *dir, const char *file)
+{
+	char path[2*KBYTE];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	return access(path, F_OK) == 0;
+}
+
+static int write_cgroup_file(const char *dir, const char *file, const char *value)
+{
+	char path[2*KBYTE];
+	int fd, length = strlen(value);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, value, length) != length)
+	{
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+/*
+  Moves the process into a new memory cgroup below its own, of cgroup v2
+  when mounted at CGROUP_ROOT, else of the v1 memory controller. The
+  page cache of the files it reads and writes from then on is charged
+  to the cgroup and reclaimed at the limit.
+*/
+static void limit_memory(unsigned long long limit)
+{
+	FILE *f = fopen(CGROUP_FILE, "r");
+	char line[KBYTE], path[KBYTE] = "", parent[KBYTE], value[64];
+	int v2 = access(CGROUP_ROOT "/cgroup.controllers", F_OK) == 0;
+	const char *limitFile = v2 ? "memory.max" : "memory.limit_in_bytes";
+
+	while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+	{
+		char *controllers = strchr(line, ':');
+		char *cgroup = controllers ? strchr(controllers + 1, ':') : NULL;
+
+		if (cgroup == NULL)
+			continue;
+		*cgroup++ = 0;
+		cgroup[strcspn(cgroup, "\n")] = 0;
+
+		/* "0::path" for v2, "n:...,memory,...:path" for v1 */
+		if (v2 ? !strcmp(line, "0") && controllers[1] == 0 :
+		    strstr(controllers + 1, "memory") != NULL)
+			snprintf(path, sizeof(path), "%s", cgroup);
+	}
+	if (f != NULL)
+		fclose(f);
+
+	if (!path[0])
+	{
+		fprintf(stderr, "--mem-limit: no memory cgroup in %s\n", CGROUP_FILE);
+		exit(1);
+	}
+
+	if (snprintf(parent, sizeof(parent), "%s%s", v2 ? CGROUP_ROOT : CGROUP_MEMORY_ROOT,
+		     strcmp(path, "/") ? path : "") >= sizeof(parent))
+	{
+		fprintf(stderr, "--mem-limit: cgroup path %s too long\n", path);
+		exit(1);
+	}
+	strcpy(memoryPressure.parent, parent);
+	sprintf(memoryPressure.cgroup, "%s/tiotest.%d", parent, (int)getpid());
+
+	if (mkdir(memoryPressure.cgroup, 0755) < 0)
+	{
+		fprintf(stderr, "--mem-limit: %s: %s (needs root or a delegated cgroup)\n",
+			memoryPressure.cgroup, strerror(errno));
+		memoryPressure.cgroup[0] = 0;
+		exit(1);
+	}
+
+	sprintf(value, "%d", (int)getpid());
+
+	/*
+	  v2 only has the memory files if the parent hands the controller
+	  down, which it cannot while it holds processes: move out first
+	*/
+	if (v2 && !cgroup_file_exists(memoryPressure.cgroup, limitFile))
+	{
+		if (write_cgroup_file(memoryPressure.cgroup, "cgroup.procs", value) < 0)
+		{
+			fprintf(stderr, "--mem-limit: %s/cgroup.procs: %s\n",
+				memoryPressure.cgroup, strerror(errno));
+			exit(1);
+		}
+
+		if (write_cgroup_file(parent, "cgroup.subtree_control", "+memory") < 0)
+		{
+			fprintf(stderr, "--mem-limit: enabling the memory controller below %s: %s%s\n",
+				parent, strerror(errno),
+				errno == EBUSY ? " (other processes share the cgroup, start tiotest in one of its own)" : "");
+			exit(1);
+		}
+		memoryPressure.enabledMemory = TRUE;
+	}
+
+	sprintf(value, "%llu", limit);
+	if (write_cgroup_file(memoryPressure.cgroup, limitFile, value) < 0)
+	{
+		fprintf(stderr, "--mem-limit: %s/%s: %s\n", memoryPressure.cgroup,
+			limitFile, strerror(errno));
+		exit(1);
+	}
+
+	sprintf(value, "%d", (int)getpid());
+	if (write_cgroup_file(memoryPressure.cgroup, "cgroup.procs", value) < 0)
+	{
+		fprintf(stderr, "--mem-limit: %s/cgroup.procs: %s\n",
+			memoryPressure.cgroup, strerror(errno));
+		exit(1);
+	}
+}
+
+/*
+  Locks bytes of anonymous memory, which the page cache then cannot
+  use. Needs that much RLIMIT_MEMLOCK, which root can raise.
+*/
+static void pin_memory(unsigned long long bytes)
+{
+	struct rlimit limit;
+	void *p;
+
+	if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+	    limit.rlim_cur < bytes)
+	{
+		limit.rlim_cur = bytes;
+		if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < bytes)
+			limit.rlim_max = bytes;
+		setrlimit(RLIMIT_MEMLOCK, &limit);
+	}
+
+	p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		fprintf(stderr, "--mlock: mapping %llu MBytes: %s\n",
+			bytes / MBYTE, strerror(errno));
+		exit(1);
+	}
+
+	/* --processes workers need not copy the page tables */
+	madvise(p, bytes, MADV_DONTFORK);
+
+	if (mlock(p, bytes) < 0)
+	{
+		fprintf(stderr, "--mlock: locking %llu MBytes: %s (raise ulimit -l or run as root)\n",
+			bytes / MBYTE, strerror(errno));
+		exit(1);
+	}
+
+	memoryPressure.pinned = p;
+	memoryPressure.pinnedBytes = bytes;
+}
+
+/*
+  at exit: back to the parent cgroup so that the test one can go, which
+  on v2 first takes back the memory controller if it was handed down
+*/
+static void release_memory_pressure( void )
+{
+	char pid[32];
+
+	/* forked workers exit through here too */
+	if (getpid() != memoryPressure.owner || !memoryPressure.cgroup[0])
+		return;
+
+	if (memoryPressure.enabledMemory &&
+	    write_cgroup_file(memoryPressure.parent, "cgroup.subtree_control", "-memory") < 0)
+		fprintf(stderr, "Could not disable the memory controller below %s: %s\n",
+			memoryPressure.parent, strerror(errno));
+
+	sprintf(pid, "%d", (int)getpid());
+	if (write_cgroup_file(memoryPressure.parent, "cgroup.procs", pid) < 0 ||
+	    rmdir(memoryPressure.cgroup) < 0)
+		fprintf(stderr, "Could not remove cgroup %s: %s\n",
+			memoryPressure.cgroup, strerror(errno));
+}
+
+/*
+  Shrinks the page cache for the tests, instead of files of twice the
+  memory or booting with mem=. The memory is locked before moving into
+  the cgroup so that it is not charged against the limit.
+*/
+static void apply_memory_pressure( void )
+{
+	unsigned long long bytes = args.mlockBytes;
+
+	memoryPressure.owner = getpid();
+	atexit(release_memory_pressure);
+
+	if (args.pageCache)
+	{
+		const unsigned long long available = read_meminfo("MemAvailable:");
+
+		bytes = available > args.pageCache ? available - args.pageCache : 0;
+	}
+
+	if (bytes)
+		pin_memory(bytes);
+
+	if (args.memLimit)
+		limit_memory(args.memLimit);
+
+	if (args.terse)
+	{
+		printf("memory:%llu,%llu,%llu\n", args.memLimit / MBYTE,
+		       memoryPressure.pinnedBytes / MBYTE,
+		       read_meminfo("MemAvailable:") / MBYTE);
+		return;
+	}
+
+	if (args.memLimit)
+		printf("Memory limited to %llu MBytes by cgroup %s\n",
+		       args.memLimit / MBYTE, memoryPressure.cgroup);
+	if (args.mlockBytes || args.pageCache)
+		printf("Locked %llu MBytes of memory, %llu MBytes left available\n",
+		       memoryPressure.pinnedBytes / MBYTE,
+		       read_meminfo("MemAvailable:") / MBYTE);
+}
+
+static void disk_phase_start( ThreadTest *test, int testCase )
+{
+	int i;
+
+	for(i = 0; i < diskStats.count; i++)
+	{
+		Disk *disk = &diskStats.disks[i];
+
+		read_disk_sample(disk->statFile, &disk->start);
+		disk->last = disk->start;
+	}
+
+	if (args.amplification)
+	{
+		diskStats.residentBefore[testCase] = test_residency(test);
+		read_vmstat(&diskStats.pagedIn, &diskStats.pagedOut);
+	}
+
+	diskStats.phase = testCase;
+	gettimeofday(&diskStats.start, NULL);
+	diskStats.last = diskStats.start;
+
+	diskStats.stop = FALSE;
+	if (args.diskStatsInterval && diskStats.count &&
+	    pthread_create(&diskStats.sampler, NULL, disk_sampler, NULL))
+	{
+		perror("Error creating device sampler thread");
+		exit(-1);
+	}
+}
+
+static void disk_phase_stop( ThreadTest *test, int testCase )
+{
+	struct timeval now;
+	int i;
+
+	if (args.diskStatsInterval && diskStats.count)
+	{
+		diskStats.stop = TRUE;
+		pthread_join(diskStats.sampler, NULL);
+	}
+
+	gettimeofday(&now, NULL);
+
+	for(i = 0; i < diskStats.count; i++)
+	{
+		Disk *disk = &diskStats.disks[i];
+		DiskSample end;
+
+		if (read_disk_sample(disk->statFile, &end) < 0)
+			continue;
+		diff_disk_sample(&disk->delta[testCase], &end, &disk->start);
+		disk->secs[testCase] = (now.tv_sec - diskStats.start.tv_sec) +
+			(now.tv_usec - diskStats.start.tv_usec) / 1000000.0;
+	}
+
+	if (args.amplification)
+	{
+		unsigned long long in, out;
+
+		read_vmstat(&in, &out);
+		diskStats.vmstatIn[testCase] = in - diskStats.pagedIn;
+		diskStats.vmstatOut[testCase] = out - diskStats.pagedOut;
+		diskStats.residentAfter[testCase] = test_residency(test);
+	}
+}
+
+/* a line of the agent protocol without its newline, NULL at the end */
+static char *read_protocol_line( FILE *in, char **line, size_t *size )
+{
+	ssize_t length = getline(line, size, in);
+
+	if (length < 0)
+		return NULL;
+	if (length > 0 && (*line)[length - 1] == '\n')
+		(*line)[length - 1] = 0;
+	return *line;
+}
+
+/* holds an --agent worker until the controller starts the phase */
+static void agent_ready( int testCase )
+{
+	char *line = NULL;
+	size_t size = 0;
+
+	fprintf(agentLink.out, "ready %s\n", testNames[testCase]);
+	fflush(agentLink.out);
+
+	if (read_protocol_line(agentLink.in, &line, &size) == NULL ||
+	    strcmp(line, "go"))
+	{
+		fprintf(stderr, "Lost the controller before %s\n", testNames[testCase]);
+		exit(1);
+	}
+	free(line);
+}
+
+static void do_test( ThreadTest *test, int testCase, int sequential,
+					 struct tt_rusage *t, char *debugMessage )
+{
+	int i;
+
+	assert(testCase < TEST_COUNT);
+
+	/* stonewalling makes no sense when threads run one by one */
+	memset(stonewall, 0, sizeof(Stonewall));
+	stonewall->armed = args.stonewall && !sequential;
+
+	ramp->active = args.rampOps || args.rampSecs;
+	ramp->sync = ramp->active && !sequential;
+	for(i = 0; i < test->numThreads; i++)
+	{
+		timerclear(&test->threads[i].rampUserTime);
+		timerclear(&test->threads[i].rampSysTime);
+	}
+	if (ramp->sync)
+	{
+		pthread_barrierattr_t attr;
+
+		pthread_barrierattr_init(&attr);
+		if (args.processes)
+			pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_barrier_init(&ramp->barrier, &attr, test->numThreads);
+		pthread_barrierattr_destroy(&attr);
+	}
+
+	if (args.evict)
+		evict_test_files(test);
+
+	if (cache_control_used())
+		residentStart[testCase] = test_residency(test);
+
+	if (agentLink.out)
+		agent_ready(testCase);
+
+	if (args.diskStats)
+		disk_phase_start(test, testCase);
+
+	run_test_threads(test, Tests[testCase], sequential, t);
+
+	if (args.diskStats)
+		disk_phase_stop(test, testCase);
+
+	if (cache_control_used())
+		residentEnd[testCase] = test_residency(test);
+
+	if (ramp->sync)
+	{
+		pthread_barrier_destroy(&ramp->barrier);
+		t->startRealTime = ramp->measureStart;
+	}
+
+	/* the phase clock started before the ramps, so did its CPU times */
+	for(i = 0; i < test->numThreads; i++)
+	{
+		timeradd(&t->startUserTime, &test->threads[i].rampUserTime, &t->startUserTime);
+		timeradd(&t->startSysTime, &test->threads[i].rampSysTime, &t->startSysTime);
+	}
+	ramp->active = ramp->sync = FALSE;
+
+	if (stonewall->armed && stonewall->hit)
+	{
+		test->stonewallTime[testCase] = stonewall->time;
+		test->stonewalled[testCase] = TRUE;
+	}
+}
+
+/*
+  A job group or stage summed over its threads. The time is the span
+  from the first of the threads starting to the last one finishing.
+*/
+typedef struct {
+	double           mbytes;
+	double           ops;
+	double           secs;
+	Latencies        latency;
+} JobTotals;
+
+static void sum_job_threads( const ThreadTest *d, int first, int count,
+			     JobTotals *t )
+{
+	unsigned long long start = 0, stop = 0;
+	int i;
+
+	memset(t, 0, sizeof(JobTotals));
+
+	for(i = first; i < first + count; i++)
+	{
+		const PhaseStats *stats = &d->threads[i].phase[d->threads[i].jobTest];
+		const unsigned long long threadStart = tv_to_usec(&stats->timings.startRealTime);
+		const unsigned long long threadStop = tv_to_usec(&stats->timings.stopRealTime);
+
+		t->mbytes += (double)stats->bytes / MBYTE;
+		t->ops += stats->blocks;
+		merge_latencies(&t->latency, &stats->latency);
+
+		if (i == first || threadStart < start)
+			start = threadStart;
+		if (threadStop > stop)
+			stop = threadStop;
+	}
+
+	t->secs = stop > start ? (stop - start) / 1000000.0 : 0;
+}
+
+/*
+  Job groups: every thread does the pattern of its group, the
+  threads of one stage all run at once
+*/
+static void do_job_thread( ThreadData *d )
+{
+	const int random = d->jobTest == RANDOM_WRITE_TEST ||
+		d->jobTest == RANDOM_READ_TEST;
+	const int write = is_write_test(d->jobTest);
+
+	do_generic_test(write ? do_pwrite_operation : do_pread_operation,
+			write ? do_mmap_write_operation : do_mmap_read_operation,
+			random ? get_random_offset : get_sequential_offset,
+			random ? get_random_loc : get_sequential_loc,
+			d, random ? MADV_RANDOM : MADV_SEQUENTIAL,
+			d->jobOps, d->jobTest);
+}
+
+static void do_job_test( ThreadTest *test )
+{
+	int stage, i;
+
+	for(stage = 0; stage < jobs.stagesCount; stage++)
+	{
+		ThreadTest view;
+
+		memset(&view, 0, sizeof(ThreadTest));
+
+		for(i = 0; i < jobs.count; i++)
+		{
+			const JobGroup *g = &jobs.groups[i];
+
+			if (g->stage != jobs.stages[stage])
+				continue;
+
+			if (view.threads == NULL)
+				view.threads = &test->threads[g->firstThread];
+			view.numThreads += g->numThreads;
+		}
+
+		t_log(LEVEL_INFO, "Running job stage");
+		run_test_threads(&view, do_job_thread, FALSE,
+				 &jobs.stageTimings[stage]);
+	}
+}
+
+/*
+  Saturation finder: the threads doubling every step, each step
+  running the pattern for a fixed time on files kept from the step
+  before. Stops once throughput stops growing, the 99% latency passes
+  its bound or all threads are in use.
+*/
+static void do_prefill_thread( ThreadData *d )
+{
+	const TIO_off_t blocks = ((TIO_off_t)d->fileSizeInMBytes*MBYTE)/d->blockSize;
+	int fd;
+
+	fd = open(d->fileName, O_RDWR | (args.rawDrives ? 0 : O_CREAT), 0600);
+	if (fd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), d->fileName);
+		return;
+	}
+
+	prefill_file(fd, blocks * d->blockSize, d);
+	close(fd);
+}
+
+static void reset_phase( ThreadData *d, int testCase )
+{
+	PhaseStats *stats = &d->phase[testCase];
+	Latencies *sizeLatency = stats->sizeLatency;
+
+	/* --processes workers need it allocated before they start */
+	if (args.processes && sizeLatency)
+		memset(sizeLatency, 0, size_latency_size(d, testCase));
+	else
+	{
+		free(sizeLatency);
+		sizeLatency = NULL;
+	}
+
+	memset(stats, 0, sizeof(PhaseStats));
+	stats->sizeLatency = sizeLatency;
+}
+
+static double step_iops( const KneeStep *step )
+{
+	return step->secs > 0 ? step->ops / step->secs : 0;
+}
+
+static double round_iops( const SteadyRound *r )
+{
+	return r->secs > 0 ? r->ops / r->secs : 0;
+}
+
+/*
+  The SNIA PTS steady state test on the window of rounds ending with
+  round: the range of IOPS within band and the excursion of their
+  least squares line within slope, both in percent of the average.
+*/
+static int steady_window( int round )
+{
+	SteadyRound *r = &steady.rounds[round];
+	const int n = args.steadyWindow;
+	const int first = round - n + 1;
+	double sum = 0, min = HUGE_VAL, max = 0, sxy = 0, sxx = 0, slope;
+	int i;
+
+	if (first < 0)
+		return FALSE;
+
+	for(i = 0; i < n; i++)
+	{
+		const double iops = round_iops(&steady.rounds[first + i]);
+
+		sum += iops;
+		min = MIN(min, iops);
+		max = MAX(max, iops);
+	}
+	r->windowAvg = sum / n;
+
+	for(i = 0; i < n; i++)
+	{
+		const double x = i - (n - 1) / 2.0;
+
+		sxy += x * (round_iops(&steady.rounds[first + i]) - r->windowAvg);
+		sxx += x * x;
+	}
+	slope = sxy / sxx;
+
+	if (r->windowAvg <= 0)
+		return FALSE;
+
+	r->range = 100 * (max - min) / r->windowAvg;
+	r->excursion = 100 * fabs(slope) * (n - 1) / r->windowAvg;
+
+	return r->range <= args.steadyBand && r->excursion <= args.steadySlope;
+}
+
+/*
+  Preconditions the files like the SNIA PTS: a sequential fill, then
+  rounds of random writes on every thread until the IOPS of the last
+  rounds are steady or the rounds run out.
+*/
+static void do_steady_state_test( ThreadTest *test )
+{
+	struct tt_rusage t;
+	int i;
+
+	steady.reached = -1;
+
+	run_test_threads(test, do_prefill_thread, FALSE, &t);
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		ThreadData *d = &test->threads[i];
+
+		d->jobTest = RANDOM_WRITE_TEST;
+		d->jobOps = ULONG_MAX;
+		d->runtime = args.steadyTime;
+	}
+
+	while (steady.count < args.steadyRounds)
+	{
+		SteadyRound *r = &steady.rounds[steady.count];
+		JobTotals totals;
+
+		for(i = 0; i < test->numThreads; i++)
+			reset_phase(&test->threads[i], RANDOM_WRITE_TEST);
+
+		run_test_threads(test, do_job_thread, FALSE, &t);
+		sum_job_threads(test, 0, test->numThreads, &totals);
+
+		r->mbytes = totals.mbytes;
+		r->ops = totals.ops;
+		r->secs = totals.secs;
+		r->p99 = latency_percentile(&totals.latency, 99);
+
+		if (args.terse)
+			printf("steady_round:%d,%.5f,%.5f,%.5f\n", steady.count + 1,
+			       round_iops(r), r->secs > 0 ? r->mbytes / r->secs : 0,
+			       r->p99 * 1000);
+		else
+			printf("Steady state round %d: %.1f IOPS\n", steady.count + 1,
+			       round_iops(r));
+		fflush(stdout);
+
+		if (steady_window(steady.count++))
+		{
+			steady.reached = steady.count - 1;
+			break;
+		}
+	}
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		ThreadData *d = &test->threads[i];
+
+		d->runtime = 0;
+		reset_phase(d, RANDOM_WRITE_TEST);
+	}
+}
+
+static void do_knee_test( ThreadTest *test )
+{
+	int threads = 1, prepared = 0, i;
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		ThreadData *d = &test->threads[i];
+
+		d->jobTest = args.kneeTest;
+		d->jobOps = ULONG_MAX;
+		d->runtime = args.kneeStepTime;
+	}
+
+	while (knee.count < KNEE_MAX_STEPS)
+	{
+		KneeStep *step = &knee.steps[knee.count];
+		ThreadTest view;
+		struct tt_rusage t;
+		JobTotals totals;
+
+		if (threads > test->numThreads)
+			threads = test->numThreads;
+
+		memset(&view, 0, sizeof(ThreadTest));
+
+		/* threads new to this step get their files filled first */
+		if (threads > prepared && !is_write_test(args.kneeTest))
+		{
+			view.threads = &test->threads[prepared];
+			view.numThreads = threads - prepared;
+			run_test_threads(&view, do_prefill_thread, FALSE, &t);
+		}
+		prepared = threads;
+
+		for(i = 0; i < threads; i++)
+			reset_phase(&test->threads[i], args.kneeTest);
+
+		view.threads = test->threads;
+		view.numThreads = threads;
+		run_test_threads(&view, do_job_thread, FALSE, &t);
+
+		sum_job_threads(test, 0, threads, &totals);
+
+		step->threads = threads;
+		step->mbytes = totals.mbytes;
+		step->ops = totals.ops;
+		step->secs = totals.secs;
+		step->avg = totals.latency.count ? totals.latency.avg / totals.latency.count : 0;
+		step->p99 = latency_percentile(&totals.latency, 99);
+		step->max = totals.latency.max;
+		knee.count++;
+
+		if (args.kneeP99 > 0 && step->p99 * 1000 > args.kneeP99)
+		{
+			knee.knee = knee.count > 1 ? knee.count - 2 : 0;
+			knee.reason = "99% latency above bound";
+			break;
+		}
+
+		if (knee.count > 1 &&
+		    step_iops(step) < step_iops(step - 1) * (1 + args.kneeGain / 100))
+		{
+			knee.knee = knee.count - 2;
+			knee.reason = "throughput gain below minimum";
+			break;
+		}
+
+		if (threads == test->numThreads)
+		{
+			knee.knee = knee.count - 1;
+			knee.reason = "thread limit reached";
+			break;
+		}
+
+		threads *= 2;
+	}
+}
+
+/*
+  Atomic replace phase: the way config stores and package managers
+  update a file. Each operation writes a temporary file, fsync()s it,
+  rename()s it over the target and fsync()s the directory.
+*/
+
+static void replace_file_name(char *name, const ThreadData *d, int file, int temp)
+{
+	sprintf(name, "%s.replace%d%s", d->fileName, file, temp ? ".tmp" : "");
+}
+
+/* records the time since *tv_start and starts the next step from now */
+static void timed_step(Latencies *lat, struct timeval *tv_start)
+{
+	struct timeval tv_stop;
+
+	gettimeofday(&tv_stop, NULL);
+	update_latency_info(lat, *tv_start, tv_stop);
+	*tv_start = tv_stop;
+}
+
+static void do_replace_thread( ThreadData *d )
+{
+	char dirName[KBYTE], target[KBYTE + 32], temp[KBYTE + 32];
+	char *slash;
+	unsigned int seed = get_random_seed() + d->myNumber;
+	int dirfd;
+	unsigned long op;
+
+	strcpy(dirName, d->fileName);
+	slash = strrchr(dirName, '/');
+	if (slash)
+		*slash = '\0';
+	else
+		strcpy(dirName, ".");
+
+	dirfd = open(dirName, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), dirName);
+		return;
+	}
+
+	timer_start(&d->replaceTimings);
+
+	for(op = 0; op < args.replaceOps; op++)
+	{
+		const int file = get_random_number(args.replaceFiles, &seed);
+		struct timeval tv_begin, tv_step;
+		int fd, left;
+
+		replace_file_name(target, d, file, FALSE);
+		replace_file_name(temp, d, file, TRUE);
+
+		gettimeofday(&tv_begin, NULL);
+		tv_step = tv_begin;
+
+		fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd == -1)
+		{
+			fprintf(stderr, "%s: %s\n", strerror(errno), temp);
+			break;
+		}
+
+		for(left = args.replaceSize; left > 0; left -= d->blockSize)
+		{
+			const size_t len = MIN(left, d->blockSize);
+
+			if (write(fd, d->buffer, len) != len)
+			{
+				perror("Error writing temporary file");
+				close(fd);
+				goto out;
+			}
+		}
+		timed_step(&d->replaceStepLatency[REPLACE_WRITE], &tv_step);
+
+		if (fsync(fd))
+		{
+			perror("Error fsync()ing temporary file");
+			close(fd);
+			break;
+		}
+		timed_step(&d->replaceStepLatency[REPLACE_FSYNC], &tv_step);
+
+		close(fd);
+
+		if (rename(temp, target))
+		{
+			fprintf(stderr, "%s: rename %s\n", strerror(errno), temp);
+			break;
+		}
+		timed_step(&d->replaceStepLatency[REPLACE_RENAME], &tv_step);
+
+		if (fsync(dirfd))
+		{
+			fprintf(stderr, "%s: fsync %s\n", strerror(errno), dirName);
+			break;
+		}
+		timed_step(&d->replaceStepLatency[REPLACE_DIRSYNC], &tv_step);
+
+		update_latency_info(&d->replaceLatency, tv_begin, tv_step);
+		d->replaceOps++;
+	}
+out:
+	timer_stop(&d->replaceTimings);
+
+	close(dirfd);
+}
+
+static void do_replace_test( ThreadTest *test )
+{
+	char name[KBYTE + 32];
+	int i, file;
+
+	timer_init(&test->totalTimeReplace);
+
+	t_log(LEVEL_INFO, "Doing atomic replace test");
+	run_test_threads(test, do_replace_thread, FALSE, &test->totalTimeReplace);
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		for(file = 0; file < args.replaceFiles; file++)
+		{
+			replace_file_name(name, &test->threads[i], file, FALSE);
+			unlink(name);
+			replace_file_name(name, &test->threads[i], file, TRUE);
+			unlink(name);
+		}
+	}
+}
+
+/*
+  Discard phases: ranges of discardMin to discardMax bytes at random
+  block aligned offsets are deallocated, by BLKDISCARD on raw devices
+  and by punching holes in files. The mixed phase interleaves them with
+  random reads and writes of a block, whose latencies show the effect
+  of the discards next to the random phases without them.
+*/
+static int discard_range(int fd, TIO_off_t offset, TIO_off_t length)
+{
+	if (args.rawDrives)
+	{
+		uint64_t range[2] = { offset, length };
+
+		return ioctl(fd, BLKDISCARD, range);
+	}
+
+	return TIO_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			     offset, length);
+}
+
+static void discard_thread( ThreadData *d, int mixed )
+{
+	const TIO_off_t bytesize = (TIO_off_t)d->fileSizeInMBytes * MBYTE / d->blockSize * d->blockSize;
+	const unsigned long ops = mixed ? d->numRandomOps : args.discardOps;
+	struct tt_rusage *timings = mixed ? &d->mixedTimings : &d->discardTimings;
+	unsigned int seed = get_random_seed() + d->myNumber;
+	int openFlags = O_RDWR;
+	unsigned long op;
+	int fd;
+
+	if (!args.rawDrives)
+		openFlags |= O_CREAT;
+	if (args.syncWriting)
+		openFlags |= args.dsyncWriting ? O_DSYNC : O_SYNC;
+	if (args.openDirect)
+		openFlags |= O_DIRECT;
+#ifdef USE_LARGEFILES
+	openFlags |= O_LARGEFILE;
+#endif
+
+	fd = open(d->fileName, openFlags, 0600);
+	if (fd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), d->fileName);
+		return;
+	}
+
+	/* without the write phase there is nothing to discard yet */
+	if (prefill_file(fd, bytesize, d))
+	{
+		close(fd);
+		return;
+	}
+
+	d->ioSize = d->lastIoSize = d->blockSize;
+
+	timer_start(timings);
+
+	for(op = 0; op < ops; op++)
+	{
+		int kind = mixed ? MIXED_DISCARD : DISCARD_RANGE;
+		TIO_off_t offset, length = d->blockSize;
+		struct timeval tv_start, tv_stop;
+		int ret;
+
+		if (mixed && get_random_number(100, &seed) >= args.discardMix)
+			kind = get_random_number(2, &seed) ? MIXED_READ : MIXED_WRITE;
+
+		if (kind == MIXED_DISCARD || kind == DISCARD_RANGE)
+		{
+			length = args.discardMin +
+				get_random_number(args.discardMax - args.discardMin + 1, &seed);
+			length = MAX(length / d->blockSize, 1) * d->blockSize;
+		}
+		offset = d->fileOffset + get_random_number((bytesize - length) / d->blockSize + 1,
+							   &seed) * d->blockSize;
+
+		if (kind == MIXED_WRITE && patterns.active)
+			fill_pattern(d, d->blockSize);
+
+		gettimeofday(&tv_start, NULL);
+
+		if (kind == MIXED_WRITE)
+			ret = do_pwrite_operation(fd, offset, d);
+		else if (kind == MIXED_READ)
+			ret = do_pread_operation(fd, offset, d);
+		else if ((ret = discard_range(fd, offset, length)) != 0)
+			fprintf(stderr, "%s: %s %s\n", strerror(errno),
+				args.rawDrives ? "BLKDISCARD" : "punching hole in", d->fileName);
+
+		if (ret != 0)
+			break;
+
+		gettimeofday(&tv_stop, NULL);
+		update_latency_info(&d->discardLatency[kind], tv_start, tv_stop);
+		d->discardOps[kind]++;
+		d->discardBytes[kind] += length;
+	}
+
+	timer_stop(timings);
+
+	close(fd);
+}
+
+static void do_discard_thread( ThreadData *d )
+{
+	discard_thread(d, FALSE);
+}
+
+static void do_mixed_discard_thread( ThreadData *d )
+{
+	discard_thread(d, TRUE);
+}
+
+static void do_discard_test( ThreadTest *test, int mixed )
+{
+	struct tt_rusage *t = mixed ? &test->totalTimeMixed : &test->totalTimeDiscard;
+
+	timer_init(t);
+
+	t_log(LEVEL_INFO, mixed ? "Doing mixed discard test" : "Doing discard test");
+	run_test_threads(test, mixed ? do_mixed_discard_thread : do_discard_thread,
+			 FALSE, t);
+}
+
+/*
+  Trace replay
+*/
+
+static unsigned long long timespec_to_nsec(const struct timespec *ts)
+{
+	return (unsigned long long)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void replay_queue_push(ReplayQueue *q, const ReplayRecord *r)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->head - q->tail == REPLAY_QUEUE_LENGTH)
+		pthread_cond_wait(&q->changed, &q->lock);
+	q->records[q->head++ % REPLAY_QUEUE_LENGTH] = *r;
+	pthread_cond_broadcast(&q->changed);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void replay_queue_pop(ReplayQueue *q, ReplayRecord *r)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->head == q->tail)
+		pthread_cond_wait(&q->changed, &q->lock);
+	*r = q->records[q->tail++ % REPLAY_QUEUE_LENGTH];
+	pthread_cond_broadcast(&q->changed);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*
+  Streams the trace to the worker queues, a chunk at a time so that
+  traces of any size replay in constant memory
+*/
+static void* replay_reader( void *data )
+{
+	ReplayRecord *chunk, end;
+	ssize_t rc;
+	int i, truncated;
+
+	chunk = malloc(REPLAY_READ_RECORDS * sizeof(ReplayRecord));
+	if (chunk == NULL)
+	{
+		perror("Error malloc()ing trace buffer");
+		exit(-1);
+	}
+
+	while ((rc = read(replay.traceFd, chunk,
+			  REPLAY_READ_RECORDS * sizeof(ReplayRecord))) > 0)
+	{
+		/* short read in the middle of a record, get the rest */
+		while (rc % sizeof(ReplayRecord))
+		{
+			const ssize_t more = read(replay.traceFd, (char *)chunk + rc,
+						  sizeof(ReplayRecord) - rc % sizeof(ReplayRecord));
+
+			if (more < 0)
+				perror("Error reading trace file");
+			if (more <= 0)
+				break;
+			rc += more;
+		}
+		truncated = rc % sizeof(ReplayRecord) != 0;
+
+		for(i = 0; i < rc / sizeof(ReplayRecord); i++)
+		{
+			ReplayRecord *r = &chunk[i];
+
+			r->timestamp = le64toh(r->timestamp);
+			r->offset    = le64toh(r->offset);
+			r->length    = le32toh(r->length);
+			r->stream    = le32toh(r->stream);
+
+			if (r->op >= REPLAY_OPS)
+				continue;
+
+			replay_queue_push(&replay.queues[r->stream % replay.numQueues], r);
+			replay.records++;
+		}
+
+		if (truncated)
+		{
+			fprintf(stderr, "Truncated trace record in %s\n", args.replayFile);
+			break;
+		}
+	}
+
+	if (rc < 0)
+		perror("Error reading trace file");
+
+	memset(&end, 0, sizeof(ReplayRecord));
+	end.op = REPLAY_END;
+	for(i = 0; i < replay.numQueues; i++)
+		replay_queue_push(&replay.queues[i], &end);
+
+	free(chunk);
+	return NULL;
+}
+
+/* maps a traced operation into the target, keeping O_DIRECT alignment */
+static TIO_off_t replay_offset(const ReplayRecord *r, size_t *length)
+{
+	const unsigned long align = args.openDirect ? PAGE_SIZE : 1;
+	TIO_off_t span;
+
+	*length = MIN(r->length, REPLAY_MAX_LENGTH);
+	*length = MIN(*length, replay.size);
+	*length = (*length + align - 1) / align * align;
+	if (*length == 0)
+		*length = align;
+
+	span = replay.size - *length + 1;
+	return replay.base + (r->offset % span) / align * align;
+}
+
+static void do_replay_thread( ThreadData *d )
+{
+	ReplayQueue *q = &replay.queues[d->myNumber];
+	unsigned char *buffer = d->buffer;
+	size_t bufferSize = d->blockSize;
+	ReplayRecord r;
+
+	/* the first worker to run starts the trace clock */
+	if (__sync_bool_compare_and_swap(&replay.started, 0, 1))
+	{
+		clock_gettime(CLOCK_MONOTONIC, &replay.start);
+		__sync_synchronize();
+		replay.started = 2;
+	}
+	while (replay.started != 2)
+		;
+
+	timer_start(&d->replayTimings);
+
+	for (;;)
+	{
+		struct timeval tv_start, tv_stop;
+		TIO_off_t offset = 0;
+		size_t length = 0;
+		ssize_t rc = 0;
+
+		replay_queue_pop(q, &r);
+		if (r.op == REPLAY_END)
+			break;
+
+		if (r.op != REPLAY_FSYNC)
+		{
+			offset = replay_offset(&r, &length);
+			if (length > bufferSize)
+			{
+				if (buffer != d->buffer)
+					tt_aligned_free((caddr_t)buffer, bufferSize);
+				bufferSize = length;
+				buffer = tt_aligned_alloc(bufferSize);
+			}
+		}
+
+		if (args.replayOriginalTiming)
+		{
+			const unsigned long long due =
+				timespec_to_nsec(&replay.start) + r.timestamp;
+			struct timespec ts;
+
+			ts.tv_sec = due / 1000000000ULL;
+			ts.tv_nsec = due % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+		}
+
+		gettimeofday(&tv_start, NULL);
+
+		switch (r.op)
+		{
+		case REPLAY_READ:
+			rc = TIO_pread(replay.fd, buffer, length, offset);
+			break;
+		case REPLAY_WRITE:
+			rc = TIO_pwrite(replay.fd, buffer, length, offset);
+			break;
+		case REPLAY_FSYNC:
+			rc = do_flush(replay.fd, NULL, 0, NULL);
+			break;
+		}
+
+		gettimeofday(&tv_stop, NULL);
+
+		if (rc < 0 || (r.op != REPLAY_FSYNC && rc != length))
+		{
+			fprintf(stderr, "Replayed %s of %lu bytes at offset " OFFSET_FORMAT " failed: %s\n",
+				r.op == REPLAY_READ ? "read" : r.op == REPLAY_WRITE ? "write" : "fsync",
+				(unsigned long)length, offset, rc < 0 ? strerror(errno) : "short I/O");
+			continue;
+		}
+
+		update_latency_info(&d->replayLatency[r.op], tv_start, tv_stop);
+		d->replayOps[r.op]++;
+		d->replayBytes[r.op] += length;
+
+		if (r.flags & REPLAY_FLAG_FSYNC)
+		{
+			if (do_flush(replay.fd, NULL, 0, &d->replayLatency[REPLAY_FSYNC]) == 0)
+				d->replayOps[REPLAY_FSYNC]++;
+		}
+	}
+
+	timer_stop(&d->replayTimings);
+
+	if (buffer != d->buffer)
+		tt_aligned_free((caddr_t)buffer, bufferSize);
+}
+
+static int open_replay_trace( void )
+{
+	ReplayHeader h;
+
+	replay.traceFd = open(args.replayFile, O_RDONLY);
+	if (replay.traceFd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), args.replayFile);
+		return -1;
+	}
+
+	if (read(replay.traceFd, &h, sizeof(h)) != sizeof(h) ||
+	    memcmp(h.magic, REPLAY_MAGIC, sizeof(h.magic)) ||
+	    le32toh(h.version) != REPLAY_VERSION ||
+	    le32toh(h.recordSize) != sizeof(ReplayRecord))
+	{
+		fprintf(stderr, "%s is not a tiotest trace, convert it with scripts/tiotrace.pl\n",
+			args.replayFile);
+		close(replay.traceFd);
+		return -1;
+	}
+
+	posix_fadvise(replay.traceFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return 0;
+}
+
+static void do_replay_test( ThreadTest *test )
+{
+	pthread_t reader;
+	int openFlags = O_RDWR;
+	int i;
+
+	memset(&replay, 0, sizeof(Replay));
+
+	if (open_replay_trace())
+		return;
+
+	if (args.rawDrives)
+		snprintf(replay.fileName, sizeof(replay.fileName), "%s", args.path[0]);
+	else
+	{
+		snprintf(replay.fileName, sizeof(replay.fileName), "%s/_tiotest_pid%d.replay",
+			 args.path[0], (int)getpid());
+		openFlags |= O_CREAT;
+	}
+
+	if (args.openDirect)
+		openFlags |= O_DIRECT;
+	if (args.syncWriting)
+		openFlags |= args.dsyncWriting ? O_DSYNC : O_SYNC;
+#ifdef USE_LARGEFILES
+	openFlags |= O_LARGEFILE;
+#endif
+
+	replay.fd = open(replay.fileName, openFlags, 0600);
+	if (replay.fd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), replay.fileName);
+		close(replay.traceFd);
+		return;
+	}
+
+	replay.size = (TIO_off_t)args.fileSizeInMBytes * MBYTE;
+	/* keep clear of the start of raw devices like the normal tests do */
+	if (args.rawDrives)
+		replay.base = (TIO_off_t)args.threadOffset * MBYTE;
+	else if (prefill_file(replay.fd, replay.size, &test->threads[0]))
+		goto out;
+
+	replay.numQueues = test->numThreads;
+	replay.queues = calloc(replay.numQueues, sizeof(ReplayQueue));
+	if (replay.queues == NULL)
+	{
+		perror("Error calloc()ing replay queues");
+		goto out;
+	}
+
+	for(i = 0; i < replay.numQueues; i++)
+	{
+		pthread_mutex_init(&replay.queues[i].lock, NULL);
+		pthread_cond_init(&replay.queues[i].changed, NULL);
+	}
+
+	if (pthread_create(&reader, NULL, replay_reader, NULL))
+	{
+		perror("Error from pthread_create()");
+		exit(-1);
+	}
+
+	timer_init(&test->totalTimeReplay);
+
+	t_log(LEVEL_INFO, "Doing trace replay");
+	run_test_threads(test, do_replay_thread, FALSE, &test->totalTimeReplay);
+
+	pthread_join(reader, NULL);
+
+	for(i = 0; i < replay.numQueues; i++)
+	{
+		pthread_cond_destroy(&replay.queues[i].changed);
+		pthread_mutex_destroy(&replay.queues[i].lock);
+	}
+	free(replay.queues);
+out:
+	close(replay.fd);
+	close(replay.traceFd);
+	if (!args.rawDrives)
+		unlink(replay.fileName);
+}
+
+static void oplog_map_window( void )
+{
+	if (TIO_ftruncate(oplog.fd, oplog.windowStart + OPLOG_WINDOW) < 0)
+	{
+		perror("Error growing operation log");
+		exit(-1);
+	}
+
+	oplog.window = TIO_mmap(NULL, OPLOG_WINDOW, PROT_READ | PROT_WRITE,
+				MAP_SHARED, oplog.fd, oplog.windowStart);
+	if (oplog.window == MAP_FAILED)
+	{
+		perror("Error " xstr(TIO_mmap) "()ing operation log");
+		exit(-1);
+	}
+}
+
+static void oplog_append(const OplogRecord *r)
+{
+	OplogRecord *to;
+
+	if (oplog.size - oplog.windowStart == OPLOG_WINDOW)
+	{
+		munmap(oplog.window, OPLOG_WINDOW);
+		oplog.windowStart += OPLOG_WINDOW;
+		oplog_map_window();
+	}
+
+	to = (OplogRecord *)(oplog.window + (oplog.size - oplog.windowStart));
+	to->start    = htole64(r->start);
+	to->offset   = htole64(r->offset);
+	to->size     = htole32(r->size);
+	to->duration = htole32(r->duration);
+	to->thread   = htole32(r->thread);
+	to->test     = r->test;
+	memset(to->pad, 0, sizeof(to->pad));
+
+	oplog.size += sizeof(OplogRecord);
+	oplog.records++;
+}
+
+static void oplog_drain( void )
+{
+	int i;
+
+	for(i = 0; i < oplog.test->numThreads; i++)
+	{
+		OplogRing *ring = &oplog.test->threads[i].oplog;
+		const unsigned long head = ring->head;
+		unsigned long tail;
+
+		/* pairs with the barrier before head moves */
+		__sync_synchronize();
+		for(tail = ring->tail; tail != head; tail++)
+			oplog_append(&ring->records[tail % OPLOG_RING_RECORDS]);
+
+		__sync_synchronize();
+		ring->tail = tail;
+	}
+}
+
+static void* oplog_flusher( void *data )
+{
+	while (!oplog.stop)
+	{
+		oplog_drain();
+		usleep(OPLOG_FLUSH_USECS);
+	}
+	oplog_drain();
+
+	return NULL;
+}
+
+static void open_oplog( ThreadTest *test )
+{
+	OplogHeader *h;
+	int i;
+
+	oplog.fd = open(args.oplogFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (oplog.fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), args.oplogFile);
+		exit(1);
+	}
+
+	for(i = 0; i < test->numThreads; i++)
+	{
+		OplogRing *ring = &test->threads[i].oplog;
+
+		ring->records = tt_shared_alloc(OPLOG_RING_RECORDS * sizeof(OplogRecord));
+		if (ring->records == NULL)
+		{
+			perror("Error allocating operation log buffers");
+			exit(-1);
+		}
+	}
+
+	gettimeofday(&oplog.start, NULL);
+	oplog.test = test;
+	oplog_map_window();
+
+	h = (OplogHeader *)oplog.window;
+	memcpy(h->magic, OPLOG_MAGIC, sizeof(h->magic));
+	h->version    = htole32(OPLOG_VERSION);
+	h->recordSize = htole32(sizeof(OplogRecord));
+	h->startSec   = htole64(oplog.start.tv_sec);
+	h->startUsec  = htole64(oplog.start.tv_usec);
+	oplog.size = sizeof(OplogHeader);
+
+	if (pthread_create(&oplog.flusher, NULL, oplog_flusher, NULL))
+	{
+		perror("Error creating operation log thread");
+		exit(-1);
+	}
+}
+
+static void close_oplog( void )
+{
+	unsigned long dropped = 0;
+	int i;
+
+	oplog.stop = TRUE;
+	pthread_join(oplog.flusher, NULL);
+
+	munmap(oplog.window, OPLOG_WINDOW);
+	if (TIO_ftruncate(oplog.fd, oplog.size) < 0)
+		perror("Error truncating operation log");
+	close(oplog.fd);
+
+	for(i = 0; i < oplog.test->numThreads; i++)
+	{
+		OplogRing *ring = &oplog.test->threads[i].oplog;
+
+		dropped += ring->dropped;
+		tt_shared_free(ring->records, OPLOG_RING_RECORDS * sizeof(OplogRecord));
+		ring->records = NULL;
+	}
+
+	if (args.terse)
+		printf("oplog:%llu,%lu\n", oplog.records, dropped);
+	else
+		printf("Logged %llu operations to %s, %lu dropped with full buffers\n",
+		       oplog.records, args.oplogFile, dropped);
+}
+
+static void do_tests( ThreadTest *thisTest )
+{
+	struct tt_rusage *timeWrite       = &(thisTest->totalTime[WRITE_TEST]);
+	struct tt_rusage *timeRandomWrite = &(thisTest->totalTime[RANDOM_WRITE_TEST]);
+	struct tt_rusage *timeRead        = &(thisTest->totalTime[READ_TEST]);
+	struct tt_rusage *timeRandomRead  = &(thisTest->totalTime[RANDOM_READ_TEST]);
+
+	timer_init( timeWrite );
+	timer_init( timeRandomWrite );
+	timer_init( timeRead );
+	timer_init( timeRandomRead );
+
+	/*
+	  Write testing
+	*/
+	if (args.testsToRun[WRITE_TEST])
+		do_test( thisTest, WRITE_TEST, args.sequentialWriting,
+				 timeWrite,  "Waiting write threads to finish...");
+
+	/*
+	  RandomWrite testing
+	*/
+	if (args.testsToRun[RANDOM_WRITE_TEST])
+		do_test( thisTest, RANDOM_WRITE_TEST, FALSE, timeRandomWrite,
+				 "Waiting random write threads to finish...");
+
+	/*
+	  Read testing
+	*/
+	if (args.testsToRun[READ_TEST])
+		do_test( thisTest, READ_TEST, FALSE, timeRead,
+				 "Waiting read threads to finish..." );
+
+	/*
+	  RandomRead testing
+	*/
+	if (args.testsToRun[RANDOM_READ_TEST])
+		do_test( thisTest, RANDOM_READ_TEST, FALSE, timeRandomRead,
+				 "Waiting random read threads to finish...");
+
+	/*
+	  Atomic replace testing
+	*/
+	if (args.replace)
+		do_replace_test( thisTest );
+
+	/*
+	  Discard testing, last as it leaves holes in the files
+	*/
+	if (args.discardMix)
+		do_discard_test( thisTest, TRUE );
+
+	if (args.discard)
+		do_discard_test( thisTest, FALSE );
+}
+
+/* threads of the first threads that use path p, they go round robin */
+static int path_threads( int p, int threads )
+{
+	return p < threads ? (threads - p + args.pathsCount - 1) / args.pathsCount : 0;
+}
+
+/*
+  Sizes the file of every path for the most threads, or fills it when
+  no write phase will. Not timed.
+*/
+static int lay_out_sweep_files( ThreadTest *test, int runWrite )
+{
+	int openFlags = O_RDWR | O_CREAT;
+	int p, rc;
+
+#ifdef USE_LARGEFILES
+	openFlags |= O_LARGEFILE;
+#endif
+
+	for(p = 0; p < MIN(args.pathsCount, test->numThreads); p++)
+	{
+		ThreadData *d = &test->threads[p];
+		const TIO_off_t bytes = (TIO_off_t)path_threads(p, test->numThreads) *
+			args.fileSizeInMBytes * MBYTE;
+		int fd = open(d->fileName, openFlags, 0600);
+
+		if (fd == -1)
+		{
+			fprintf(stderr, "%s: %s\n", strerror(errno), d->fileName);
+			return -1;
+		}
+
+		rc = runWrite ? TIO_ftruncate(fd, bytes) : prefill_file(fd, bytes, d);
+		if (rc && runWrite)
+			perror(xstr(TIO_ftruncate) "() failed");
+		close(fd);
+		if (rc)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+  Sweep over thread counts and block sizes on one data set of -f
+  MBytes for each of the most threads, in one file per path written
+  once. Every thread count splits the data set of each path between
+  its threads there and runs as many random ops in all, then the other
+  phases run for each of its block sizes.
+*/
+static void do_sweep_test( ThreadTest *test )
+{
+	const int runWrite = args.testsToRun[WRITE_TEST];
+	const int configs = args.sweepThreadsCount * args.sweepBlocksCount;
+	int c, i, j;
+
+	if (!args.rawDrives && lay_out_sweep_files(test, runWrite))
+		return;
+
+	for(c = -1; c < configs; c++)
+	{
+		/* -1 is the configuration writing the data set */
+		const int threads = c < 0 ? test->numThreads :
+			args.sweepThreads[c / args.sweepBlocksCount];
+		const int block = args.sweepBlocks[c < 0 ? 0 : c % args.sweepBlocksCount];
+		ThreadTest view;
+
+		if (c >= 0 && threads == test->numThreads && block == args.sweepBlocks[0])
+			continue;
+
+		memset(&view, 0, sizeof(ThreadTest));
+		view.threads = test->threads;
+		view.numThreads = threads;
+
+		for(i = 0; i < threads; i++)
+		{
+			ThreadData *d = &test->threads[i];
+			const int p = i % args.pathsCount;
+
+			place_thread(d, i, path_threads(p, test->numThreads) *
+				     args.fileSizeInMBytes / path_threads(p, threads));
+			d->numRandomOps = args.numRandomOps * test->numThreads / threads;
+			d->prefill = FALSE;
+
+			d->blockSize = d->ioSize = block;
+			for(j = 0; j < TEST_COUNT; j++)
+				reset_phase(d, j);
+			reset_slow_ops(d);
+		}
+
+		args.testsToRun[WRITE_TEST] = runWrite && c < 0;
+		do_tests(&view);
+
+		if (args.terse)
+			printf("sweep:%d,%d\n", threads, block);
+		else
+			printf("Tiotest sweep with %d threads and %d byte blocks:\n",
+			       threads, block);
+		print_results(&view);
+		fflush(stdout);
+	}
+
+	args.testsToRun[WRITE_TEST] = runWrite;
+}
+
+/*
+  Write-ahead log workload
+*/
+
+struct wal_record_header {
+	unsigned int       length;
+	unsigned int       thread;
+	unsigned long long sequence;
+};
+
+/* called and returns with walLog.lock held */
+static void wal_commit_locked( void )
+{
+	WalLog *w = &walLog;
+	unsigned char *batch = w->batch[w->filling];
+	const size_t bytes = w->batchBytes;
+	const unsigned long records = w->batchRecords;
+	const unsigned long long seq = w->fillingSeq;
+	struct timeval tv_start, tv_stop;
+	ssize_t rc;
+
+	w->leader = TRUE;
+	w->filling ^= 1;
+	w->fillingSeq++;
+	w->batchBytes = 0;
+	w->batchRecords = 0;
+
+	pthread_mutex_unlock(&w->lock);
+
+	gettimeofday(&tv_start, NULL);
+	rc = write(w->fd, batch, bytes);
+	if (rc != bytes)
+	{
+		if (rc == -1)
+			perror("Error appending to log file");
+		else
+			fprintf(stderr, "Tried to append %lu bytes to log file, but only wrote %ld bytes\n",
+				(unsigned long)bytes, (long)rc);
+		rc = -1;
+	}
+	else if (fdatasync(w->fd))
+	{
+		perror("Error fdatasync()ing log file");
+		rc = -1;
+	}
+	gettimeofday(&tv_stop, NULL);
+
+	pthread_mutex_lock(&w->lock);
+
+	if (rc == -1)
+		w->failed = TRUE;
+
+	update_latency_info(&w->commitLatency, tv_start, tv_stop);
+	w->commits++;
+	w->committedRecords += records;
+	w->durableSeq = seq;
+	w->leader = FALSE;
+
+	pthread_cond_broadcast(&w->committed);
+}
+
+static void do_wal_thread( ThreadData *d )
+{
+	WalLog *w = &walLog;
+	unsigned int seed = get_random_seed() + d->myNumber;
+	const int range = args.walRecordMax - args.walRecordMin + 1;
+	unsigned long r;
+
+	timer_start(&d->walTimings);
+
+	for(r = 0; r < args.walRecords && !w->failed; r++)
+	{
+		const size_t size = args.walRecordMin + get_random_number(range, &seed);
+		struct wal_record_header h;
+		struct timeval tv_start, tv_stop;
+		unsigned long long mySeq;
+
+		gettimeofday(&tv_start, NULL);
+
+		pthread_mutex_lock(&w->lock);
+
+		while (w->batchBytes > 0 &&
+		       (w->batchBytes + size > w->batchSize ||
+			w->batchRecords >= args.walBatch))
+		{
+			if (!w->leader)
+				wal_commit_locked();
+			else
+				pthread_cond_wait(&w->committed, &w->lock);
+		}
+
+		h.length = size;
+		h.thread = d->myNumber;
+		h.sequence = r;
+		memcpy(w->batch[w->filling] + w->batchBytes, d->buffer,
+		       MIN(size, d->blockSize));
+		memcpy(w->batch[w->filling] + w->batchBytes, &h,
+		       MIN(size, sizeof(h)));
+		w->batchBytes += size;
+		w->batchRecords++;
+		mySeq = w->fillingSeq;
+
+		while (w->durableSeq < mySeq && !w->failed)
+		{
+			if (!w->leader)
+				wal_commit_locked();
+			else
+				pthread_cond_wait(&w->committed, &w->lock);
+		}
+
+		pthread_mutex_unlock(&w->lock);
+
+		gettimeofday(&tv_stop, NULL);
+		update_latency_info(&d->walLatency, tv_start, tv_stop);
+
+		d->walRecords++;
+		d->walBytes += size;
+	}
+
+	timer_stop(&d->walTimings);
+}
+
+static int do_wal_test( ThreadTest *test )
+{
+	WalLog *w = &walLog;
+	int openFlags = O_WRONLY | O_CREAT | O_TRUNC | O_APPEND;
+	int i;
+
+#ifdef USE_LARGEFILES
+	openFlags |= O_LARGEFILE;
+#endif
+
+	memset(w, 0, sizeof(WalLog));
+
+	sprintf(w->fileName, "%s/_tiotest_pid%d.wal", args.path[0], (int)getpid());
+
+	w->fd = open(w->fileName, openFlags, 0600);
+	if (w->fd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", strerror(errno), w->fileName);
+		return -1;
+	}
+
+	w->batchSize = (size_t)args.walRecordMax * args.walBatch;
+	for(i = 0; i < 2; i++)
+		w->batch[i] = tt_aligned_alloc(w->batchSize);
+
+	w->fillingSeq = 1;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->committed, NULL);
+
+	/* records carry the thread's buffer as payload */
+	for(i = 0; i < test->numThreads; i++)
+		if (!args.consistencyCheckData)
+			memset(test->threads[i].buffer, 'a' + i % 26,
+			       test->threads[i].blockSize);
+
+	timer_init(&test->totalTimeWal);
+
+	t_log(LEVEL_INFO, "Doing write-ahead log test");
+	run_test_threads(test, do_wal_thread, FALSE, &test->totalTimeWal);
+
+	pthread_cond_destroy(&w->committed);
+	pthread_mutex_destroy(&w->lock);
+
+	for(i = 0; i < 2; i++)
+		tt_aligned_free((caddr_t)w->batch[i], w->batchSize);
+
+	close(w->fd);
+	unlink(w->fileName);
+	return 0;
+}
+
+static void add_timer(struct timeval* v, const struct timeval* start_time, const struct timeval* end_time)
+{
+	struct timeval tmp;
+
+	assert(end_time->tv_sec >= start_time->tv_sec);
+	if(start_time->tv_sec == end_time->tv_sec)
+	{
+		assert(start_time->tv_usec <= end_time->tv_usec);
+	}
+
+	memset(&tmp, 0, sizeof(struct timeval));
+
+	timersub(end_time, start_time, &tmp);
+
+	timeradd(v, &tmp, v);
+}
+
+static double timeval_to_secs(const struct timeval* v)
+{
+	double s;
+
+	s = v->tv_sec;
+	s += v->tv_usec / (1000.0*1000.0);
+
+	return s;
+}
+
+static float timeval_percentage_of(const struct timeval* value, const struct timeval* from, unsigned int divider)
+{
+	unsigned long long v;
+	float p;
+
+	v = (100 * 100 * tv_to_usec(value)) / tv_to_usec(from);
+
+	p = (float)v / (100.0 * divider);
+
+	return p;
+}
+
+/*
+  Rates with stonewalling: the aggregate counts only what was done
+  while every thread was still running, and the per thread spread
+  shows how evenly the threads were served.
+*/
+static void print_stonewall_results( ThreadTest *d )
+{
+	int i, testCase;
+
+	if (!args.terse)
+	{
+		printf("Tiotest stonewall results:\n");
+		printf(",-------------------------------------------------------------------------------------.\n");
+		printf("| Item         | Stonewall rate | Full rate      | Thread min   | Thread max   | Stddev  |\n");
+		printf("+--------------+----------------+----------------+--------------+--------------+---------+\n");
+	}
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		struct timeval realtime, walltime;
+		double stonewallMBytes = 0, totalMBytes = 0;
+		double mbytes, secs, rate, fullRate;
+		double min = 0, max = 0, sum = 0, sumsq = 0, avg, stddev;
+		int rates = 0;
+
+		if (!d->stonewalled[testCase])
+			continue;
+
+		for(i = 0; i < d->numThreads; i++)
+		{
+			const PhaseStats *stats = &d->threads[i].phase[testCase];
+			const struct tt_rusage *t = &stats->timings;
+			const double threadMBytes = (double)stats->bytes / MBYTE;
+			struct timeval elapsed;
+			double threadRate;
+
+			stonewallMBytes += (double)stats->stonewallBytes / MBYTE;
+			totalMBytes     += threadMBytes;
+
+			memset(&elapsed, 0, sizeof(struct timeval));
+			add_timer(&elapsed, &t->startRealTime, &t->stopRealTime);
+			if (timeval_to_secs(&elapsed) <= 0)
+				continue;
+
+			threadRate = threadMBytes / timeval_to_secs(&elapsed);
+
+			if (rates == 0 || threadRate < min)
+				min = threadRate;
+			if (rates == 0 || threadRate > max)
+				max = threadRate;
+			sum   += threadRate;
+			sumsq += threadRate * threadRate;
+			rates++;
+		}
+
+		if (totalMBytes == 0)
+			continue;
+
+		avg = rates ? sum / rates : 0;
+		stddev = rates ? sumsq / rates - avg * avg : 0;
+		stddev = stddev > 0 ? sqrt(stddev) : 0;
+
+		memset(&realtime, 0, sizeof(struct timeval));
+		memset(&walltime, 0, sizeof(struct timeval));
+		add_timer(&realtime, &(d->totalTime[testCase].startRealTime),
+			  &d->stonewallTime[testCase]);
+		add_timer(&walltime, &(d->totalTime[testCase].startRealTime),
+			  &(d->totalTime[testCase].stopRealTime));
+
+		mbytes = stonewallMBytes;
+		secs = timeval_to_secs(&realtime);
+		rate = secs > 0 ? mbytes / secs : 0;
+		fullRate = totalMBytes / timeval_to_secs(&walltime);
+
+		if (args.terse)
+			printf("stonewall_%s:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+			       testNames[testCase], mbytes, secs, rate, fullRate,
+			       min, max, stddev);
+		else
+			printf("| %-12s | %9.3f MB/s | %9.3f MB/s | %7.1f MB/s | %7.1f MB/s | %7.1f |\n",
+			       testTitles[testCase], rate, fullRate, min, max, stddev);
+	}
+
+	if (!args.terse)
+		printf("`--------------+----------------+----------------+--------------+--------------+---------'\n\n");
+}
+
+/*
+  Flush latencies are kept apart from the data operations, they include
+  the --fsync-ops/--fsync-mb cadence and the final flush of the phase
+*/
+static void print_flush_results( ThreadTest *d )
+{
+	int i, testCase;
+
+	if (!args.terse)
+	{
+		printf("Tiotest flush latency results:\n");
+		printf(",-----------------------------------------------------------------------------------------------------------.\n");
+		printf("| Item         | Flushes  | Average latency | 50%% latency  | 99%% latency  | 99.9%% latency | Maximum latency |\n");
+		printf("+--------------+----------+-----------------+--------------+--------------+---------------+-----------------+\n");
+	}
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		Latencies lat;
+
+		if (!is_write_test(testCase))
+			continue;
+
+		memset(&lat, 0, sizeof(Latencies));
+		for(i = 0; i < d->numThreads; i++)
+			merge_latencies(&lat, &d->threads[i].phase[testCase].flushLatency);
+
+		if (lat.count == 0)
+			continue;
+
+		if (args.terse)
+			printf("flush_%s:%lu,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+			       testNames[testCase], lat.count,
+			       lat.avg / lat.count * 1000,
+			       latency_percentile(&lat, 50) * 1000,
+			       latency_percentile(&lat, 99) * 1000,
+			       latency_percentile(&lat, 99.9) * 1000,
+			       lat.max * 1000);
+		else
+			printf("| %-12s | %8lu | %12.3f ms | %9.3f ms | %9.3f ms | %10.3f ms | %12.3f ms |\n",
+			       testTitles[testCase], lat.count,
+			       lat.avg / lat.count * 1000,
+			       latency_percentile(&lat, 50) * 1000,
+			       latency_percentile(&lat, 99) * 1000,
+			       latency_percentile(&lat, 99.9) * 1000,
+			       lat.max * 1000);
+	}
+
+	if (!args.terse)
+		printf("`--------------+----------+-----------------+--------------+--------------+---------------+-----------------'\n\n");
+}
+
+static void print_replace_results( ThreadTest *d )
+{
+	static const char* const stepNames[REPLACE_STEPS] = {
+		"write", "fsync", "rename", "dirsync",
+	};
+	static const char* const stepTitles[REPLACE_STEPS] = {
+		"Write", "Fsync", "Rename", "Dir fsync",
+	};
+	struct timeval realtime, usrtime, systime;
+	Latencies total, steps[REPLACE_STEPS];
+	double ops = 0, secs;
+	int i, step;
+
+	memset(&realtime, 0, sizeof(struct timeval));
+	memset(&usrtime, 0, sizeof(struct timeval));
+	memset(&systime, 0, sizeof(struct timeval));
+	memset(&total, 0, sizeof(Latencies));
+	memset(steps, 0, sizeof(steps));
+
+	for(i = 0; i < d->numThreads; i++)
+	{
+		add_timer( &usrtime, &(d->threads[i].replaceTimings.startUserTime), &(d->threads[i].replaceTimings.stopUserTime) );
+		add_timer( &systime, &(d->threads[i].replaceTimings.startSysTime), &(d->threads[i].replaceTimings.stopSysTime) );
+
+		ops += d->threads[i].replaceOps;
+		merge_latencies(&total, &d->threads[i].replaceLatency);
+		for(step = 0; step < REPLACE_STEPS; step++)
+			merge_latencies(&steps[step], &d->threads[i].replaceStepLatency[step]);
+	}
+
+	add_timer( &realtime, &(d->totalTimeReplace.startRealTime), &(d->totalTimeReplace.stopRealTime) );
+	secs = timeval_to_secs(&realtime);
+
+	if (args.terse)
+	{
+		printf("replace:%.0f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+		       ops, secs,
+		       timeval_to_secs(&usrtime)/d->numThreads,
+		       timeval_to_secs(&systime)/d->numThreads,
+		       total.count ? total.avg / total.count * 1000 : 0,
+		       total.max * 1000);
+		for(step = 0; step < REPLACE_STEPS; step++)
+			printf("replace_%s:%.5f,%.5f,%.5f\n", stepNames[step],
+			       steps[step].count ? steps[step].avg / steps[step].count * 1000 : 0,
+			       latency_percentile(&steps[step], 99) * 1000,
+			       steps[step].max * 1000);
+		return;
+	}
+
+	printf("Tiotest atomic replace results:\n");
+	printf(",---------------------------------------------------------.\n");
+	printf("| Item         | Ops      | Time     | Ops/s              |\n");
+	printf("+--------------+----------+----------+--------------------+\n");
+	printf("| Replace      | %8.0f | %6.1f s | %18.1f |\n",
+	       ops, secs, secs > 0 ? ops / secs : 0);
+	printf("`---------------------------------------------------------'\n");
+
+	if (!args.showLatency)
+		return;
+
+	printf("Tiotest atomic replace latency results:\n");
+	printf(",--------------------------------------------------------------------------------.\n");
+	printf("| Item         | Average latency | 50%% latency  | 99%% latency  | Maximum latency |\n");
+	printf("+--------------+-----------------+--------------+--------------+-----------------+\n");
+
+	for(step = 0; step < REPLACE_STEPS; step++)
+		printf("| %-12s | %12.3f ms | %9.3f ms | %9.3f ms | %12.3f ms |\n",
+		       stepTitles[step],
+		       steps[step].count ? steps[step].avg / steps[step].count * 1000 : 0,
+		       latency_percentile(&steps[step], 50) * 1000,
+		       latency_percentile(&steps[step], 99) * 1000,
+		       steps[step].max * 1000);
+
+	printf("|--------------+-----------------+--------------+--------------+-----------------|\n");
+	printf("| Total        | %12.3f ms | %9.3f ms | %9.3f ms | %12.3f ms |\n",
+	       total.count ? total.avg / total.count * 1000 : 0,
+	       latency_percentile(&total, 50) * 1000,
+	       latency_percentile(&total, 99) * 1000,
+	       total.max * 1000);
+	printf("`--------------+-----------------+--------------+--------------+-----------------'\n\n");
+}
+
+/*
+  A phase summed over all threads
+*/
+typedef struct {
+	double           blocks;
+	double           mbytes;
+	struct timeval   realtime, usrtime, systime;
+	Latencies        latency;
+	PerfCounts       perf;          /* valid if valid for every thread */
+} PhaseTotals;
+
+static void sum_phase( const ThreadTest *d, int testCase, PhaseTotals *p )
+{
+	int i;
+
+	memset(p, 0, sizeof(PhaseTotals));
+	p->perf.valid = ~0U;
+
+	for(i = 0; i < d->numThreads; i++)
+	{
+		const PhaseStats *stats = &d->threads[i].phase[testCase];
+		int j;
+
+		for(j = 0; j < PERF_COUNTERS_COUNT; j++)
+			p->perf.value[j] += stats->perf.value[j];
+		p->perf.valid &= stats->perf.valid;
+
+		add_timer( &p->usrtime, &(stats->timings.startUserTime), &(stats->timings.stopUserTime) );
+		add_timer( &p->systime, &(stats->timings.startSysTime), &(stats->timings.stopSysTime) );
+
+		p->blocks += stats->blocks;
+		p->mbytes += (double)stats->bytes / MBYTE;
+		merge_latencies(&p->latency, &stats->latency);
+	}
+
+	add_timer( &p->realtime, &(d->totalTime[testCase].startRealTime),
+		   &(d->totalTime[testCase].stopRealTime) );
+}
+
+/*
+  Average latency and the shares over LATENCY_STAT1/LATENCY_STAT2
+*/
+static void latency_shares( const Latencies *lat, double *avg,
+			    double *perc1, double *perc2 )
+{
+	*avg = *perc1 = *perc2 = 0;
+
+	if (lat->count > 0)
+	{
+		*avg = lat->avg / lat->count;
+		*perc1 = lat->count1 * 100.0 / lat->count;
+		*perc2 = lat->count2 * 100.0 / lat->count;
+	}
+}
+
+/*
+  Phases with a block size distribution also report every size on
+  its own, rates being the share of the phase throughput
+*/
+static void format_size( char *buf, unsigned long size )
+{
+	if (size % MBYTE == 0)
+		sprintf(buf, "%lum", size / MBYTE);
+	else if (size % KBYTE == 0)
+		sprintf(buf, "%luk", size / KBYTE);
+	else
+		sprintf(buf, "%lu", size);
+}
+
+static void print_block_size_header( void )
+{
+	if (args.terse)
+		return;
+
+	printf("Tiotest block size results:\n");
+	printf(",-----------------------------------------------------------------------------------------------.\n");
+	printf("| Item         | Block    | Ops     | Rate         | Avg latency  | 99%% latency  | Max latency  |\n");
+	printf("+--------------+----------+---------+--------------+--------------+--------------+--------------+\n");
+}
+
+static void print_block_size_footer( void )
+{
+	if (!args.terse)
+		printf("`--------------+----------+---------+--------------+--------------+--------------+--------------'\n\n");
+}
+
+static void print_block_size_lines( const ThreadTest *d, const char *name,
+				    const BlockDist *dist, int first, int count,
+				    int testCase, double secs )
+{
+	double totalOps = 0;
+	int i, k;
+
+	for(i = first; i < first + count; i++)
+		totalOps += d->threads[i].phase[testCase].blocks;
+
+	if (totalOps == 0)
+		return;
+
+	for(k = 0; k < dist->count; k++)
+	{
+		Latencies lat;
+		char size[32];
+		double mbytes, share, rate, avg;
+
+		memset(&lat, 0, sizeof(Latencies));
+		for(i = first; i < first + count; i++)
+			if (d->threads[i].phase[testCase].sizeLatency)
+				merge_latencies(&lat, &d->threads[i].phase[testCase].sizeLatency[k]);
+
+		format_size(size, dist->size[k]);
+		mbytes = (double)lat.count * dist->size[k] / MBYTE;
+		share = lat.count * 100.0 / totalOps;
+		rate = secs > 0 ? mbytes / secs : 0;
+		avg = lat.count ? lat.avg / lat.count : 0;
+
+		if (args.terse)
+			printf("bsdist_%s_%s:%lu,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+			       name, size, lat.count, share, mbytes, rate,
+			       avg * 1000, latency_percentile(&lat, 99) * 1000,
+			       lat.max * 1000);
+		else
+			printf("| %-12.12s | %8s | %5.1f %% | %7.3f MB/s | %9.3f ms | %9.3f ms | %9.3f ms |\n",
+			       name, size, share, rate, avg * 1000,
+			       latency_percentile(&lat, 99) * 1000,
+			       lat.max * 1000);
+	}
+}
+
+static void print_block_size_results( ThreadTest *d, const PhaseTotals *phases )
+{
+	int testCase;
+
+	print_block_size_header();
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+		if (args.blockDist[testCase].count)
+			print_block_size_lines(d, args.terse ? testNames[testCase] : testTitles[testCase],
+					       &args.blockDist[testCase], 0, d->numThreads,
+					       testCase, timeval_to_secs(&phases[testCase].realtime));
+
+	print_block_size_footer();
+}
+
+/*
+  --perf counters of every test per I/O and per MByte. Counters the
+  kernel would not open, like hardware ones without a PMU, show as -.
+*/
+static void print_perf_results( const PhaseTotals *phases )
+{
+	int testCase, i, unit;
+
+	if (!args.terse)
+	{
+		printf("CPU counters%s:\n", *perfUserOnly ? " (user space only)" : "");
+		printf(",-----------------------------------------------------------------------------------------------------------------.\n");
+		printf("| Item         | Unit   |");
+		for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+			printf(" %-12s |", perfEvents[i].title);
+		printf("\n");
+		printf("+--------------+--------+--------------+--------------+--------------+--------------+--------------+--------------+\n");
+	}
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		const PhaseTotals *p = &phases[testCase];
+
+		if (!p->blocks)
+			continue;
+
+		if (args.terse)
+		{
+			printf("perf_%s:%.0f,%.5f", testNames[testCase],
+			       p->blocks, p->mbytes);
+			for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+				if (p->perf.valid & (1 << i))
+					printf(",%llu", p->perf.value[i]);
+				else
+					printf(",-");
+			printf("\n");
+			continue;
+		}
+
+		for(unit = 0; unit < 2; unit++)
+		{
+			const double per = unit ? p->mbytes : p->blocks;
+
+			printf("| %-12s | %-6s |", unit ? "" : testTitles[testCase],
+			       unit ? "per MB" : "per op");
+			for(i = 0; i < PERF_COUNTERS_COUNT; i++)
+			{
+				double v = p->perf.value[i];
+
+				if (i == PERF_TASK_CLOCK)
+					v /= 1000;
+				if (!(p->perf.valid & (1 << i)) || per <= 0)
+					printf(" %12s |", "-");
+				else
+					printf(" %12.2f |", v / per);
+			}
+			printf("\n");
+		}
+	}
+
+	if (!args.terse)
+		printf("`-----------------------------------------------------------------------------------------------------------------'\n");
+}
+
+/*
+  Device side numbers of every test next to the rate tiotest measured,
+  telling a slow application path from a busy device.
+*/
+static void print_disk_results( const PhaseTotals *phases )
+{
+	int testCase, i;
+
+	if (!args.terse)
+	{
+		printf("Device statistics:\n");
+		printf(",-------------------------------------------------------------------------------------------------------------.\n");
+		printf("| Item         | Device     | Tiotest      | Device       | IOPS      | Util    | Queue   | Await     | Merged  |\n");
+		printf("+--------------+------------+--------------+--------------+-----------+---------+---------+-----------+---------+\n");
+	}
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		const PhaseTotals *p = &phases[testCase];
+		const double secs = timeval_to_secs(&p->realtime);
+
+		if (!p->blocks)
+			continue;
+
+		for(i = 0; i < diskStats.count; i++)
+		{
+			const Disk *disk = &diskStats.disks[i];
+			DiskRates r;
+
+			disk_rates(&disk->delta[testCase], disk->secs[testCase], &r);
+
+			if (args.terse)
+				printf("disk_%s_%s:%.1f,%.3f,%.1f,%.2f,%.3f,%.1f\n",
+				       testNames[testCase], disk->name, r.iops,
+				       r.mbytes, r.util, r.queue, r.await, r.merged);
+			else
+				printf("| %-12s | %-10s | %7.3f MB/s | %7.3f MB/s | %9.1f | %5.1f %% | %7.2f | %6.3f ms | %5.1f %% |\n",
+				       testTitles[testCase], disk->name,
+				       secs ? p->mbytes / secs : 0, r.mbytes,
+				       r.iops, r.util, r.queue, r.await, r.merged);
+		}
+	}
+
+	if (!args.terse)
+		printf("`-------------------------------------------------------------------------------------------------------------'\n");
+}
+
+/*
+  Bytes that reached the devices for every byte a test issued, from
+  diskstats or, without a device, the system wide /proc/vmstat paging
+  counters. Reads that did not reach a device are counted as page
+  cache hits; readahead beyond what was read lowers that estimate.
+*/
+static void print_amplification_results( const PhaseTotals *phases )
+{
+	const char *source = diskStats.count ? "diskstats" : "/proc/vmstat";
+	int testCase, i;
+
+	if (!args.terse)
+	{
+		printf("Amplification and page cache (device bytes from %s):\n", source);
+		printf(",------------------------------------------------------------------------------------------.\n");
+		printf("| Item         | Issued      | Device      | Ratio   | Cached before | Cached after | Hits    |\n");
+		printf("+--------------+-------------+-------------+---------+---------------+--------------+---------+\n");
+	}
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		const PhaseTotals *p = &phases[testCase];
+		const int write = is_write_test(testCase);
+		unsigned long long device = 0;
+		double ratio, hits;
+
+		if (!p->blocks)
+			continue;
+
+		for(i = 0; i < diskStats.count; i++)
+		{
+			const DiskSample *delta = &diskStats.disks[i].delta[testCase];
+
+			device += (write ? delta->writeSectors : delta->readSectors) *
+				DISK_SECTOR_SIZE;
+		}
+		if (!diskStats.count)
+			device = write ? diskStats.vmstatOut[testCase] :
+				diskStats.vmstatIn[testCase];
+
+		ratio = p->mbytes ? device / (p->mbytes * MBYTE) : 0;
+		hits = write ? 0 : MAX(0.0, 1 - ratio);
+
+		if (args.terse)
+		{
+			printf("ampl_%s:%.5f,%.5f,%.5f,%.5f,%.5f,", testNames[testCase],
+			       p->mbytes, (double)device / MBYTE, ratio,
+			       diskStats.residentBefore[testCase] * 100,
+			       diskStats.residentAfter[testCase] * 100);
+			if (write)
+				printf("-\n");
+			else
+				printf("%.5f\n", hits * 100);
+			continue;
+		}
+
+		printf("| %-12s | %7.1f MBs | %7.1f MBs | %7.3f | %11.1f %% | %10.1f %% | ",
+		       testTitles[testCase], p->mbytes, (double)device / MBYTE, ratio,
+		       diskStats.residentBefore[testCase] * 100,
+		       diskStats.residentAfter[testCase] * 100);
+		if (write)
+			printf("      - |\n");
+		else
+			printf("%5.1f %% |\n", hits * 100);
+	}
+
+	if (!args.terse)
+		printf("`------------------------------------------------------------------------------------------'\n");
+}
+
+/* the share of the test files cached when every phase started and ended */
+static void print_cache_results( const PhaseTotals *phases )
+{
+	int testCase;
+
+	if (!args.terse)
+	{
+		printf("Tiotest page cache results:\n");
+		printf(",------------------------------------------------------------------------.\n");
+		printf("| Item         | Advice     | Readahead  | Cached at start | Cached at end |\n");
+		printf("+--------------+------------+------------+-----------------+---------------+\n");
+	}
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		const char *advice = args.fadvise[testCase] >= 0 ?
+			fadviseNames[args.fadvise[testCase]] : "-";
+		const unsigned long readahead = is_write_test(testCase) ?
+			0 : args.readahead[testCase];
+		char window[32] = "-";
+
+		if (!phases[testCase].blocks)
+			continue;
+
+		if (args.terse)
+		{
+			printf("cache_%s:%s,%lu,%.5f,%.5f\n", testNames[testCase],
+			       advice, readahead,
+			       residentStart[testCase] * 100, residentEnd[testCase] * 100);
+			continue;
+		}
+
+		if (readahead)
+			format_size(window, readahead);
+
+		printf("| %-12s | %-10s | %10s | %13.1f %% | %11.1f %% |\n",
+		       testTitles[testCase], advice, window,
+		       residentStart[testCase] * 100, residentEnd[testCase] * 100);
+	}
+
+	if (!args.terse)
+		printf("`------------------------------------------------------------------------'\n");
+}
+
+/* a noted op with the number of its thread, for sorting them all */
+typedef struct {
+	const SlowOp    *op;
+	unsigned long    thread;
+} SlowOpRef;
+
+static int compare_slowest(const void *a, const void *b)
+{
+	const double la = ((const SlowOpRef *)a)->op->latency;
+	const double lb = ((const SlowOpRef *)b)->op->latency;
+
+	return la < lb ? 1 : la > lb ? -1 : 0;
+}
+
+static int compare_slow_start(const void *a, const void *b)
+{
+	const struct timeval *ta = &((const SlowOpRef *)a)->op->start;
+	const struct timeval *tb = &((const SlowOpRef *)b)->op->start;
+
+	if (ta->tv_sec != tb->tv_sec)
+		return ta->tv_sec < tb->tv_sec ? -1 : 1;
+	return ta->tv_usec < tb->tv_usec ? -1 : ta->tv_usec > tb->tv_usec;
+}
+
+static void print_slow_ops(const char *title, const char *terseName,
+			   SlowOpRef *refs, unsigned long count)
+{
+	unsigned long i;
+
+	if (!args.terse)
+	{
+		printf("%s:\n", title);
+		printf(",-----------------------------------------------------------------------------------------.\n");
+		printf("| Time            | Thread | Item         | Offset             | Size       | Latency     |\n");
+		printf("+-----------------+--------+--------------+--------------------+------------+-------------+\n");
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		const SlowOp *op = refs[i].op;
+
+		if (args.terse)
+		{
+			printf("%s:%lu,%s,%ld.%06ld,%llu,%lu,%.3f\n", terseName,
+			       refs[i].thread, testNames[op->testCase],
+			       (long)op->start.tv_sec, (long)op->start.tv_usec,
+			       (unsigned long long)op->offset, op->size,
+			       op->latency * 1000);
+		}
+		else
+		{
+			char stamp[16];
+			struct tm tm;
+			time_t secs = op->start.tv_sec;
+
+			localtime_r(&secs, &tm);
+			strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+			printf("| %s.%06ld | %6lu | %-12s | %18llu | %10lu | %8.3f ms |\n",
+			       stamp, (long)op->start.tv_usec, refs[i].thread,
+			       testTitles[op->testCase],
+			       (unsigned long long)op->offset, op->size,
+			       op->latency * 1000);
+		}
+	}
+
+	if (!args.terse)
+		printf("`-----------------------------------------------------------------------------------------'\n");
+}
+
+/*
+  The --slowest ops of every thread, slowest first, and the --slow-ms
+  ops of all threads in the order they were issued.
+*/
+static void print_slow_results( ThreadTest *d )
+{
+	unsigned long count = 0, dropped = 0;
+	SlowOpRef *refs;
+	int i, j;
+
+	for(i = 0; i < d->numThreads; i++)
+		count += MAX((unsigned long)d->threads[i].slowestCount,
+			     d->threads[i].slowOpsCount);
+
+	refs = malloc(MAX(count, 1) * sizeof(SlowOpRef));
+	if (refs == NULL)
+	{
+		perror("Error malloc()ing slow operation list");
+		return;
+	}
+
+	if (args.slowest)
+	{
+		char title[64];
+
+		count = 0;
+		for(i = 0; i < d->numThreads; i++)
+			for(j = 0; j < d->threads[i].slowestCount; j++)
+			{
+				refs[count].op = &d->threads[i].slowest[j];
+				refs[count++].thread = d->threads[i].myNumber;
+			}
+		qsort(refs, count, sizeof(SlowOpRef), compare_slowest);
+
+		sprintf(title, "Slowest %d operations of every thread", args.slowest);
+		print_slow_ops(title, "slowest", refs, count);
+	}
+
+	if (args.slowMs)
+	{
+		char title[64];
+
+		count = 0;
+		for(i = 0; i < d->numThreads; i++)
+		{
+			for(j = 0; j < d->threads[i].slowOpsCount; j++)
+			{
+				refs[count].op = &d->threads[i].slowOps[j];
+				refs[count++].thread = d->threads[i].myNumber;
+			}
+			dropped += d->threads[i].slowOpsDropped;
+		}
+		qsort(refs, count, sizeof(SlowOpRef), compare_slow_start);
+
+		sprintf(title, "Operations over %g ms", args.slowMs);
+		print_slow_ops(title, "slow", refs, count);
+
+		if (dropped)
+			printf(args.terse ? "slow_dropped:%lu\n" :
+			       "%lu more operations over the latency were not kept\n",
+			       dropped);
+	}
+
+	free(refs);
+}
+
+static double average_latency(const Latencies *lat)
+{
+	return lat->count ? lat->avg / lat->count : 0;
+}
+
+static void print_discard_results( ThreadTest *d, const PhaseTotals *phases )
+{
+	static const char* const opNames[DISCARD_OPS] = {
+		"discard", "mixed_discard", "mixed_write", "mixed_read",
+	};
+	static const char* const opTitles[DISCARD_OPS] = {
+		"Discard", "Mix Discard", "Mix Write", "Mix Read",
+	};
+	/* the random phases the mixed reads and writes compare to */
+	static const int aloneTests[DISCARD_OPS] = {
+		-1, -1, RANDOM_WRITE_TEST, RANDOM_READ_TEST,
+	};
+	struct timeval realtime[2];
+	Latencies lat[DISCARD_OPS];
+	double ops[DISCARD_OPS], mbytes[DISCARD_OPS];
+	double secs[2];
+	int i, op, compared = FALSE;
+
+	memset(realtime, 0, sizeof(realtime));
+	memset(lat, 0, sizeof(lat));
+	memset(ops, 0, sizeof(ops));
+	memset(mbytes, 0, sizeof(mbytes));
+
+	for(i = 0; i < d->numThreads; i++)
+		for(op = 0; op < DISCARD_OPS; op++)
+		{
+			ops[op] += d->threads[i].discardOps[op];
+			mbytes[op] += (double)d->threads[i].discardBytes[op] / MBYTE;
+			merge_latencies(&lat[op], &d->threads[i].discardLatency[op]);
+		}
+
+	add_timer( &realtime[0], &(d->totalTimeDiscard.startRealTime), &(d->totalTimeDiscard.stopRealTime) );
+	add_timer( &realtime[1], &(d->totalTimeMixed.startRealTime), &(d->totalTimeMixed.stopRealTime) );
+	secs[0] = timeval_to_secs(&realtime[0]);
+	secs[1] = timeval_to_secs(&realtime[1]);
+
+	if (args.terse)
+	{
+		for(op = 0; op < DISCARD_OPS; op++)
+			if (lat[op].count)
+				printf("%s:%.5f,%.5f,%.5f,%.5f,%.5f,%.0f\n",
+				       opNames[op], mbytes[op],
+				       secs[op != DISCARD_RANGE],
+				       average_latency(&lat[op]) * 1000,
+				       latency_percentile(&lat[op], 99) * 1000,
+				       lat[op].max * 1000, ops[op]);
+		return;
+	}
+
+	printf("Tiotest discard results (%s):\n",
+	       args.rawDrives ? "BLKDISCARD" : "hole punching");
+
+	printf(",----------------------------------------------------------------------.\n");
+	printf("| Item                  | Ops        | Rate         | Ops/s          |\n");
+	printf("+-----------------------+------------+--------------+----------------+\n");
+
+	for(op = 0; op < DISCARD_OPS; op++)
+	{
+		const double s = secs[op != DISCARD_RANGE];
+
+		if (ops[op])
+			printf("| %-12s %4.0f MBs | %10.0f | %7.3f MB/s | %14.1f |\n",
+			       opTitles[op], mbytes[op], ops[op],
+			       s > 0 ? mbytes[op] / s : 0,
+			       s > 0 ? ops[op] / s : 0);
+	}
+
+	printf("`----------------------------------------------------------------------'\n");
+
+	if (!args.showLatency)
+		return;
+
+	printf("Tiotest discard latency results:\n");
+	printf(",--------------------------------------------------------------------------------.\n");
+	printf("| Item         | Average latency | 50%% latency  | 99%% latency  | Maximum latency |\n");
+	printf("+--------------+-----------------+--------------+--------------+-----------------+\n");
+
+	for(op = 0; op < DISCARD_OPS; op++)
+		if (lat[op].count)
+			printf("| %-12s | %12.3f ms | %9.3f ms | %9.3f ms | %12.3f ms |\n",
+			       opTitles[op], average_latency(&lat[op]) * 1000,
+			       latency_percentile(&lat[op], 50) * 1000,
+			       latency_percentile(&lat[op], 99) * 1000,
+			       lat[op].max * 1000);
+
+	printf("`--------------+-----------------+--------------+--------------+-----------------'\n\n");
+
+	for(op = 0; op < DISCARD_OPS; op++)
+	{
+		const Latencies *alone;
+
+		if (aloneTests[op] < 0 || !lat[op].count ||
+		    !phases[aloneTests[op]].latency.count)
+			continue;
+		alone = &phases[aloneTests[op]].latency;
+
+		if (!compared)
+		{
+			printf("Tiotest latency with discards, random phases alone against the mixed phase:\n");
+			printf(",--------------------------------------------------------------------------------------------------------.\n");
+			printf("| Item         | Avg alone    | Avg mixed    | 99%% alone    | 99%% mixed    | Max alone    | Max mixed    |\n");
+			printf("+--------------+--------------+--------------+--------------+--------------+--------------+--------------+\n");
+			compared = TRUE;
+		}
+
+		printf("| %-12s | %9.3f ms | %9.3f ms | %9.3f ms | %9.3f ms | %9.3f ms | %9.3f ms |\n",
+		       testTitles[aloneTests[op]],
+		       average_latency(alone) * 1000, average_latency(&lat[op]) * 1000,
+		       latency_percentile(alone, 99) * 1000,
+		       latency_percentile(&lat[op], 99) * 1000,
+		       alone->max * 1000, lat[op].max * 1000);
+	}
+
+	if (compared)
+		printf("`--------------+--------------+--------------+--------------+--------------+--------------+--------------'\n\n");
+}
+
+/* the --access patterns in place of the default ones, if any */
+static void print_access_patterns( void )
+{
+	int testCase, shown = 0;
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		const AccessPattern *a = &args.access[testCase];
+
+		if (a->kind < 0)
+			continue;
+
+		printf("%s%s %s", shown++ ? ", " : "Access patterns: ",
+		       testTitles[testCase], accessNames[a->kind]);
+		if (a->kind == ACCESS_STRIDE)
+			printf(" of %lu bytes", a->stride);
+		else if (a->kind == ACCESS_INTERLEAVE)
+			printf(" of %d streams", a->streams);
+	}
+
+	if (shown)
+		printf("\n");
+}
+
+static void print_results( ThreadTest *d )
+{
+	PhaseTotals phases[TEST_COUNT];
+	Latencies total;
+	double avgLat, perc1Lat, perc2Lat;
+	int testCase;
+
+	memset(&total, 0, sizeof(Latencies));
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		sum_phase(d, testCase, &phases[testCase]);
+		merge_latencies(&total, &phases[testCase].latency);
+	}
+
+	latency_shares(&total, &avgLat, &perc1Lat, &perc2Lat);
+
+	if(args.terse)
+	{
+		for(testCase = 0; testCase < TEST_COUNT; testCase++)
+		{
+			const PhaseTotals *p = &phases[testCase];
+			double avg, perc1, perc2;
+
+			latency_shares(&p->latency, &avg, &perc1, &perc2);
+
+			printf("%s:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+			       testNames[testCase], p->mbytes,
+			       timeval_to_secs(&p->realtime),
+			       timeval_to_secs(&p->usrtime)/d->numThreads,
+			       timeval_to_secs(&p->systime)/d->numThreads,
+			       avg*1000, p->latency.max*1000, perc1, perc2 );
+		}
+
+		printf("total:%.5f,%.5f,%.5f,%.5f\n",
+		       avgLat*1000, total.max*1000, perc1Lat, perc2Lat );
+
+		if (args.fsyncOps || args.fsyncBytes || args.flushData)
+			print_flush_results(d);
+
+		if (args.stonewall)
+			print_stonewall_results(d);
+
+		if (args.replace)
+			print_replace_results(d);
+
+		if (args.discard || args.discardMix)
+			print_discard_results(d, phases);
+
+		if (block_dists_used())
+			print_block_size_results(d, phases);
+
+		if (diskStats.count)
+			print_disk_results(phases);
+
+		if (args.amplification)
+			print_amplification_results(phases);
+
+		if (cache_control_used())
+			print_cache_results(phases);
+
+		if (args.perf)
+			print_perf_results(phases);
+
+		if (args.slowest || args.slowMs)
+			print_slow_results(d);
+
+		return;
+	}
+
+	printf("Tiotest results for %d concurrent io %s:\n",
+	       d->numThreads, args.processes ? "processes" : "threads");
+
+	print_access_patterns();
+
+	printf(",----------------------------------------------------------------------.\n");
+	printf("| Item                  | Time     | Rate         | Usr CPU  | Sys CPU |\n");
+	printf("+-----------------------+----------+--------------+----------+---------+\n");
+
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		const PhaseTotals *p = &phases[testCase];
+
+		if (!p->blocks)
+			continue;
+
+		printf("| %s %*.0f MBs | %6.1f s | %7.3f MB/s | %5.1f %%  | %5.1f %% |\n",
+		       testTitles[testCase],
+		       (int)(16 - strlen(testTitles[testCase])), p->mbytes,
+		       timeval_to_secs(&p->realtime),
+		       p->mbytes / timeval_to_secs(&p->realtime),
+		       timeval_percentage_of(&p->usrtime, &p->realtime, d->numThreads),
+		       timeval_percentage_of(&p->systime, &p->realtime, d->numThreads) );
+	}
+
+	printf("`----------------------------------------------------------------------'\n");
+
+	if (args.showLatency)
+	{
+		printf("Tiotest latency results:\n");
+
+		printf(",-------------------------------------------------------------------------.\n");
+		printf("| Item         | Average latency | Maximum latency | %% >%d sec | %% >%d sec |\n", 
+		       LATENCY_STAT1, LATENCY_STAT2);
+		printf("+--------------+-----------------+-----------------+----------+-----------+\n");
+
+		for(testCase = 0; testCase < TEST_COUNT; testCase++)
+		{
+			const PhaseTotals *p = &phases[testCase];
+			double avg, perc1, perc2;
+
+			if (!p->blocks)
+				continue;
+
+			latency_shares(&p->latency, &avg, &perc1, &perc2);
+
+			printf("| %-12s | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
+			       testTitles[testCase], avg*1000,
+			       p->latency.max*1000, perc1, perc2);
+		}
+
+		printf("|--------------+-----------------+-----------------+----------+-----------|\n");
+
+		printf("| Total        | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
+		       avgLat*1000, total.max*1000, perc1Lat, perc2Lat);
+
+		printf("`--------------+-----------------+-----------------+----------+-----------'\n\n");
+
+		if (args.fsyncOps || args.fsyncBytes || args.flushData)
+			print_flush_results(d);
+	}
+
+	if (args.stonewall)
+		print_stonewall_results(d);
+
+	if (args.replace)
+		print_replace_results(d);
+
+	if (args.discard || args.discardMix)
+		print_discard_results(d, phases);
+
+	if (block_dists_used())
+		print_block_size_results(d, phases);
+
+	if (diskStats.count)
+		print_disk_results(phases);
+
+	if (args.amplification)
+		print_amplification_results(phases);
+
+	if (cache_control_used())
+		print_cache_results(phases);
+
+	if (args.perf)
+		print_perf_results(phases);
+
+	if (args.slowest || args.slowMs)
+		print_slow_results(d);
+}
+
+
+static void print_wal_results( ThreadTest *d )
+{
+	struct timeval realtime, usrtime, systime;
+	Latencies records;
+	const Latencies *commits = &walLog.commitLatency;
+	double totalRecords = 0, mbytes = 0, secs, recordRate, batch;
+	int i;
+
+	memset(&realtime, 0, sizeof(struct timeval));
+	memset(&usrtime, 0, sizeof(struct timeval));
+	memset(&systime, 0, sizeof(struct timeval));
+	memset(&records, 0, sizeof(Latencies));
+
+	for(i = 0; i < d->numThreads; i++)
+	{
+		add_timer( &usrtime, &(d->threads[i].walTimings.startUserTime), &(d->threads[i].walTimings.stopUserTime) );
+		add_timer( &systime, &(d->threads[i].walTimings.startSysTime), &(d->threads[i].walTimings.stopSysTime) );
+
+		totalRecords += d->threads[i].walRecords;
+		mbytes += (double)d->threads[i].walBytes / MBYTE;
+		merge_latencies(&records, &d->threads[i].walLatency);
+	}
+
+	add_timer( &realtime, &(d->totalTimeWal.startRealTime), &(d->totalTimeWal.stopRealTime) );
+
+	secs = timeval_to_secs(&realtime);
+	recordRate = secs > 0 ? totalRecords / secs : 0;
+	batch = walLog.commits ? (double)walLog.committedRecords / walLog.commits : 0;
+
+	if (args.terse)
+	{
+		printf("wal:%.0f,%.5f,%.5f,%.5f,%.5f,%lu,%.5f\n",
+		       totalRecords, mbytes, secs,
+		       timeval_to_secs(&usrtime)/d->numThreads,
+		       timeval_to_secs(&systime)/d->numThreads,
+		       walLog.commits, batch);
+		printf("wal_commit:%.5f,%.5f,%.5f,%.5f\n",
+		       commits->count ? commits->avg / commits->count * 1000 : 0,
+		       latency_percentile(commits, 50) * 1000,
+		       latency_percentile(commits, 99) * 1000,
+		       commits->max * 1000);
+		printf("wal_record:%.5f,%.5f,%.5f,%.5f\n",
+		       records.count ? records.avg / records.count * 1000 : 0,
+		       latency_percentile(&records, 50) * 1000,
+		       latency_percentile(&records, 99) * 1000,
+		       records.max * 1000);
+		return;
+	}
+
+	printf("Tiotest write-ahead log results for %d concurrent committers:\n",
+	       d->numThreads);
+
+	printf(",-------------------------------------------------------------------------------.\n");
+	printf("| Records  | Time     | Records/s    | Rate         | Commits  | Records/commit |\n");
+	printf("+----------+----------+--------------+--------------+----------+----------------+\n");
+	printf("| %8.0f | %6.1f s | %12.1f | %7.3f MB/s | %8lu | %14.2f |\n",
+	       totalRecords, secs, recordRate, secs > 0 ? mbytes / secs : 0,
+	       walLog.commits, batch);
+	printf("`-------------------------------------------------------------------------------'\n");
+
+	if (args.showLatency)
+	{
+		printf("Tiotest write-ahead log latency results:\n");
+		printf(",--------------------------------------------------------------------------------.\n");
+		printf("| Item         | Average latency | 50%% latency  | 99%% latency  | Maximum latency |\n");
+		printf("+--------------+-----------------+--------------+--------------+-----------------+\n");
+		printf("| Commit       | %12.3f ms | %9.3f ms | %9.3f ms | %12.3f ms |\n",
+		       commits->count ? commits->avg / commits->count * 1000 : 0,
+		       latency_percentile(commits, 50) * 1000,
+		       latency_percentile(commits, 99) * 1000,
+		       commits->max * 1000);
+		printf("| Record       | %12.3f ms | %9.3f ms | %9.3f ms | %12.3f ms |\n",
+		       records.count ? records.avg / records.count * 1000 : 0,
+		       latency_percentile(&records, 50) * 1000,
+		       latency_percentile(&records, 99) * 1000,
+		       records.max * 1000);
+		printf("`--------------+-----------------+--------------+--------------+-----------------'\n\n");
+	}
+}
+
+
+static void print_replay_results( ThreadTest *d )
+{
+	static const char* const opNames[REPLAY_OPS] = {
+		"read", "write", "fsync",
+	};
+	static const char* const opTitles[REPLAY_OPS] = {
+		"Replay Read", "Replay Write", "Replay Fsync",
+	};
+	struct timeval realtime, usrtime, systime;
+	Latencies lat[REPLAY_OPS];
+	double ops[REPLAY_OPS], mbytes[REPLAY_OPS];
+	double secs;
+	int i, op;
+
+	memset(&realtime, 0, sizeof(struct timeval));
+	memset(&usrtime, 0, sizeof(struct timeval));
+	memset(&systime, 0, sizeof(struct timeval));
+	memset(lat, 0, sizeof(lat));
+	memset(ops, 0, sizeof(ops));
+	memset(mbytes, 0, sizeof(mbytes));
+
+	for(i = 0; i < d->numThreads; i++)
+	{
+		add_timer( &usrtime, &(d->threads[i].replayTimings.startUserTime), &(d->threads[i].replayTimings.stopUserTime) );
+		add_timer( &systime, &(d->threads[i].replayTimings.startSysTime), &(d->threads[i].replayTimings.stopSysTime) );
+
+		for(op = 0; op < REPLAY_OPS; op++)
+		{
+			ops[op] += d->threads[i].replayOps[op];
+			mbytes[op] += (double)d->threads[i].replayBytes[op] / MBYTE;
+			merge_latencies(&lat[op], &d->threads[i].replayLatency[op]);
+		}
+	}
+
+	add_timer( &realtime, &(d->totalTimeReplay.startRealTime), &(d->totalTimeReplay.stopRealTime) );
+	secs = timeval_to_secs(&realtime);
+
+	if (args.terse)
+	{
+		for(op = 0; op < REPLAY_OPS; op++)
+			printf("replay_%s:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.0f\n",
+			       opNames[op], mbytes[op], secs,
+			       timeval_to_secs(&usrtime)/d->numThreads,
+			       timeval_to_secs(&systime)/d->numThreads,
+			       lat[op].count ? lat[op].avg / lat[op].count * 1000 : 0,
+			       lat[op].max * 1000,
+			       latency_percentile(&lat[op], 99) * 1000,
+			       ops[op]);
+		return;
+	}
+
+	printf("Tiotest replay results for %llu operations on %d concurrent io threads:\n",
+	       replay.records, d->numThreads);
+
+	printf(",----------------------------------------------------------------------.\n");
+	printf("| Item                  | Ops        | Rate         | Ops/s          |\n");
+	printf("+-----------------------+------------+--------------+----------------+\n");
+
+	for(op = 0; op < REPLAY_OPS; op++)
+		if (ops[op])
+			printf("| %-12s %4.0f MBs | %10.0f | %7.3f MB/s | %14.1f |\n",
+			       opTitles[op], mbytes[op], ops[op],
+			       secs > 0 ? mbytes[op] / secs : 0,
+			       secs > 0 ? ops[op] / secs : 0);
+
+	printf("`----------------------------------------------------------------------'\n");
+	printf("Replay time %.1f s, usr CPU %.1f %%, sys CPU %.1f %%\n",
+	       secs,
+	       secs > 0 ? timeval_percentage_of(&usrtime, &realtime, d->numThreads) : 0,
+	       secs > 0 ? timeval_percentage_of(&systime, &realtime, d->numThreads) : 0);
+
+	if (!args.showLatency)
+		return;
+
+	printf("Tiotest replay latency results:\n");
+	printf(",--------------------------------------------------------------------------------.\n");
+	printf("| Item         | Average latency | 50%% latency  | 99%% latency  | Maximum latency |\n");
+	printf("+--------------+-----------------+--------------+--------------+-----------------+\n");
+
+	for(op = 0; op < REPLAY_OPS; op++)
+		if (lat[op].count)
+			printf("| %-12s | %12.3f ms | %9.3f ms | %9.3f ms | %12.3f ms |\n",
+			       opTitles[op] + strlen("Replay "),
+			       lat[op].avg / lat[op].count * 1000,
+			       latency_percentile(&lat[op], 50) * 1000,
+			       latency_percentile(&lat[op], 99) * 1000,
+			       lat[op].max * 1000);
+
+	printf("`--------------+-----------------+--------------+--------------+-----------------'\n\n");
+}
+
+static void print_knee_results( ThreadTest *d )
+{
+	const KneeStep *k = &knee.steps[knee.knee];
+	int i;
+
+	if (knee.count == 0)
+		return;
+
+	if (args.terse)
+	{
+		for(i = 0; i < knee.count; i++)
+		{
+			const KneeStep *step = &knee.steps[i];
+
+			printf("knee_step:%d,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+			       step->threads, step->mbytes, step->secs,
+			       step->secs > 0 ? step->mbytes / step->secs : 0,
+			       step_iops(step), step->avg * 1000,
+			       step->p99 * 1000, step->max * 1000);
+		}
+
+		printf("knee:%d,%.5f,%.5f,%.5f\n", k->threads, step_iops(k),
+		       k->secs > 0 ? k->mbytes / k->secs : 0, k->p99 * 1000);
+		return;
+	}
+
+	printf("Tiotest saturation results for %s:\n", testTitles[args.kneeTest]);
+	printf(",---------------------------------------------------------------------------------------------.\n");
+	printf("| Threads | Time     | Rate         | IOPS       | Avg latency  | 99%% latency  | Max latency  |\n");
+	printf("+---------+----------+--------------+------------+--------------+--------------+--------------+\n");
+
+	for(i = 0; i < knee.count; i++)
+	{
+		const KneeStep *step = &knee.steps[i];
+
+		printf("| %7d | %6.1f s | %7.3f MB/s | %10.1f | %9.3f ms | %9.3f ms | %9.3f ms |\n",
+		       step->threads, step->secs,
+		       step->secs > 0 ? step->mbytes / step->secs : 0,
+		       step_iops(step), step->avg * 1000,
+		       step->p99 * 1000, step->max * 1000);
+	}
+
+	printf("`---------+----------+--------------+------------+--------------+--------------+--------------'\n");
+	printf("Knee at %d threads: %.1f IOPS, %.3f MB/s, 99%% latency %.3f ms (%s)\n\n",
+	       k->threads, step_iops(k), k->secs > 0 ? k->mbytes / k->secs : 0,
+	       k->p99 * 1000, knee.reason);
+}
+
+static void print_steady_results( void )
+{
+	const int n = args.steadyWindow;
+	int i;
 
-		while(io_ops--)
+	if (args.terse)
+	{
+		for(i = 0; i < steady.count; i++)
 		{
-			struct timeval tv_start, tv_stop;
-			int ret;
+			const SteadyRound *r = &steady.rounds[i];
 
-			current_offset = (*offset_func)(current_offset, d, &(seed));
+			printf("steady_window:%d,%.5f,%.5f,%.5f\n", i + 1,
+			       r->windowAvg, r->range, r->excursion);
+		}
 
-			gettimeofday(&tv_start, NULL);
-			ret = (*io_func)(fd, current_offset, d);
-			if(ret != 0)
-				exit(ret);
+		if (steady.reached >= 0)
+			printf("steady:1,%d,%.5f\n", steady.reached + 1,
+			       steady.rounds[steady.reached].windowAvg);
+		else
+			printf("steady:0,%d,0\n", steady.count);
+		return;
+	}
 
-			gettimeofday(&tv_stop, NULL);
-			update_latency_info(latencies, tv_start, tv_stop);
+	printf("Tiotest steady state results (%d second rounds, window of %d):\n",
+	       args.steadyTime, n);
+	printf(",------------------------------------------------------------------------------------------.\n");
+	printf("| Round | Rate         | IOPS       | 99%% latency  | Window IOPS | Range     | Slope     |\n");
+	printf("+-------+--------------+------------+--------------+-------------+-----------+-----------+\n");
+
+	for(i = 0; i < steady.count; i++)
+	{
+		const SteadyRound *r = &steady.rounds[i];
+
+		printf("| %5d | %7.3f MB/s | %10.1f | %9.3f ms |", i + 1,
+		       r->secs > 0 ? r->mbytes / r->secs : 0, round_iops(r),
+		       r->p99 * 1000);
+		if (i + 1 >= n)
+			printf(" %11.1f | %7.1f %% | %7.1f %% |\n", r->windowAvg,
+			       r->range, r->excursion);
+		else
+			printf(" %11s | %9s | %9s |\n", "-", "-", "-");
+	}
+
+	printf("`------------------------------------------------------------------------------------------'\n");
+
+	if (steady.reached >= 0)
+		printf("Steady state in rounds %d-%d: %.1f IOPS, range %.1f %% (max %.0f %%), slope %.1f %% (max %.0f %%)\n\n",
+		       steady.reached - n + 2, steady.reached + 1,
+		       steady.rounds[steady.reached].windowAvg,
+		       steady.rounds[steady.reached].range, args.steadyBand,
+		       steady.rounds[steady.reached].excursion, args.steadySlope);
+	else
+		printf("No steady state after %d rounds, the tests run anyway\n\n",
+		       steady.count);
+}
+
+static void print_job_line( const char *name, const char *stage, int threads,
+			    const JobTotals *t )
+{
+	const double rate = t->secs > 0 ? t->mbytes / t->secs : 0;
+	const double iops = t->secs > 0 ? t->ops / t->secs : 0;
+	const double avg = t->latency.count ? t->latency.avg / t->latency.count : 0;
+
+	if (args.terse)
+		printf("job_%s:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+		       name, t->mbytes, t->secs, rate, iops, avg * 1000,
+		       latency_percentile(&t->latency, 99) * 1000,
+		       t->latency.max * 1000);
+	else
+		printf("| %-12.12s | %5s | %7d | %6.1f s | %7.3f MB/s | %10.1f | %9.3f ms | %9.3f ms | %9.3f ms |\n",
+		       name, stage, threads, t->secs, rate, iops, avg * 1000,
+		       latency_percentile(&t->latency, 99) * 1000,
+		       t->latency.max * 1000);
+}
+
+static void print_job_results( ThreadTest *d )
+{
+	JobTotals total;
+	int i, stage;
+
+	memset(&total, 0, sizeof(JobTotals));
+
+	if (!args.terse)
+	{
+		printf("Tiotest job results for %d groups:\n", jobs.count);
+		printf(",----------------------------------------------------------------------------------------------------------------------.\n");
+		printf("| Group        | Stage | Threads | Time     | Rate         | IOPS       | Avg latency  | 99%% latency  | Max latency  |\n");
+		printf("+--------------+-------+---------+----------+--------------+------------+--------------+--------------+--------------+\n");
+	}
+
+	for(i = 0; i < jobs.count; i++)
+	{
+		const JobGroup *g = &jobs.groups[i];
+		char stage[16];
+		JobTotals t;
+
+		sprintf(stage, "%d", g->stage);
+		sum_job_threads(d, g->firstThread, g->numThreads, &t);
+		print_job_line(g->name, stage, g->numThreads, &t);
+	}
+
+	if (!args.terse)
+		printf("|--------------+-------+---------+----------+--------------+------------+--------------+--------------+--------------|\n");
+
+	for(stage = 0; stage < jobs.stagesCount; stage++)
+	{
+		JobTotals t;
+		char name[JOB_NAME_LENGTH], number[16];
+		int first = -1, threads = 0;
+
+		for(i = 0; i < jobs.count; i++)
+		{
+			const JobGroup *g = &jobs.groups[i];
+
+			if (g->stage != jobs.stages[stage])
+				continue;
+			if (first < 0)
+				first = g->firstThread;
+			threads += g->numThreads;
 		}
 
-		(*blockCount) += orig_iops; // take this out of the for loop, we don't handle errors that well
+		sum_job_threads(d, first, threads, &t);
+
+		total.mbytes += t.mbytes;
+		total.ops += t.ops;
+		total.secs += t.secs;
+		merge_latencies(&total.latency, &t.latency);
+
+		if (jobs.stagesCount > 1)
+		{
+			sprintf(name, args.terse ? "stage%d" : "Stage %d",
+				jobs.stages[stage]);
+			sprintf(number, "%d", jobs.stages[stage]);
+			print_job_line(name, number, threads, &t);
+		}
 	}
 
-	fsync(fd);
+	print_job_line(args.terse ? "total" : "Total", "", d->numThreads, &total);
 
-	close(fd);
+	if (!args.terse)
+		printf("`--------------+-------+---------+----------+--------------+------------+--------------+--------------+--------------'\n\n");
+
+	if (!block_dists_used())
+		return;
+
+	print_block_size_header();
+
+	for(i = 0; i < jobs.count; i++)
+	{
+		const JobGroup *g = &jobs.groups[i];
+		JobTotals t;
+
+		if (g->blockDist.count == 0)
+			continue;
+
+		sum_job_threads(d, g->firstThread, g->numThreads, &t);
+		print_block_size_lines(d, g->name, &g->blockDist, g->firstThread,
+				       g->numThreads, g->testCase, t.secs);
+	}
+
+	print_block_size_footer();
+}
+
+/*
+ * p{write,read} functions
+ */
+
+//
+// define functions to get the next offset for the next I/O operation
+//
+
+/* with mixed block sizes every operation is aligned to its own size */
+static TIO_off_t get_sequential_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
+{
+	const TIO_off_t next = current_offset + d->lastIoSize - d->fileOffset;
+
+	return d->fileOffset + (next + d->ioSize - 1) / d->ioSize * d->ioSize;
+}
+
+static TIO_off_t get_random_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
+{
+	TIO_off_t blocks=(d->fileSizeInMBytes*MBYTE/d->ioSize);
+	TIO_off_t offset = get_random_number(blocks, seed) * d->ioSize;
+
+	return d->fileOffset + offset;
+}
+
+/*
+  The other --access patterns work on offsets relative to the start of
+  an area of bytes, in steps of size and wrapping around to its start.
+  Before the first op of a phase the offset is negative. Every pattern
+  visits each block once before wrapping, like the sequential one.
+*/
+static TIO_off_t reverse_step(TIO_off_t rel, TIO_off_t bytes, unsigned long size)
+{
+	bytes = bytes / size * size;
+
+	return rel < (TIO_off_t)size ? bytes - size : rel - size;
+}
+
+/* blocks stride apart, each pass starting a block after the last one */
+static TIO_off_t stride_step(TIO_off_t rel, TIO_off_t bytes, unsigned long size,
+			     unsigned long stride)
+{
+	TIO_off_t next;
+
+	stride = MAX(stride / size, 1) * size;
+	bytes = bytes / size * size;
+
+	if (rel < 0)
+		return 0;
+	if (rel + stride + size <= bytes)
+		return rel + stride;
+
+	next = rel % stride + size;
+	return next < stride && next + size <= bytes ? next : 0;
+}
+
+/*
+  streams sequential readers of consecutive regions of the area, one op
+  of every stream in turn
+*/
+static TIO_off_t interleave_step(TIO_off_t rel, TIO_off_t bytes, unsigned long size,
+				 int streams)
+{
+	const TIO_off_t region = (bytes / size + streams - 1) / streams * size;
+	TIO_off_t position;
+	int stream;
+
+	bytes = bytes / size * size;
+
+	/* files smaller than one block have no regions, stay at the start */
+	if (rel < 0 || region == 0)
+		return 0;
+
+	stream = rel / region;
+	position = rel % region;
+
+	/* the last region can be short, its missing blocks are skipped */
+	while (1)
+	{
+		if (++stream == streams)
+		{
+			stream = 0;
+			position += size;
+			if (position >= region)
+				return 0;
+		}
+		if (stream * region + position + size <= bytes)
+			return stream * region + position;
+	}
+}
+
+static TIO_off_t get_reverse_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
+{
+	return d->fileOffset + reverse_step(current_offset - d->fileOffset,
+					    (TIO_off_t)d->fileSizeInMBytes * MBYTE, d->ioSize);
+}
+
+static TIO_off_t get_strided_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
+{
+	return d->fileOffset + stride_step(current_offset - d->fileOffset,
+					   (TIO_off_t)d->fileSizeInMBytes * MBYTE, d->ioSize,
+					   d->access->stride);
+}
+
+static TIO_off_t get_interleaved_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
+{
+	return d->fileOffset + interleave_step(current_offset - d->fileOffset,
+					       (TIO_off_t)d->fileSizeInMBytes * MBYTE, d->ioSize,
+					       d->access->streams);
+}
+
+//
+// define READ/WRITE operations on file descriptors
+//
+
+static int do_pread_operation(int fd, TIO_off_t offset, ThreadData *d)
+{
+	ssize_t rc = TIO_pread( fd, d->buffer, d->ioSize, offset );
+	if( rc != d->ioSize ) {
+		if( rc == -1 ) {
+			perror("Error " xstr(TIO_pread) "()ing to file");
+		} else {
+			fprintf(stderr, "Tried to read %ld bytes from offset " OFFSET_FORMAT " of file %s of length " OFFSET_FORMAT ", but only read %d bytes\n", d->ioSize, offset, d->fileName, d->fileSizeInMBytes*MB, rc);
+		}
+
+		return -1;
+	}
+	else {
+		if( args.consistencyCheckData )
+		{
+			const unsigned crc = crc32(d->buffer, d->blockSize, 0);
 
-	timer_stop( timings );
+			if(crc != d->bufferCrc)
+			{
+				fprintf(stderr, "Thread(%lu) consistency check failed at offset %Lu\n", d->myNumber, (long long unsigned int)offset);
+				return -1;
+			}
+		}
+	}
 
 	return 0;
 }
 
-static unsigned long get_number_of_blocks(ThreadData *d)
+static int do_pwrite_operation(int fd, TIO_off_t offset, ThreadData *d)
 {
-	return (d->fileSizeInMBytes * MB) / d->blockSize;
+	ssize_t rc = TIO_pwrite( fd, d->buffer, d->ioSize, offset );
+	if( rc  != d->ioSize ) {
+		if( rc == -1 ) {
+			perror("Error " xstr(TIO_pwrite) "()ing to file");
+		} else {
+			fprintf(stderr, "Tried to write %ld bytes from offset " OFFSET_FORMAT " of file %s of length " OFFSET_FORMAT ", but only wrote %d bytes\n", d->ioSize, offset, d->fileName, d->fileSizeInMBytes*MB, rc);
+		}
+		return -1;
+	}
+
+	return 0;
 }
 
-static void do_read_test( ThreadData *d )
+/*
+ * MMAP functions
+ */
+
+// 
+// define functions to get the next memory location for the next mmap operation
+//
+
+static void *get_sequential_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
 {
-	t_log(LEVEL_INFO, "Doing sequential read test");
-	do_generic_test(do_pread_operation, do_mmap_read_operation,
-			get_sequential_offset, get_sequential_loc,
-			d, &(d->readTimings), &(d->readLatency),
-			MADV_SEQUENTIAL, &(d->blocksRead), get_number_of_blocks(d));
+	// wraps around for --access sequential phases of more ops than blocks
+	TIO_off_t max_bytes = MIN(MMAP_CHUNK_SIZE, d->fileSizeInMBytes*MBYTE);
+
+	if (current_loc + 2 * d->blockSize > base_loc + max_bytes)
+		return base_loc;
+
+	return current_loc + d->blockSize;
 }
 
-static void do_write_test( ThreadData *d )
+static void *get_random_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
 {
-	t_log(LEVEL_INFO, "Doing sequential write test");
-	do_generic_test(do_pwrite_operation, do_mmap_write_operation,
-			get_sequential_offset, get_sequential_loc,
-			d, &(d->writeTimings), &(d->writeLatency),
-			MADV_SEQUENTIAL, &(d->blocksWritten), get_number_of_blocks(d));
+	// limit ourselves to a single (the current) mmap chunk for now, just easier
+	TIO_off_t max_bytes = MIN(MMAP_CHUNK_SIZE, d->fileSizeInMBytes*MBYTE);
+	TIO_off_t blocks    = (max_bytes/d->blockSize);
+	TIO_off_t offset    = get_random_number(blocks, seed) * d->blockSize;
+
+	return base_loc + offset;
 }
 
-static void do_random_read_test( ThreadData *d )
+// like get_random_loc() these stay in the current mmap chunk
+static void *get_reverse_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
 {
-	t_log(LEVEL_INFO, "Doing random read test");
-	do_generic_test(do_pread_operation, do_mmap_read_operation,
-			get_random_offset, get_random_loc,
-			d, &(d->randomReadTimings), &(d->randomReadLatency),
-			MADV_RANDOM, &(d->blocksRandomRead), d->numRandomOps);
+	return base_loc + reverse_step(current_loc - base_loc,
+				       MIN(MMAP_CHUNK_SIZE, d->fileSizeInMBytes*MBYTE),
+				       d->blockSize);
 }
 
-static void do_random_write_test( ThreadData *d )
+static void *get_strided_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
 {
-	t_log(LEVEL_INFO, "Doing random write test");
-	do_generic_test(do_pwrite_operation, do_mmap_write_operation,
-			get_random_offset, get_random_loc,
-			d, &(d->randomWriteTimings), &(d->randomWriteLatency),
-			MADV_RANDOM, &(d->blocksRandomWritten), d->numRandomOps);
+	return base_loc + stride_step(current_loc - base_loc,
+				      MIN(MMAP_CHUNK_SIZE, d->fileSizeInMBytes*MBYTE),
+				      d->blockSize, d->access->stride);
 }
 
-static const TestFunc Tests[] = {
-    do_write_test,
-    do_random_write_test,
-    do_read_test,
-    do_random_read_test,
-};
+static void *get_interleaved_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
+{
+	return base_loc + interleave_step(current_loc - base_loc,
+					  MIN(MMAP_CHUNK_SIZE, d->fileSizeInMBytes*MBYTE),
+					  d->blockSize, d->access->streams);
+}
 
-static void initialize_test( ThreadTest *d )
+//
+// define functions to perform the next mmap-based read or write
+//
+
+static int do_mmap_read_operation(void *loc, ThreadData *d)
 {
-	int i;
-	int pathLoadBalIdx = 0;
-	TIO_off_t offs, cur_offs[KBYTE] = {0};
+	memcpy(d->buffer, loc, d->blockSize);
+
+	if( args.consistencyCheckData )
+	{
+		const unsigned crc = crc32(d->buffer, d->blockSize, 0);
+
+		if(crc != d->bufferCrc)
+		{
+			fprintf(stderr, "Thread(%lu) mmap consistency check failed at 0x%p\n", d->myNumber, loc);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int do_mmap_write_operation(void *loc, ThreadData *d)
+{
+	memcpy(loc, d->buffer, d->blockSize);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+/* compares the whole token whatever the first difference */
+static int token_matches(const char *a, const char *b)
+{
+	size_t i, la = strlen(a), lb = strlen(b);
+	unsigned char diff = la != lb;
+
+	for(i = 0; i < la; i++)
+		diff |= a[i] ^ (i < lb ? b[i] : 0);
+
+	return diff == 0;
+}
+
+/*
+  --agent: serves controllers one connection at a time per worker. The
+  listening process never returns; every connection is handled by a
+  forked worker, which returns with the arguments of the controller to
+  run the tests with them once the controller gave the token.
+*/
+static void serve_agent( int *argc, char ***argv )
+{
+	const char *bind_address = args.agentBind[0] ? args.agentBind : DEFAULT_AGENT_BIND;
+	struct addrinfo hints, *res, *ai;
+	char *line = NULL, **agentArgv;
+	size_t size = 0;
+	int fd = -1, conn, count = 1, one = 1;
+	pid_t pid;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if ((conn = getaddrinfo(bind_address, args.agentPort, &hints, &res)))
+	{
+		fprintf(stderr, "%s port %s: %s\n", bind_address, args.agentPort,
+			gai_strerror(conn));
+		exit(1);
+	}
+
+	for(ai = res; ai; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, MAX_AGENTS) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not listen on %s port %s: %s\n", bind_address,
+			args.agentPort, strerror(errno));
+		exit(1);
+	}
+
+	printf("Agent listening on %s port %s\n", bind_address, args.agentPort);
+	fflush(stdout);
+
+	/* nobody waits for the workers */
+	signal(SIGCHLD, SIG_IGN);
+
+	for(;;)
+	{
+		conn = accept(fd, NULL, NULL);
+		if (conn < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("Error from accept()");
+			exit(1);
+		}
+
+		pid = fork();
+		if (pid == 0)
+			break;
+		if (pid < 0)
+			perror("Error from fork()");
+		close(conn);
+	}
 
-	assert(TEST_COUNT == (sizeof(Tests)/sizeof(TestFunc)));
+	close(fd);
+	signal(SIGCHLD, SIG_DFL);
 
-	memset( d, 0, sizeof(ThreadTest) );
+	agentLink.in = fdopen(conn, "r");
+	agentLink.out = fdopen(dup(conn), "w");
+	if (agentLink.in == NULL || agentLink.out == NULL)
+	{
+		perror("Error opening the controller connection");
+		exit(1);
+	}
 
-	d->numThreads = args.numThreads;
+	fprintf(agentLink.out, "tiotest agent %d\n", AGENT_PROTOCOL);
+	fflush(agentLink.out);
 
-	d->threads = calloc( d->numThreads, sizeof(ThreadData) );
-	if( d->threads == NULL )
+	if (read_protocol_line(agentLink.in, &line, &size) == NULL ||
+	    strncmp(line, "token ", 6) != 0 ||
+	    !token_matches(line + 6, args.agentToken))
 	{
-		perror("Error calloc()ing thread data memory");
-		exit(-1);
+		fprintf(stderr, "Refused a controller without the agent token\n");
+		exit(1);
 	}
+	fprintf(agentLink.out, "ok\n");
+	fflush(agentLink.out);
 
-	/* Initializing thread data */
-	if (args.rawDrives)
+	agentArgv = malloc(2 * sizeof(char *));
+	agentArgv[0] = (*argv)[0];
+
+	while (read_protocol_line(agentLink.in, &line, &size))
 	{
-		if (args.threadOffset != 0)
+		if (strcmp(line, "run") == 0)
 		{
-			offs = (args.threadOffset + args.fileSizeInMBytes) * MBYTE;
-			if (args.useThreadOffsetForFirstThread)
-			{
-				int k;
-				for(k = 0; k < KBYTE; k++)
-					cur_offs[k] = (TIO_off_t)args.threadOffset * MBYTE;
-			}
+			agentArgv[count] = NULL;
+			*argc = count;
+			*argv = agentArgv;
+			free(line);
+			return;
 		}
-		else
-			offs = (TIO_off_t)args.fileSizeInMBytes * MBYTE;
-	}
-	else
-		offs = 0;
 
-	for(i = 0; i < d->numThreads; i++)
-	{
-		d->threads[i].myNumber = i;
-		d->threads[i].blockSize = args.blockSize;
-		d->threads[i].numRandomOps = args.numRandomOps;
-		d->threads[i].fileSizeInMBytes = args.fileSizeInMBytes;
-		if (args.rawDrives)
+		if (strncmp(line, "arg ", 4) == 0)
 		{
-			d->threads[i].fileOffset = cur_offs[pathLoadBalIdx];
-			cur_offs[pathLoadBalIdx] += offs;
-			sprintf(d->threads[i].fileName, "%s",
-				args.path[pathLoadBalIdx++]);
+			agentArgv = realloc(agentArgv, (count + 2) * sizeof(char *));
+			agentArgv[count++] = strdup(line + 4);
 		}
-		else
+		else if (sscanf(line, "agent %d", &agentLink.number) != 1)
 		{
-			d->threads[i].fileOffset = 0;
-			sprintf(d->threads[i].fileName, "%s/_tiotest_pid%d.thr%d",
-				args.path[pathLoadBalIdx++], (int) getpid(), i);
+			fprintf(stderr, "Unexpected \"%s\" from the controller\n", line);
+			exit(1);
 		}
+	}
 
-		if( pathLoadBalIdx >= args.pathsCount )
-			pathLoadBalIdx = 0;
+	fprintf(stderr, "The controller went away before the run\n");
+	exit(1);
+}
 
-		pthread_attr_init( &(d->threads[i].thread_attr) );
+/* sends what every phase did to the controller */
+static void agent_report( ThreadTest *d )
+{
+	int testCase, i;
 
-		pthread_attr_setscope(&(d->threads[i].thread_attr),
-				      PTHREAD_SCOPE_SYSTEM);
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
+	{
+		PhaseTotals p;
+
+		sum_phase(d, testCase, &p);
+		if (!p.blocks)
+			continue;
+
+		fprintf(agentLink.out, "phase %s %.0f %.6f %.6f %.9g %.9g %lu %lu %lu",
+			testNames[testCase], p.blocks, p.mbytes,
+			timeval_to_secs(&p.realtime), p.latency.avg, p.latency.max,
+			p.latency.count, p.latency.count1, p.latency.count2);
+		for(i = 0; i < LATENCY_BUCKETS; i++)
+			if (p.latency.hist[i])
+				fprintf(agentLink.out, " %d:%lu", i, p.latency.hist[i]);
+		fprintf(agentLink.out, "\n");
+	}
 
-		d->threads[i].buffer = tt_aligned_alloc( d->threads[i].blockSize );
+	fprintf(agentLink.out, "done\n");
+	fflush(agentLink.out);
+}
 
-		if( args.consistencyCheckData )
-		{
-			int j;
-			const unsigned long bsize = d->threads[i].blockSize;
-			unsigned char *b = d->threads[i].buffer;
+static void connect_agent( ClusterAgent *a )
+{
+	struct addrinfo hints, *res, *ai;
+	char *line = NULL;
+	size_t size = 0;
+	int fd = -1, err, version;
 
-			for(j = 0; j < bsize; j++)
-			{
-				b[j] = rand() & 0xFF;
-			}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
 
-			d->threads[i].bufferCrc = crc32(b, bsize, 0);
-		}
+	if ((err = getaddrinfo(a->host, a->port, &hints, &res)))
+	{
+		fprintf(stderr, "Agent %s:%s: %s\n", a->host, a->port, gai_strerror(err));
+		exit(1);
 	}
-}
 
-static void cleanup_test( ThreadTest *d )
-{
-	int i;
+	for(ai = res; ai; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
 
-	for(i = 0; i < d->numThreads; i++)
+	if (fd < 0)
 	{
-		if (!args.rawDrives)
-			unlink(d->threads[i].fileName);
-		tt_aligned_free( (char *)d->threads[i].buffer, d->threads[i].blockSize );
-		d->threads[i].buffer = 0;
+		fprintf(stderr, "Could not connect to agent %s:%s: %s\n",
+			a->host, a->port, strerror(errno));
+		exit(1);
+	}
 
-		pthread_attr_destroy( &(d->threads[i].thread_attr) );
+	a->in = fdopen(fd, "r");
+	a->out = fdopen(dup(fd), "w");
+	if (a->in == NULL || a->out == NULL)
+	{
+		perror("Error opening an agent connection");
+		exit(1);
+	}
+
+	if (read_protocol_line(a->in, &line, &size) == NULL ||
+	    sscanf(line, "tiotest agent %d", &version) != 1 ||
+	    version != AGENT_PROTOCOL)
+	{
+		fprintf(stderr, "%s:%s is not a tiotest agent of this version\n",
+			a->host, a->port);
+		exit(1);
 	}
 
-	free(d->threads);
+	fprintf(a->out, "token %s\n", args.agentToken);
+	fflush(a->out);
 
-	d->threads = 0;
+	if (read_protocol_line(a->in, &line, &size) == NULL || strcmp(line, "ok") != 0)
+	{
+		fprintf(stderr, "Agent %s:%s refused the token\n", a->host, a->port);
+		exit(1);
+	}
+	free(line);
 }
 
-static void wait_for_threads( ThreadTest *d )
+/*
+  An --agent keeps to the directories it was started with: a controller
+  gets no raw devices and no directories outside them. Options that
+  reach the whole host, a memory cgroup, locked memory or dropping the
+  page cache, it only takes if it was started with them itself.
+*/
+static void save_agent_limits( void )
 {
+	char resolved[PATH_MAX];
 	int i;
 
-	for(i = 0; i < d->numThreads; i++)
-		pthread_join(d->threads[i].thread, NULL);
-}
+	agentLink.memLimit = args.memLimit != 0;
+	agentLink.mlock = args.mlockBytes != 0;
+	agentLink.pageCache = args.pageCache != 0;
+	agentLink.flushCaches = args.flushCaches;
 
-static void* start_proc( void *data )
-{
-	StartData *sd = (StartData*)data;
-	*sd->child_status = getpid();
-	if (sd->pstart != NULL)
-		while (*sd->pstart == 0) sleep(0);
-	sd->fn(sd->d);
-	return NULL;
+	for(i = 0; i < args.pathsCount; i++)
+	{
+		if (realpath(args.path[i], resolved) == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", args.path[i], strerror(errno));
+			exit(1);
+		}
+		if (strlen(resolved) >= KBYTE)
+		{
+			fprintf(stderr, "%s: path too long\n", resolved);
+			exit(1);
+		}
+		strcpy(agentLink.dirs[agentLink.dirsCount++], resolved);
+	}
 }
 
-static void do_test( ThreadTest *test, int testCase, int sequential,
-					 struct tt_rusage *t, char *debugMessage )
+static void check_agent_request( void )
 {
-	int i;
-	volatile int *child_status;
-	StartData *sd;
-	int synccount;
-	volatile int start = 0;
-
-	assert(testCase < TEST_COUNT);
+	char resolved[PATH_MAX];
+	int i, j;
 
-	child_status = (volatile int *)calloc(test->numThreads, sizeof(int));
-	if (child_status == NULL)
+	if (args.rawDrives)
 	{
-		perror("Error calloc()ing thread status memory");
-		return;
+		fprintf(stderr, "Agents do not take -R from controllers\n");
+		exit(1);
 	}
 
-	sd = (StartData*)calloc(test->numThreads, sizeof(StartData));
-	if (sd == NULL)
+	if ((args.memLimit && !agentLink.memLimit) ||
+	    (args.mlockBytes && !agentLink.mlock) ||
+	    (args.pageCache && !agentLink.pageCache) ||
+	    (args.flushCaches && !agentLink.flushCaches))
 	{
-		perror("Error calloc()ing thread start data memory");
-		free((int*)child_status);
-		return;
+		fprintf(stderr, "Agents only take --mem-limit, --mlock, --page-cache and -F from controllers if started with them\n");
+		exit(1);
 	}
 
-	if (sequential)
-		timer_start(t);
-
-	for(i = 0; i < test->numThreads; i++)
+	for(i = 0; i < args.pathsCount; i++)
 	{
-		sd[i].child_status = &child_status[i];
-		sd[i].fn = Tests[testCase];
-		sd[i].d = &test->threads[i];
-		if (sequential)
-			sd[i].pstart = NULL;
-		else
-			sd[i].pstart = &start;
-		if( pthread_create(
-				&(test->threads[i].thread),
-				&(test->threads[i].thread_attr),
-				start_proc,
-				(void *)&sd[i]))
-		{
-			perror("Error from pthread_create()");
-			free((int*)child_status);
-			free(sd);
-			exit(-1);
-		}
-
-		if(sequential)
+		if (realpath(args.path[i], resolved) == NULL)
 		{
-			t_log(LEVEL_INFO,"Waiting previous thread to finish before starting a new one");
-			pthread_join(test->threads[i].thread, NULL);
+			fprintf(stderr, "%s: %s\n", args.path[i], strerror(errno));
+			exit(1);
 		}
-	}
 
-	if(sequential)
-		timer_stop(t);
-	else
-	{
-		struct timeval tv1, tv2;
-		gettimeofday(&tv1, NULL);
-		do
+		for(j = 0; j < agentLink.dirsCount; j++)
 		{
-			synccount = 0;
-			for(i = 0; i < test->numThreads; i++)
-				if (child_status[i])
-					synccount++;
-			if (synccount == test->numThreads)
+			const char *dir = agentLink.dirs[j];
+			const size_t len = strlen(dir);
+
+			if (strncmp(resolved, dir, len) == 0 &&
+			    (resolved[len] == 0 || resolved[len] == '/' || dir[len - 1] == '/'))
 				break;
-			sleep(1);
-			gettimeofday(&tv2, NULL);
-		} while ((tv2.tv_sec - tv1.tv_sec) < 30);
+		}
 
-		if (synccount != test->numThreads)
+		if (j == agentLink.dirsCount)
 		{
-			fprintf(stderr, "Unable to start %d threads (started %d)\n", 
-					test->numThreads, synccount);
-			start = 1;
-			wait_for_threads(test);
-			free((int*)child_status);
-			free(sd);
-			return;
+			fprintf(stderr, "Agents only use their own -d directories, not %s\n",
+				args.path[i]);
+			exit(1);
 		}
+	}
+}
 
-		t_log(LEVEL_INFO, "Created threads");
-
-		timer_start(t);
-
-		start = 1;
+/* host:port[,host:port...], hosts of IPv6 addresses in brackets */
+static void parse_agents( const char *list )
+{
+	char *copy = strdup(list), *save = NULL, *item;
 
-		t_log(LEVEL_INFO, "Waiting threads");
+	for(item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save))
+	{
+		ClusterAgent *a = &cluster.agents[cluster.count];
+		char *port = strrchr(item, ':');
 
-		wait_for_threads(test);
+		if (port == NULL || port == item || !port[1] || cluster.count == MAX_AGENTS)
+		{
+			fprintf(stderr, "Wrong agent %s (host:port, at most " xstr(MAX_AGENTS) ")\n", item);
+			exit(1);
+		}
+		*port++ = 0;
+		if (item[0] == '[' && port[-2] == ']')
+		{
+			port[-2] = 0;
+			item++;
+		}
 
-		timer_stop(t);
+		snprintf(a->host, sizeof(a->host), "%s", item);
+		snprintf(a->port, sizeof(a->port), "%s", port);
+		cluster.count++;
 	}
-	free((int*)child_status);
-
-	free(sd);
 
-	t_log(LEVEL_INFO, "Done!");
+	free(copy);
 }
 
-static void do_tests( ThreadTest *thisTest )
+static int test_by_name( const char *name )
 {
-	struct tt_rusage *timeWrite       = &(thisTest->totalTimeWrite);
-	struct tt_rusage *timeRandomWrite = &(thisTest->totalTimeRandomWrite);
-	struct tt_rusage *timeRead        = &(thisTest->totalTimeRead);
-	struct tt_rusage *timeRandomRead  = &(thisTest->totalTimeRandomRead);
-
-	timer_init( timeWrite );
-	timer_init( timeRandomWrite );
-	timer_init( timeRead );
-	timer_init( timeRandomRead );
+	int i;
 
-	/*
-	  Write testing
-	*/
-	if (args.testsToRun[WRITE_TEST])
-		do_test( thisTest, WRITE_TEST, args.sequentialWriting,
-				 timeWrite,  "Waiting write threads to finish...");
+	for(i = 0; i < TEST_COUNT; i++)
+		if (strcmp(testNames[i], name) == 0)
+			return i;
+	return -1;
+}
 
-	/*
-	  RandomWrite testing
-	*/
-	if (args.testsToRun[RANDOM_WRITE_TEST])
-		do_test( thisTest, RANDOM_WRITE_TEST, FALSE, timeRandomWrite,
-				 "Waiting random write threads to finish...");
+static void parse_agent_phase( ClusterAgent *a, const char *line )
+{
+	char name[32];
+	AgentPhase p;
+	int testCase, n, bucket;
+	unsigned long count;
+
+	memset(&p, 0, sizeof(p));
+
+	if (sscanf(line, "phase %31s %lu %lf %lf %lf %lf %lu %lu %lu%n",
+		   name, &p.blocks, &p.mbytes, &p.secs, &p.latency.avg,
+		   &p.latency.max, &p.latency.count, &p.latency.count1,
+		   &p.latency.count2, &n) != 9 ||
+	    (testCase = test_by_name(name)) < 0)
+	{
+		fprintf(stderr, "Agent %s:%s sent \"%.40s\"\n", a->host, a->port, line);
+		exit(1);
+	}
 
-	/*
-	  Read testing
-	*/
-	if (args.testsToRun[READ_TEST])
-		do_test( thisTest, READ_TEST, FALSE, timeRead,
-				 "Waiting read threads to finish..." );
+	for(line += n; *line; line += n)
+	{
+		if (sscanf(line, " %d:%lu%n", &bucket, &count, &n) != 2 ||
+		    bucket < 0 || bucket >= LATENCY_BUCKETS)
+		{
+			fprintf(stderr, "Agent %s:%s sent a broken histogram\n", a->host, a->port);
+			exit(1);
+		}
+		p.latency.hist[bucket] = count;
+	}
 
-	/*
-	  RandomRead testing
-	*/
-	if (args.testsToRun[RANDOM_READ_TEST])
-		do_test( thisTest, RANDOM_READ_TEST, FALSE, timeRandomRead,
-				 "Waiting random read threads to finish...");
+	a->phase[testCase] = p;
 }
 
-static void add_timer(struct timeval* v, const struct timeval* start_time, const struct timeval* end_time)
+/*
+  Reads from an agent until it is ready for the next phase, returning
+  the phase, or is done, returning -1
+*/
+static int next_agent_phase( ClusterAgent *a )
 {
-	struct timeval tmp;
+	char *line = NULL;
+	size_t size = 0;
+	int testCase = -1;
 
-	assert(end_time->tv_sec >= start_time->tv_sec);
-	if(start_time->tv_sec == end_time->tv_sec)
+	for(;;)
 	{
-		assert(start_time->tv_usec <= end_time->tv_usec);
-	}
-
-	memset(&tmp, 0, sizeof(struct timeval));
+		if (read_protocol_line(a->in, &line, &size) == NULL)
+		{
+			fprintf(stderr, "Agent %s:%s closed the connection\n", a->host, a->port);
+			exit(1);
+		}
 
-	timersub(end_time, start_time, &tmp);
+		if (strncmp(line, "ready ", 6) == 0 &&
+		    (testCase = test_by_name(line + 6)) >= 0)
+			break;
+		if (strcmp(line, "done") == 0)
+			break;
+		parse_agent_phase(a, line);
+	}
 
-	timeradd(v, &tmp, v);
+	free(line);
+	return testCase;
 }
 
-static double timeval_to_secs(const struct timeval* v)
+/*
+  --controller: hands its arguments to every agent, then starts every
+  phase on all of them at once when the last one is ready for it
+*/
+static void run_controller( int argc, char *argv[] )
 {
-	double s;
+	int i, j, testCase;
 
-	s = v->tv_sec;
-	s += v->tv_usec / (1000.0*1000.0);
+	parse_agents(args.controller);
 
-	return s;
-}
+	for(i = 0; i < cluster.count; i++)
+	{
+		ClusterAgent *a = &cluster.agents[i];
 
-static float timeval_percentage_of(const struct timeval* value, const struct timeval* from, unsigned int divider)
-{
-	unsigned long long v;
-	float p;
+		connect_agent(a);
+		fprintf(a->out, "agent %d\n", i);
+		for(j = 1; j < argc; j++)
+		{
+			if (strchr(argv[j], '\n'))
+			{
+				fprintf(stderr, "Arguments for agents cannot hold newlines\n");
+				exit(1);
+			}
+			fprintf(a->out, "arg %s\n", argv[j]);
+		}
+		fprintf(a->out, "run\n");
+		fflush(a->out);
+	}
+
+	for(;;)
+	{
+		testCase = next_agent_phase(&cluster.agents[0]);
+		for(i = 1; i < cluster.count; i++)
+			if (next_agent_phase(&cluster.agents[i]) != testCase)
+			{
+				fprintf(stderr, "Agent %s:%s is out of step with the others\n",
+					cluster.agents[i].host, cluster.agents[i].port);
+				exit(1);
+			}
+
+		if (testCase < 0)
+			break;
+
+		for(i = 0; i < cluster.count; i++)
+		{
+			fprintf(cluster.agents[i].out, "go\n");
+			fflush(cluster.agents[i].out);
+		}
+	}
 
-	v = (100 * 100 * tv_to_usec(value)) / tv_to_usec(from);
+	for(i = 0; i < cluster.count; i++)
+	{
+		fclose(cluster.agents[i].in);
+		fclose(cluster.agents[i].out);
+	}
+}
 
-	p = (float)v / (100.0 * divider);
+static void print_cluster_line( const char *item, const char *agent,
+				const AgentPhase *p )
+{
+	const double rate = p->secs > 0 ? p->mbytes / p->secs : 0;
+	const double avg = p->latency.count ? p->latency.avg / p->latency.count : 0;
 
-	return p;
+	printf("| %-12s | %-22.22s | %6.1f s | %7.3f MB/s | %9.3f ms | %9.3f ms | %9.3f ms |\n",
+	       item, agent, p->secs, rate, avg * 1000,
+	       latency_percentile(&p->latency, 99) * 1000, p->latency.max * 1000);
 }
 
-static void print_results( ThreadTest *d )
-{
 /*
-  This is messy and should be rewritten but some of unixes, didn't
-  understand all printf options and long long formats.
+  Every phase per agent and over the cluster: the bytes of all agents
+  over the time of the slowest, as the phases started together, and
+  the latencies of all operations
 */
-	int i;
-	double totalBlocksWrite = 0, totalBlocksRead = 0,
-		totalBlocksRandomWrite = 0, totalBlocksRandomRead = 0;
-
-	double read_rate,write_rate,random_read_rate,random_write_rate;
-	struct timeval realtime_write, usrtime_write, systime_write;
-	struct timeval realtime_rwrite, usrtime_rwrite, systime_rwrite;
-	struct timeval realtime_read, usrtime_read, systime_read;
-	struct timeval realtime_rread, usrtime_rread, systime_rread;
-
-	double mbytesWrite, mbytesRandomWrite, mbytesRead, mbytesRandomRead;
-
-	double avgWriteLat=0, avgRWriteLat=0, avgReadLat=0, avgRReadLat=0;
-	double maxWriteLat=0, maxRWriteLat=0, maxReadLat=0, maxRReadLat=0;
-	double countWriteLat=0, countRWriteLat=0, countReadLat=0, countRReadLat=0;
-	double count1WriteLat=0, count1RWriteLat=0, count1ReadLat=0,
-		count1RReadLat=0;
-	double count2WriteLat=0, count2RWriteLat=0, count2ReadLat=0,
-		count2RReadLat=0;
-	double perc1WriteLat=0, perc1RWriteLat=0, perc1ReadLat=0,
-		perc1RReadLat=0;
-	double perc2WriteLat=0, perc2RWriteLat=0, perc2ReadLat=0,
-		perc2RReadLat=0;
-	double avgLat=0, maxLat=0, countLat=0, count1Lat=0, count2Lat=0,
-		perc1Lat=0, perc2Lat=0;
-
-	memset(&realtime_write, 0, sizeof(struct timeval));
-	memset(&usrtime_write, 0, sizeof(struct timeval));
-	memset(&systime_write, 0, sizeof(struct timeval));
-
-	memset(&realtime_rwrite, 0, sizeof(struct timeval));
-	memset(&usrtime_rwrite, 0, sizeof(struct timeval));
-	memset(&systime_rwrite, 0, sizeof(struct timeval));
-
-	memset(&realtime_read, 0, sizeof(struct timeval));
-	memset(&usrtime_read, 0, sizeof(struct timeval));
-	memset(&systime_read, 0, sizeof(struct timeval));
-
-	memset(&realtime_rread, 0, sizeof(struct timeval));
-	memset(&usrtime_rread, 0, sizeof(struct timeval));
-	memset(&systime_rread, 0, sizeof(struct timeval));
-
-	for(i = 0; i < d->numThreads; i++)
-	{
-		add_timer( &usrtime_write, &(d->threads[i].writeTimings.startUserTime), &(d->threads[i].writeTimings.stopUserTime) );
-		add_timer( &systime_write, &(d->threads[i].writeTimings.startSysTime), &(d->threads[i].writeTimings.stopSysTime) );
-
-		add_timer( &usrtime_rwrite, &(d->threads[i].randomWriteTimings.startUserTime), &(d->threads[i].randomWriteTimings.stopUserTime) );
-		add_timer( &systime_rwrite, &(d->threads[i].randomWriteTimings.startSysTime), &(d->threads[i].randomWriteTimings.stopSysTime) );
-
-		add_timer( &usrtime_read, &(d->threads[i].readTimings.startUserTime), &(d->threads[i].readTimings.stopUserTime) );
-		add_timer( &systime_read, &(d->threads[i].readTimings.startSysTime), &(d->threads[i].readTimings.stopSysTime) );
-
-		add_timer( &usrtime_rread, &(d->threads[i].randomReadTimings.startUserTime), &(d->threads[i].randomReadTimings.stopUserTime) );
-		add_timer( &systime_rread, &(d->threads[i].randomReadTimings.startSysTime), &(d->threads[i].randomReadTimings.stopSysTime) );
-
-		totalBlocksWrite       += d->threads[i].blocksWritten;
-		totalBlocksRandomWrite += d->threads[i].blocksRandomWritten;
-		totalBlocksRead        += d->threads[i].blocksRead;
-		totalBlocksRandomRead  += d->threads[i].blocksRandomRead;
-
-		avgWriteLat += d->threads[i].writeLatency.avg;
-		avgRWriteLat += d->threads[i].randomWriteLatency.avg;
-		avgReadLat += d->threads[i].readLatency.avg;
-		avgRReadLat += d->threads[i].randomReadLatency.avg;
-
-		avgLat += d->threads[i].writeLatency.avg;
-		avgLat += d->threads[i].randomWriteLatency.avg;
-		avgLat += d->threads[i].readLatency.avg;
-		avgLat += d->threads[i].randomReadLatency.avg;
-
-		countWriteLat += d->threads[i].writeLatency.count;
-		countRWriteLat += d->threads[i].randomWriteLatency.count;
-		countReadLat += d->threads[i].readLatency.count;
-		countRReadLat += d->threads[i].randomReadLatency.count;
-
-		count1WriteLat += d->threads[i].writeLatency.count1;
-		count1RWriteLat += d->threads[i].randomWriteLatency.count1;
-		count1ReadLat += d->threads[i].readLatency.count1;
-		count1RReadLat += d->threads[i].randomReadLatency.count1;
-
-		count2WriteLat += d->threads[i].writeLatency.count2;
-		count2RWriteLat += d->threads[i].randomWriteLatency.count2;
-		count2ReadLat += d->threads[i].readLatency.count2;
-		count2RReadLat += d->threads[i].randomReadLatency.count2;
-
-		countLat += d->threads[i].writeLatency.count;
-		countLat += d->threads[i].randomWriteLatency.count;
-		countLat += d->threads[i].readLatency.count;
-		countLat += d->threads[i].randomReadLatency.count;
-
-		count1Lat += d->threads[i].writeLatency.count1;
-		count1Lat += d->threads[i].randomWriteLatency.count1;
-		count1Lat += d->threads[i].readLatency.count1;
-		count1Lat += d->threads[i].randomReadLatency.count1;
-
-		count2Lat += d->threads[i].writeLatency.count2;
-		count2Lat += d->threads[i].randomWriteLatency.count2;
-		count2Lat += d->threads[i].readLatency.count2;
-		count2Lat += d->threads[i].randomReadLatency.count2;
-
-		if (maxWriteLat < d->threads[i].writeLatency.max)
-			maxWriteLat = d->threads[i].writeLatency.max;
-		if (maxRWriteLat < d->threads[i].randomWriteLatency.max)
-			maxRWriteLat = d->threads[i].randomWriteLatency.max;
-		if (maxReadLat < d->threads[i].readLatency.max)
-			maxReadLat = d->threads[i].readLatency.max;
-		if (maxRReadLat < d->threads[i].randomReadLatency.max)
-			maxRReadLat = d->threads[i].randomReadLatency.max;
-
-		if (maxLat < maxWriteLat)
-			maxLat = maxWriteLat;
-		if (maxLat < maxRWriteLat)
-			maxLat = maxRWriteLat;
-		if (maxLat < maxReadLat)
-			maxLat = maxReadLat;
-		if (maxLat <maxRReadLat)
-			maxLat = maxRReadLat;
-	}
-
-	if (countWriteLat > 0)
-	{
-		avgWriteLat /= countWriteLat;
-		perc1WriteLat = count1WriteLat*100.0/countWriteLat;
-		perc2WriteLat = count2WriteLat*100.0/countWriteLat;
-	}
-	else
-		avgWriteLat = 0;
-
-	if (countRWriteLat > 0)
-	{
-		avgRWriteLat /= countRWriteLat;
-		perc1RWriteLat = count1RWriteLat*100.0/countRWriteLat;
-		perc2RWriteLat = count2RWriteLat*100.0/countRWriteLat;
-	}
-	else
-		avgRWriteLat = 0;
+static void print_cluster_results( void )
+{
+	char name[KBYTE + 32];
+	int testCase, i;
 
-	if (countReadLat > 0)
+	if (!args.terse)
 	{
-		avgReadLat /= countReadLat;
-		perc1ReadLat = count1ReadLat*100.0/countReadLat;
-		perc2ReadLat = count2ReadLat*100.0/countReadLat;
+		printf("Tiotest cluster results for %d agents:\n", cluster.count);
+		printf(",--------------------------------------------------------------------------------------------------------------.\n");
+		printf("| Item         | Agent                  | Time     | Rate         | Avg latency  | 99%% latency  | Max latency  |\n");
 	}
-	else
-		avgReadLat = 0;
 
-	if (countRReadLat > 0)
+	for(testCase = 0; testCase < TEST_COUNT; testCase++)
 	{
-		avgRReadLat /= countRReadLat;
-		perc1RReadLat = count1RReadLat*100.0/countRReadLat;
-		perc2RReadLat = count2RReadLat*100.0/countRReadLat;
-	}
-	else
-		avgRReadLat = 0;
+		AgentPhase total;
 
-	if (countLat > 0)
-	{
-		avgLat /= countLat;
-		perc1Lat = count1Lat*100.0/countLat;
-		perc2Lat = count2Lat*100.0/countLat;
-	}
-	else
-		avgLat = 0;
+		memset(&total, 0, sizeof(total));
 
-	mbytesWrite = totalBlocksWrite /
-		((double)MBYTE/(double)(d->threads[0].blockSize));
-	mbytesRandomWrite = totalBlocksRandomWrite /
-		((double)MBYTE/(double)(d->threads[0].blockSize));
+		for(i = 0; i < cluster.count; i++)
+		{
+			const AgentPhase *p = &cluster.agents[i].phase[testCase];
 
-	mbytesRead = totalBlocksRead /
-		((double)MBYTE/(double)(d->threads[0].blockSize));
-	mbytesRandomRead = totalBlocksRandomRead /
-		((double)MBYTE/(double)(d->threads[0].blockSize));
+			total.blocks += p->blocks;
+			total.mbytes += p->mbytes;
+			total.secs = MAX(total.secs, p->secs);
+			merge_latencies(&total.latency, &p->latency);
+		}
 
-	add_timer( &realtime_write, &(d->totalTimeWrite.startRealTime), &(d->totalTimeWrite.stopRealTime) );
-	add_timer( &realtime_rwrite, &(d->totalTimeRandomWrite.startRealTime), &(d->totalTimeRandomWrite.stopRealTime) );
-	add_timer( &realtime_read, &(d->totalTimeRead.startRealTime), &(d->totalTimeRead.stopRealTime) );
-	add_timer( &realtime_rread, &(d->totalTimeRandomRead.startRealTime), &(d->totalTimeRandomRead.stopRealTime) );
+		if (!total.blocks)
+			continue;
 
-	if(args.terse)
-	{
-		printf("write:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
-		       mbytesWrite,
-		       timeval_to_secs(&realtime_write), timeval_to_secs(&usrtime_write)/d->numThreads, timeval_to_secs(&systime_write)/d->numThreads,
-		       avgWriteLat*1000, maxWriteLat*1000,
-		       perc1WriteLat, perc2WriteLat );
-
-		printf("rwrite:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
-		       mbytesRandomWrite,
-		       timeval_to_secs(&realtime_rwrite), timeval_to_secs(&usrtime_rwrite)/d->numThreads, timeval_to_secs(&systime_rwrite)/d->numThreads,
-		       avgRWriteLat*1000, maxRWriteLat*1000,
-		       perc1RWriteLat, perc2RWriteLat );
-
-		printf("read:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
-		       mbytesRead,
-		       timeval_to_secs(&realtime_read), timeval_to_secs(&usrtime_read)/d->numThreads, timeval_to_secs(&systime_read)/d->numThreads,
-		       avgReadLat*1000, maxReadLat*1000,
-		       perc1ReadLat, perc2ReadLat );
-
-		printf("rread:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
-		       mbytesRandomRead,
-		       timeval_to_secs(&realtime_rread), timeval_to_secs(&usrtime_rread)/d->numThreads, timeval_to_secs(&systime_rread)/d->numThreads,
-		       avgRReadLat*1000, maxRReadLat*1000,
-		       perc1RReadLat, perc2RReadLat );
+		if (args.terse)
+		{
+			for(i = 0; i < cluster.count; i++)
+			{
+				const AgentPhase *p = &cluster.agents[i].phase[testCase];
+
+				printf("cluster_%s_%d:%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+				       testNames[testCase], i, p->mbytes, p->secs,
+				       p->secs > 0 ? p->mbytes / p->secs : 0,
+				       p->latency.count ? p->latency.avg / p->latency.count * 1000 : 0,
+				       latency_percentile(&p->latency, 99) * 1000,
+				       p->latency.max * 1000);
+			}
 
-		printf("total:%.5f,%.5f,%.5f,%.5f\n",
-		       avgLat*1000, maxLat*1000, perc1Lat, perc2Lat );
+			printf("cluster_%s:%d,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n",
+			       testNames[testCase], cluster.count, total.mbytes, total.secs,
+			       total.secs > 0 ? total.mbytes / total.secs : 0,
+			       total.latency.count ? total.latency.avg / total.latency.count * 1000 : 0,
+			       latency_percentile(&total.latency, 99) * 1000,
+			       total.latency.max * 1000);
+			continue;
+		}
 
-		return;
+		printf("+--------------+------------------------+----------+--------------+--------------+--------------+--------------+\n");
+		for(i = 0; i < cluster.count; i++)
+		{
+			snprintf(name, sizeof(name), "%s:%s",
+				 cluster.agents[i].host, cluster.agents[i].port);
+			print_cluster_line(i ? "" : testTitles[testCase], name,
+					   &cluster.agents[i].phase[testCase]);
+		}
+		print_cluster_line("", "Cluster", &total);
 	}
 
-	write_rate = mbytesWrite / timeval_to_secs(&realtime_write);
-	random_write_rate = mbytesRandomWrite / timeval_to_secs(&realtime_rwrite);
+	if (!args.terse)
+		printf("`--------------+------------------------+----------+--------------+--------------+--------------+--------------'\n");
+}
 
-	read_rate  = mbytesRead / timeval_to_secs(&realtime_read);
-	random_read_rate  = mbytesRandomRead / timeval_to_secs(&realtime_rread);
+static void set_default_args( ArgumentOptions *args )
+{
+	int i;
 
-	printf("Tiotest results for %d concurrent io threads:\n",
-	       d->numThreads);
+	memset(args, 0, sizeof(ArgumentOptions));
+	strcpy(args->path[0], DEFAULT_DIRECTORY );
+	args->pathsCount = 1;
+	args->fileSizeInMBytes = DEFAULT_FILESIZE;
+	args->blockSize = DEFAULT_BLOCKSIZE;
+	args->numThreads = DEFAULT_THREADS;
+	args->numRandomOps = DEFAULT_RANDOM_OPS;
+	args->debugLevel = DEFAULT_DEBUG_LEVEL;
+	args->verbose = FALSE;
+	args->terse = FALSE;
+	args->use_mmap = FALSE;
+	args->consistencyCheckData = FALSE;
+	args->syncWriting = FALSE;
+	args->rawDrives = FALSE;
+	args->showLatency = TRUE;
+	args->threadOffset = DEFAULT_RAW_OFFSET;
+	args->useThreadOffsetForFirstThread = FALSE;
+	args->flushCaches = FALSE;
+	args->walRecords = DEFAULT_WAL_RECORDS;
+	args->walRecordMin = DEFAULT_WAL_RECORD_MIN;
+	args->walRecordMax = DEFAULT_WAL_RECORD_MAX;
+	args->walBatch = DEFAULT_WAL_BATCH;
+	args->replaceFiles = DEFAULT_REPLACE_FILES;
+	args->replaceOps = DEFAULT_REPLACE_OPS;
+	args->replaceSize = DEFAULT_REPLACE_SIZE;
+	args->discardOps = DEFAULT_DISCARD_OPS;
+	args->discardMin = args->discardMax = DEFAULT_DISCARD_SIZE;
+	args->kneeTest = -1;
+	args->kneeMaxThreads = DEFAULT_KNEE_MAX_THREADS;
+	args->kneeStepTime = DEFAULT_KNEE_STEP_TIME;
+	args->kneeGain = DEFAULT_KNEE_GAIN;
+	args->steadyRounds = DEFAULT_STEADY_ROUNDS;
+	args->steadyWindow = DEFAULT_STEADY_WINDOW;
+	args->steadyTime = DEFAULT_STEADY_TIME;
+	args->steadyBand = DEFAULT_STEADY_BAND;
+	args->steadySlope = DEFAULT_STEADY_SLOPE;
+	args->compressRatio = 1;
+	args->dedupeRatio = 1;
 
-	printf(",----------------------------------------------------------------------.\n");
-	printf("| Item                  | Time     | Rate         | Usr CPU  | Sys CPU |\n");
-	printf("+-----------------------+----------+--------------+----------+---------+\n");
+	for(i = 0; i < TEST_COUNT; i++)
+	{
+		args->testsToRun[i] = 1;
+		args->fadvise[i] = -1;
+		args->access[i].kind = -1;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	ThreadTest test;
+	int i, status = 0;
 
-	if(totalBlocksWrite)
-		printf("| Write %11.0f MBs | %6.1f s | %7.3f MB/s | %5.1f %%  | %5.1f %% |\n",
-		       mbytesWrite,
-		       timeval_to_secs(&realtime_write),write_rate,
-		       timeval_percentage_of(&usrtime_write, &realtime_write, d->numThreads),
-		       timeval_percentage_of(&systime_write, &realtime_write, d->numThreads) );
-
-	if(totalBlocksRandomWrite)
-		printf("| Random Write %4.0f MBs | %6.1f s | %7.3f MB/s | %5.1f %%  | %5.1f %% |\n",
-		       mbytesRandomWrite,
-		       timeval_to_secs(&realtime_rwrite),random_write_rate,
-		       timeval_percentage_of(&usrtime_rwrite, &realtime_rwrite, d->numThreads),
-		       timeval_percentage_of(&systime_rwrite, &realtime_rwrite, d->numThreads) );
-
-	if(totalBlocksRead)
-		printf("| Read %12.0f MBs | %6.1f s | %7.3f MB/s | %5.1f %%  | %5.1f %% |\n",
-		       mbytesRead,
-		       timeval_to_secs(&realtime_read),read_rate,
-		       timeval_percentage_of(&usrtime_read, &realtime_read, d->numThreads),
-		       timeval_percentage_of(&systime_read, &realtime_read, d->numThreads) );
-
-
-	if(totalBlocksRandomRead)
-		printf("| Random Read %5.0f MBs | %6.1f s | %7.3f MB/s | %5.1f %%  | %5.1f %% |\n",
-		       mbytesRandomRead,
-		       timeval_to_secs(&realtime_rread),random_read_rate,
-		       timeval_percentage_of(&usrtime_rread, &realtime_rread, d->numThreads),
-		       timeval_percentage_of(&systime_rread, &realtime_rread, d->numThreads) );
+	set_default_args( &args );
+	parse_args( &args, argc, argv );
 
-	printf("`----------------------------------------------------------------------'\n");
+	if (!args.agentToken[0] && getenv("TIOTEST_AGENT_TOKEN"))
+		snprintf(args.agentToken, sizeof(args.agentToken), "%s",
+			 getenv("TIOTEST_AGENT_TOKEN"));
 
-	if (args.showLatency)
+	if (args.agentPort[0])
 	{
-		printf("Tiotest latency results:\n");
+		if (args.controller[0])
+		{
+			fprintf(stderr, "--agent does not mix with --controller\n");
+			exit(1);
+		}
 
-		printf(",-------------------------------------------------------------------------.\n");
-		printf("| Item         | Average latency | Maximum latency | %% >%d sec | %% >%d sec |\n", 
-		       LATENCY_STAT1, LATENCY_STAT2);
-		printf("+--------------+-----------------+-----------------+----------+-----------+\n");
+		if (!args.agentToken[0])
+		{
+			fprintf(stderr, "--agent needs --agent-token or $TIOTEST_AGENT_TOKEN\n");
+			exit(1);
+		}
 
-		if(totalBlocksWrite)
-			printf("| Write        | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
-			       avgWriteLat*1000, maxWriteLat*1000, perc1WriteLat,
-			       perc2WriteLat);
+		save_agent_limits();
 
-		if(totalBlocksRandomWrite)
-			printf("| Random Write | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
-			       avgRWriteLat*1000, maxRWriteLat*1000, perc1RWriteLat,
-			       perc2RWriteLat);
+		/* returns in a worker with the arguments of a controller */
+		serve_agent( &argc, &argv );
 
-		if(totalBlocksRead)
-			printf("| Read         | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
-			       avgReadLat*1000, maxReadLat*1000, perc1ReadLat,
-			       perc2ReadLat);
+		set_default_args( &args );
+		optind = 1;
+		parse_args( &args, argc, argv );
 
-		if(totalBlocksRandomRead)
-			printf("| Random Read  | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
-			       avgRReadLat*1000, maxRReadLat*1000, perc1RReadLat,
-			       perc2RReadLat);
+		/* sent along with the rest */
+		args.controller[0] = 0;
 
-		printf("|--------------+-----------------+-----------------+----------+-----------|\n");
+		if (args.agentPort[0])
+		{
+			fprintf(stderr, "Agents do not take --agent from controllers\n");
+			exit(1);
+		}
 
-		printf("| Total        | %12.3f ms | %12.3f ms | %8.5f | %9.5f |\n",
-		       avgLat*1000, maxLat*1000, perc1Lat, perc2Lat);
+		check_agent_request();
+	}
+	else if (args.controller[0] && !args.agentToken[0])
+	{
+		fprintf(stderr, "--controller needs --agent-token or $TIOTEST_AGENT_TOKEN\n");
+		exit(1);
+	}
 
-		printf("`--------------+-----------------+-----------------+----------+-----------'\n\n");
+	if (args.wal && args.rawDrives)
+	{
+		fprintf(stderr, "The write-ahead log workload needs a directory, not a raw device\n");
+		exit(1);
 	}
-}
 
+	if (args.replace && args.rawDrives)
+	{
+		fprintf(stderr, "The atomic replace phase needs a directory, not a raw device\n");
+		exit(1);
+	}
 
-/*
- * p{write,read} functions
- */
+	if (args.jobFile[0])
+	{
+		if (args.rawDrives || args.use_mmap || args.wal ||
+		    args.replace || args.discard || args.discardMix || args.replayFile[0])
+		{
+			fprintf(stderr, "Job files do not mix with -R, -M, --wal, --replace, --discard or --replay\n");
+			exit(1);
+		}
 
-//
-// define functions to get the next offset for the next I/O operation
-//
+		load_job_file(args.jobFile);
+	}
 
-static TIO_off_t get_sequential_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
-{
-	return current_offset + d->blockSize;
-}
+	if (args.kneeTest >= 0)
+	{
+		if (args.use_mmap || args.wal || args.replace || args.discard ||
+		    args.discardMix || args.replayFile[0] || args.jobFile[0])
+		{
+			fprintf(stderr, "--knee does not mix with -M, --wal, --replace, --discard, --replay or --job\n");
+			exit(1);
+		}
 
-static TIO_off_t get_random_offset(TIO_off_t current_offset, ThreadData *d, unsigned int *seed)
-{
-	TIO_off_t blocks=(d->fileSizeInMBytes*MBYTE/d->blockSize);
-	TIO_off_t offset = get_random_number(blocks, seed) * d->blockSize;
+		args.numThreads = args.kneeMaxThreads;
+	}
 
-	return d->fileOffset + offset;
-}
+	if (args.sweepThreadsCount || args.sweepBlocksCount)
+	{
+		if (args.wal || args.replace || args.discard || args.discardMix ||
+		    args.replayFile[0] || args.jobFile[0] || args.kneeTest >= 0)
+		{
+			fprintf(stderr, "Sweeps do not mix with --wal, --replace, --discard, --replay, --job or --knee\n");
+			exit(1);
+		}
 
-//
-// define READ/WRITE operations on file descriptors
-//
+		if (args.sweepThreadsCount == 0)
+			args.sweepThreads[args.sweepThreadsCount++] = args.numThreads;
+		if (args.sweepBlocksCount == 0)
+			args.sweepBlocks[args.sweepBlocksCount++] = args.blockSize;
 
-static int do_pread_operation(int fd, TIO_off_t offset, ThreadData *d)
-{
-	ssize_t rc = TIO_pread( fd, d->buffer, d->blockSize, offset );
-	if( rc != d->blockSize ) {
-		if( rc == -1 ) {
-			perror("Error " xstr(TIO_pread) "()ing to file");
-		} else {
-			fprintf(stderr, "Tried to read %ld bytes from offset " OFFSET_FORMAT " of file %s of length " OFFSET_FORMAT ", but only read %d bytes\n", d->blockSize, offset, d->fileName, d->fileSizeInMBytes*MB, rc);
+		if (args.sweepBlocksCount > 1 && args.consistencyCheckData)
+		{
+			fprintf(stderr, "Consistency checks need a single block size\n");
+			exit(1);
 		}
 
-		return -1;
+		/* threads and buffers for the largest configuration */
+		args.numThreads = 0;
+		for(i = 0; i < args.sweepThreadsCount; i++)
+			args.numThreads = MAX(args.numThreads, args.sweepThreads[i]);
+		args.blockSize = 0;
+		for(i = 0; i < args.sweepBlocksCount; i++)
+			args.blockSize = MAX(args.blockSize, args.sweepBlocks[i]);
 	}
-	else {
-		if( args.consistencyCheckData )
+
+	if (args.steadyState)
+	{
+		if (args.use_mmap || args.wal || args.replayFile[0] || args.jobFile[0] ||
+		    args.kneeTest >= 0 || args.sweepThreadsCount || args.sweepBlocksCount)
 		{
-			const unsigned crc = crc32(d->buffer, d->blockSize, 0);
+			fprintf(stderr, "--steady-state does not mix with -M, --wal, --replay, --job, --knee or sweeps\n");
+			exit(1);
+		}
 
-			if(crc != d->bufferCrc)
-			{
-				fprintf(stderr, "Thread(%lu) consistency check failed at offset %Lu\n", d->myNumber, (long long unsigned int)offset);
-				return -1;
-			}
+		if (args.steadyWindow > args.steadyRounds)
+		{
+			fprintf(stderr, "The steady state window is longer than the rounds\n");
+			exit(1);
 		}
 	}
 
-	return 0;
-}
-
-static int do_pwrite_operation(int fd, TIO_off_t offset, ThreadData *d)
-{
-	ssize_t rc = TIO_pwrite( fd, d->buffer, d->blockSize, offset );
-	if( rc  != d->blockSize ) {
-		if( rc == -1 ) {
-			perror("Error " xstr(TIO_pwrite) "()ing to file");
-		} else {
-			fprintf(stderr, "Tried to write %ld bytes from offset " OFFSET_FORMAT " of file %s of length " OFFSET_FORMAT ", but only wrote %d bytes\n", d->blockSize, offset, d->fileName, d->fileSizeInMBytes*MB, rc);
+	for(i = 0; i < TEST_COUNT; i++)
+		if (args.readahead[i] && args.use_mmap)
+		{
+			fprintf(stderr, "--readahead does not mix with -M\n");
+			exit(1);
 		}
-		return -1;
+
+	/* the cache is only set up and measured around the regular phases */
+	if (cache_control_used() &&
+	    (args.jobFile[0] || args.kneeTest >= 0 || args.wal || args.replayFile[0]))
+	{
+		fprintf(stderr, "--evict, --fadvise and --readahead do not mix with --job, --knee, --wal or --replay\n");
+		exit(1);
 	}
 
-	return 0;
-}
+	/* only the regular phases run a ramp before measuring */
+	if ((args.rampOps || args.rampSecs) &&
+	    (args.use_mmap || args.sequentialWriting || args.jobFile[0] || args.kneeTest >= 0 ||
+	     args.steadyState || args.wal || args.replace || args.replayFile[0] || args.discard || args.discardMix))
+	{
+		fprintf(stderr, "--ramp does not mix with -M, -W, --job, --knee, --steady-state, --wal, --replace, --replay, --discard or --discard-mix\n");
+		exit(1);
+	}
 
-/*
- * MMAP functions
- */
+	if (args.mlockBytes && args.pageCache)
+	{
+		fprintf(stderr, "--mlock does not mix with --page-cache\n");
+		exit(1);
+	}
 
-// 
-// define functions to get the next memory location for the next mmap operation
-//
+	/* their threads share a log and queues in the address space */
+	if (args.processes && (args.wal || args.replayFile[0]))
+	{
+		fprintf(stderr, "--processes does not mix with --wal or --replay\n");
+		exit(1);
+	}
 
-static void *get_sequential_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
-{
-	return current_loc + d->blockSize;
-}
+	/* only phases of the regular tests are started together */
+	if ((args.controller[0] || agentLink.out) &&
+	    (args.wal || args.replace || args.discard || args.discardMix ||
+	     args.replayFile[0] || args.jobFile[0] || args.kneeTest >= 0 ||
+	     args.sweepThreadsCount || args.sweepBlocksCount || args.oplogFile[0] ||
+	     args.steadyState))
+	{
+		fprintf(stderr, "--controller does not mix with --wal, --replace, --discard, --replay, --job, --knee, sweeps, --oplog or --steady-state\n");
+		exit(1);
+	}
 
-static void *get_random_loc(void *base_loc, void *current_loc, ThreadData *d, unsigned int *seed)
-{
-	// limit ourselves to a single (the current) mmap chunk for now, just easier
-	TIO_off_t max_bytes = MIN(MMAP_CHUNK_SIZE, d->fileSizeInMBytes*MBYTE);
-	TIO_off_t blocks    = (max_bytes/d->blockSize);
-	TIO_off_t offset    = get_random_number(blocks, seed) * d->blockSize;
+	if (args.discard || args.discardMix)
+	{
+		/* reads of discarded blocks come back zeroed */
+		if (args.use_mmap || args.consistencyCheckData || args.wal || args.replayFile[0])
+		{
+			fprintf(stderr, "--discard and --discard-mix do not mix with -M, -c, --wal or --replay\n");
+			exit(1);
+		}
 
-	return base_loc + offset;
-}
+		if (args.discardMax > (unsigned long long)args.fileSizeInMBytes * MBYTE)
+		{
+			fprintf(stderr, "Discarded ranges are larger than the files\n");
+			exit(1);
+		}
+	}
 
-//
-// define functions to perform the next mmap-based read or write
-//
+	stonewall = tt_shared_alloc(sizeof(Stonewall));
+	ramp = tt_shared_alloc(sizeof(Ramp));
+	perfUserOnly = tt_shared_alloc(sizeof(int));
+	if (stonewall == NULL || ramp == NULL || perfUserOnly == NULL)
+	{
+		perror("Error allocating phase state memory");
+		exit(-1);
+	}
 
-static int do_mmap_read_operation(void *loc, ThreadData *d)
-{
-	memcpy(d->buffer, loc, d->blockSize);
+	if (args.compressRatio > 1 || args.dedupeRatio > 1 || args.unique)
+	{
+		/* the data changes with every write */
+		if (args.consistencyCheckData)
+		{
+			fprintf(stderr, "--compress, --dedupe and --unique do not mix with -c\n");
+			exit(1);
+		}
 
-	if( args.consistencyCheckData )
+		if (!args.controller[0])
+			init_patterns();
+	}
+
+	/* offsets of the other patterns are in steps of one block size */
+	for(i = 0; i < TEST_COUNT; i++)
 	{
-		const unsigned crc = crc32(d->buffer, d->blockSize, 0);
+		int blockDist = args.blockDist[i].count > 0, j;
 
-		if(crc != d->bufferCrc)
+		for(j = 0; j < jobs.count; j++)
+			if (jobs.groups[j].testCase == i && jobs.groups[j].blockDist.count)
+				blockDist = TRUE;
+
+		if (args.access[i].kind > ACCESS_RANDOM && blockDist)
 		{
-			fprintf(stderr, "Thread(%lu) mmap consistency check failed at 0x%p\n", d->myNumber, loc);
-			return -1;
+			fprintf(stderr, "--access %s does not mix with --bsdist\n",
+				accessNames[args.access[i].kind]);
+			exit(1);
 		}
-	}
 
-	return 0;
-}
+		/* interleaved streams split the file in regions of whole blocks */
+		if (args.access[i].kind == ACCESS_INTERLEAVE &&
+		    (unsigned long)args.blockSize > (unsigned long)args.fileSizeInMBytes * MBYTE)
+		{
+			fprintf(stderr, "--access interleave needs files of at least one block\n");
+			exit(1);
+		}
+	}
 
-static int do_mmap_write_operation(void *loc, ThreadData *d)
-{
-	memcpy(loc, d->buffer, d->blockSize);
+	if (block_dists_used())
+	{
+		if (args.use_mmap || args.consistencyCheckData)
+		{
+			fprintf(stderr, "Block size distributions do not mix with -M or -c\n");
+			exit(1);
+		}
 
-	return 0;
-}
+		for(i = 0; i < TEST_COUNT; i++)
+			check_block_dist(&args.blockDist[i], args.fileSizeInMBytes,
+					 testNames[i]);
+		for(i = 0; i < jobs.count; i++)
+			check_block_dist(&jobs.groups[i].blockDist,
+					 jobs.groups[i].fileSizeInMBytes,
+					 jobs.groups[i].name);
+	}
 
-////////////////////////////////////////////////////////////////////////////////////
+	if (args.controller[0])
+	{
+		run_controller( argc, argv );
+		print_cluster_results();
+		return 0;
+	}
 
-int main(int argc, char *argv[])
-{
-	ThreadTest test;
-	int i;
+	if (args.memLimit || args.mlockBytes || args.pageCache)
+		apply_memory_pressure();
 
-	strcpy(args.path[0], DEFAULT_DIRECTORY );
-	args.pathsCount = 1;
-	args.fileSizeInMBytes = DEFAULT_FILESIZE;
-	args.blockSize = DEFAULT_BLOCKSIZE;
-	args.numThreads = DEFAULT_THREADS;
-	args.numRandomOps = DEFAULT_RANDOM_OPS;
-	args.debugLevel = DEFAULT_DEBUG_LEVEL;
-	args.verbose = FALSE;
-	args.terse = FALSE;
-	args.use_mmap = FALSE;
-	args.consistencyCheckData = FALSE;
-	args.syncWriting = FALSE;
-	args.rawDrives = FALSE;
-	args.showLatency = TRUE;
-	args.threadOffset = DEFAULT_RAW_OFFSET;
-	args.useThreadOffsetForFirstThread = FALSE;
-	args.flushCaches = FALSE;
+	if (args.diskStats)
+		find_disks();
 
-	for(i = 0; i < TEST_COUNT; i++)
-		args.testsToRun[i] = 1;
+	if (args.jobFile[0])
+		initialize_job_test( &test );
+	else
+		initialize_test( &test );
 
-	parse_args( &args, argc, argv );
+	if (args.oplogFile[0])
+		open_oplog( &test );
 
-	initialize_test( &test );
+	if (args.jobFile[0])
+	{
+		do_job_test( &test );
+		print_job_results( &test );
+	}
+	else if (args.kneeTest >= 0)
+	{
+		do_knee_test( &test );
+		print_knee_results( &test );
+	}
+	else if (args.sweepThreadsCount || args.sweepBlocksCount)
+		do_sweep_test( &test );
+	else if (args.replayFile[0])
+	{
+		do_replay_test( &test );
+		print_replay_results( &test );
+	}
+	else if (args.wal)
+	{
+		if (do_wal_test( &test ) == 0)
+			print_wal_results( &test );
+		else
+			status = 1;
+	}
+	else
+	{
+		if (args.steadyState)
+		{
+			do_steady_state_test( &test );
+			print_steady_results();
+		}
 
-	do_tests( &test );
+		do_tests( &test );
+		if (agentLink.out)
+			agent_report( &test );
+		print_results( &test );
+	}
 
-	print_results( &test );
+	if (args.oplogFile[0])
+		close_oplog();
 
 	cleanup_test( &test );
 
-	return 0;
+	return status;
 }